@@ -4,12 +4,59 @@
 using namespace std;
 using namespace uav_utils;
 
+// A preallocated message published every tick. roscpp serializes it in publish() for other
+// processes but hands the pointer itself to subscribers in this process (nodelets), so it is only
+// written in place once they have released it, which is every tick unless one of them lags behind.
+template <typename M>
+static M &writable(boost::shared_ptr<M> &msg) {
+  if (!msg.unique()) msg = boost::make_shared<M>(*msg);
+  return *msg;
+}
+
 PX4CtrlFSM::PX4CtrlFSM(Parameter_t &param_, std::shared_ptr<ControlBase> controller_)
     : param(param_)
     , controller_ptr(controller_) /*, thrust_curve(thrust_curve_)*/
 {
   state = MANUAL_CTRL;
   hover_pose.setZero();
+  supervisor_divider = 1;
+  if (param.supervisor_freq > 0)
+    supervisor_divider = std::max(1, (int)std::lround(param.ctrl_freq_max / param.supervisor_freq));
+  debug_divider = 1;
+  if (param.debug.rate > 0)
+    debug_divider = std::max(1, (int)std::lround(param.ctrl_freq_max / param.debug.rate));
+  set_clock(std::make_shared<RosClock>());
+
+  trigger_msg                          = boost::make_shared<geometry_msgs::PoseStamped>();
+  trigger_msg->header.frame_id         = "world";
+  bodyrate_target_msg                  = boost::make_shared<mavros_msgs::AttitudeTarget>();
+  bodyrate_target_msg->header.frame_id = "FCU";
+  bodyrate_target_msg->type_mask       = mavros_msgs::AttitudeTarget::IGNORE_ATTITUDE;
+  attitude_target_msg                  = boost::make_shared<mavros_msgs::AttitudeTarget>();
+  attitude_target_msg->header.frame_id = "FCU";
+  attitude_target_msg->type_mask       = mavros_msgs::AttitudeTarget::IGNORE_ROLL_RATE |
+                                         mavros_msgs::AttitudeTarget::IGNORE_PITCH_RATE |
+                                         mavros_msgs::AttitudeTarget::IGNORE_YAW_RATE;
+
+  if (param.imu_filter.enable)
+    imu_data.a_filter.configure(param.imu_filter.sample_rate, param.imu_filter.lpf_cutoff,
+                                param.imu_filter.notch_num, param.imu_filter.notch_freq,
+                                param.imu_filter.notch_q);
+  if (param.vib.enable) {
+    imu_data.vibration = std::make_shared<VibrationAnalyzer>(
+        param.imu_filter.sample_rate, param.vib.min_freq, param.vib.publish_rate);
+    imu_data.vibration_notches = param.vib.drive_notches;
+  }
+}
+
+void PX4CtrlFSM::set_clock(std::shared_ptr<Clock> clock_) {
+  clock                   = clock_;
+  rc_data.clock           = clock_;
+  odom_data.clock         = clock_;
+  imu_data.clock          = clock_;
+  cmd_data.clock          = clock_;
+  bat_data.clock          = clock_;
+  takeoff_land_data.clock = clock_;
 }
 
 /*
@@ -37,281 +84,448 @@ PX4CtrlFSM::PX4CtrlFSM(Parameter_t &param_, std::shared_ptr<ControlBase> control
 
 */
 
+/*
+  The transitions of the diagram, per state in order of priority. Guards may log why a request is
+  rejected, and guard_disarmed() has to ask the FCU. Actions run once on the transition, the
+  during function of a state runs on every supervisory tick that no transition fires. All of them
+  belong to the supervisory rate group, the reference functions to the control rate.
+*/
+const PX4CtrlFSM::Transition PX4CtrlFSM::TRANSITIONS[] = {
+    // from          to            guard
+    {MANUAL_CTRL, AUTO_HOVER, "hover_switch", &PX4CtrlFSM::guard_hover_switch,
+     &PX4CtrlFSM::enter_hover_from_manual, false},
+    {MANUAL_CTRL, AUTO_TAKEOFF, "takeoff_cmd", &PX4CtrlFSM::guard_takeoff_cmd,
+     &PX4CtrlFSM::enter_takeoff, false},
+
+    {AUTO_HOVER, MANUAL_CTRL, "rc_or_odom_lost", &PX4CtrlFSM::guard_rc_or_odom_lost,
+     &PX4CtrlFSM::enter_manual, true},
+    {AUTO_HOVER, CMD_CTRL, "cmd_ready", &PX4CtrlFSM::guard_cmd_ready, nullptr, false},
+    {AUTO_HOVER, AUTO_LAND, "land_cmd", &PX4CtrlFSM::guard_land_cmd, &PX4CtrlFSM::enter_land,
+     false},
+
+    // never fires, logs the rejection
+    {CMD_CTRL, AUTO_LAND, "land_cmd", &PX4CtrlFSM::guard_land_rejected, nullptr, false},
+    {CMD_CTRL, MANUAL_CTRL, "rc_or_odom_lost", &PX4CtrlFSM::guard_rc_or_odom_lost,
+     &PX4CtrlFSM::enter_manual, true},
+    {CMD_CTRL, AUTO_HOVER, "cmd_lost", &PX4CtrlFSM::guard_cmd_lost, &PX4CtrlFSM::enter_hover_here,
+     false},
+
+    {AUTO_TAKEOFF, AUTO_HOVER, "height_reached", &PX4CtrlFSM::guard_height_reached,
+     &PX4CtrlFSM::enter_hover_after_takeoff, false},
+
+    {AUTO_LAND, MANUAL_CTRL, "rc_or_odom_lost", &PX4CtrlFSM::guard_rc_or_odom_lost,
+     &PX4CtrlFSM::enter_manual, true},
+    {AUTO_LAND, AUTO_HOVER, "command_switch_off", &PX4CtrlFSM::guard_command_switch_off,
+     &PX4CtrlFSM::enter_hover_here, false},
+    {AUTO_LAND, MANUAL_CTRL, "disarmed", &PX4CtrlFSM::guard_disarmed,
+     &PX4CtrlFSM::enter_manual_disarmed, false},
+};
+
+const PX4CtrlFSM::Action PX4CtrlFSM::DURING[] = {
+    &PX4CtrlFSM::during_manual, &PX4CtrlFSM::during_hover, nullptr, &PX4CtrlFSM::during_takeoff,
+    &PX4CtrlFSM::during_land,
+};
+
+const PX4CtrlFSM::Reference PX4CtrlFSM::REFERENCE[] = {
+    nullptr,  // the odometry, px4ctrl is not in control
+    &PX4CtrlFSM::reference_hover,
+    &PX4CtrlFSM::reference_cmd_ctrl,
+    &PX4CtrlFSM::reference_takeoff,
+    &PX4CtrlFSM::reference_land,
+};
+
+const char *PX4CtrlFSM::state_name(int s) {
+  static const char *NAMES[] = {"MANUAL_CTRL(L1)", "AUTO_HOVER(L2)", "CMD_CTRL(L3)",
+                                "AUTO_TAKEOFF", "AUTO_LAND"};
+  return s >= MANUAL_CTRL && s <= AUTO_LAND ? NAMES[s - MANUAL_CTRL] : "?";
+}
+
+const char *PX4CtrlFSM::latency_name(int k) {
+  static const char *NAMES[] = {"offboard_ack", "arm_ack", "takeoff_airborne", "takeoff_hover",
+                                "land_disarmed"};
+  return k >= 0 && k < LATENCY_NUM ? NAMES[k] : "?";
+}
+
+/*
+  Two rate groups in the thread of process(). The fast one, every tick, goes first: reference
+  generation, thrust model estimate, controller, publishing and the black box, from the state the
+  last supervisory tick left. The supervisory one, every supervisor_divider-th tick, runs after
+  the setpoint is out: the land detector, the state machine, whose actions may wait on mavros
+  services, the flag clearing and the thrust model saving. A transition takes effect on the next
+  tick, and the setpoint of a tick never waits for the state machine.
+*/
 void PX4CtrlFSM::process() {
-  ros::Time           now_time = ros::Time::now();
+  typedef std::chrono::steady_clock clk;
+  clk::time_point                   tick_start = clk::now();
+
+  ros::Time now_time  = clock->now();  // the only clock read of this tick
+  uint64_t  tick      = tick_count++;
+  bool      supervise = tick % supervisor_divider == 0;
+
   Controller_Output_t u;
-  Desired_State_t     des(odom_data);
-  bool                rotor_low_speed_during_land = false;
+  Tick                t(now_time, odom_data);
+  if (REFERENCE[state - MANUAL_CTRL]) (this->*REFERENCE[state - MANUAL_CTRL])(t);
+  Desired_State_t &des                         = t.des;
+  bool             rotor_low_speed_during_land = t.rotor_low_speed_during_land;
 
-  // STEP1: state machine runs
-  switch (state) {
-    case MANUAL_CTRL: {
-      if (rc_data.enter_hover_mode)  // Try to jump to AUTO_HOVER
-      {
-        if (!odom_is_received(now_time)) {
-          ROS_ERROR("[px4ctrl] Reject AUTO_HOVER(L2). No odom!");
-          break;
-        }
-        if (cmd_is_received(now_time)) {
-          ROS_ERROR(
-              "[px4ctrl] Reject AUTO_HOVER(L2). You are sending commands before toggling into "
-              "AUTO_HOVER, which is not allowed. Stop sending commands now!");
-          break;
-        }
-        if (odom_data.v.norm() > 3.0) {
-          ROS_ERROR(
-              "[px4ctrl] Reject AUTO_HOVER(L2). Odom_Vel=%fm/s, which seems that the locolization "
-              "module goes wrong!",
-              odom_data.v.norm());
-          break;
-        }
-
-        state = AUTO_HOVER;
-        controller_ptr->resetThrustMapping();
-        set_hov_with_odom();
-        toggle_offboard_mode(true);
-
-        ROS_INFO("\033[32m[px4ctrl] MANUAL_CTRL(L1) --> AUTO_HOVER(L2)\033[32m");
-      } else if (param.takeoff_land.enable && takeoff_land_data.triggered &&
-                 takeoff_land_data.takeoff_land_cmd ==
-                     quadrotor_msgs::TakeoffLand::TAKEOFF)  // Try to jump to AUTO_TAKEOFF
-      {
-        if (!odom_is_received(now_time)) {
-          ROS_ERROR("[px4ctrl] Reject AUTO_TAKEOFF. No odom!");
-          break;
-        }
-        if (cmd_is_received(now_time)) {
-          ROS_ERROR(
-              "[px4ctrl] Reject AUTO_TAKEOFF. You are sending commands before toggling into "
-              "AUTO_TAKEOFF, which is not allowed. Stop sending commands now!");
-          break;
-        }
-        if (odom_data.v.norm() > 0.1) {
-          ROS_ERROR(
-              "[px4ctrl] Reject AUTO_TAKEOFF. Odom_Vel=%fm/s, non-static takeoff is not allowed!",
-              odom_data.v.norm());
-          break;
-        }
-        if (!get_landed()) {
-          ROS_ERROR(
-              "[px4ctrl] Reject AUTO_TAKEOFF. land detector says that the drone is not landed "
-              "now!");
-          break;
-        }
-        if (rc_is_received(now_time))  // Check this only if RC is connected.
-        {
-          if (!rc_data.is_hover_mode || !rc_data.is_command_mode || !rc_data.check_centered()) {
-            ROS_ERROR(
-                "[px4ctrl] Reject AUTO_TAKEOFF. If you have your RC connected, keep its switches "
-                "at \"auto hover\" and \"command control\" states, and all sticks at the center, "
-                "then takeoff again.");
-            while (ros::ok()) {
-              ros::Duration(0.01).sleep();
-              ros::spinOnce();
-              if (rc_data.is_hover_mode && rc_data.is_command_mode && rc_data.check_centered()) {
-                ROS_INFO("\033[32m[px4ctrl] OK, you can takeoff again.\033[32m");
-                break;
-              }
-            }
-            break;
-          }
-        }
-
-        state = AUTO_TAKEOFF;
-        controller_ptr->resetThrustMapping();
-        set_start_pose_for_takeoff_land(odom_data);
-        ROS_INFO("try mode change!");
-        toggle_offboard_mode(true);  // toggle on offboard before arm
-
-        for (int i = 0; i < 10 && ros::ok();
-             ++i)  // wait for 0.1 seconds to allow mode change by FMU // mark
-        {
-          ros::Duration(0.01).sleep();
-          ros::spinOnce();
-        }
-        if (param.takeoff_land.enable_auto_arm) {
-          toggle_arm_disarm(true);
-        }
-        takeoff_land.toggle_takeoff_land_time = now_time;
-
-        ROS_INFO("\033[32m[px4ctrl] MANUAL_CTRL(L1) --> AUTO_TAKEOFF\033[32m");
-      }
+  // STEP1: estimate thrust model
+  if (state == AUTO_HOVER || state == CMD_CTRL) {
+    controller_ptr->estimateThrustModel(imu_data.a_filt, bat_data.volt, now_time, param);
+  }
+  controller_ptr->setIndiActive(state == AUTO_HOVER || state == CMD_CTRL);
 
-      if (rc_data.toggle_reboot)  // Try to reboot. EKF2 based PX4 FCU requires reboot when its
-                                  // state estimator goes wrong.
-      {
-        if (state_data.current_state.armed) {
-          ROS_ERROR("[px4ctrl] Reject reboot! Disarm the drone first!");
-          break;
-        }
-        reboot_FCU();
-      }
+  // STEP2: solve and update new control commands
+  if (rotor_low_speed_during_land)  // used at the start of auto takeoff
+  {
+    motors_idling(imu_data, u);
+  } else {
+    const quadrotor_msgs::Px4ctrlDebug &dbg =
+        controller_ptr->calculateControl(des, odom_data, imu_data, now_time, u);
+    if (debug_out_ptr && tick % debug_divider == 0) debug_out_ptr->push(dbg, now_time);
+  }
 
-      break;
-    }
+  // STEP3: publish control commands to mavros
+  ctrl_output = u;
+  if (param.use_bodyrate_ctrl) {
+    publish_bodyrate_ctrl(u, now_time);
+  } else {
+    publish_attitude_ctrl(u, now_time);
+  }
+  if (watchdog_ptr) {
+    bool flying = (state == AUTO_HOVER || state == CMD_CTRL || state == AUTO_TAKEOFF ||
+                   state == AUTO_LAND) &&
+                  !rotor_low_speed_during_land &&
+                  extended_state_data.current_extended_state.landed_state ==
+                      mavros_msgs::ExtendedState::LANDED_STATE_IN_AIR;
+    watchdog_ptr->beat(u.q, param.gra / controller_ptr->getThr2acc(), flying);
+  }
 
-    case AUTO_HOVER: {
-      if (!rc_data.is_hover_mode || !odom_is_received(now_time)) {
-        state = MANUAL_CTRL;
-        toggle_offboard_mode(false);
-
-        ROS_WARN("[px4ctrl] AUTO_HOVER(L2) --> MANUAL_CTRL(L1)");
-      } else if (rc_data.is_command_mode && cmd_is_received(now_time)) {
-        if (state_data.current_state.mode == "OFFBOARD") {
-          state = CMD_CTRL;
-          des   = get_cmd_des();
-          ROS_INFO("\033[32m[px4ctrl] AUTO_HOVER(L2) --> CMD_CTRL(L3)\033[32m");
-        }
-      } else if (takeoff_land_data.triggered &&
-                 takeoff_land_data.takeoff_land_cmd == quadrotor_msgs::TakeoffLand::LAND) {
-        state = AUTO_LAND;
-        set_start_pose_for_takeoff_land(odom_data);
-
-        ROS_INFO("\033[32m[px4ctrl] AUTO_HOVER(L2) --> AUTO_LAND\033[32m");
-      } else {
-        set_hov_with_rc();
-        des = get_hover_des();
-        if ((rc_data.enter_command_mode) ||
-            (takeoff_land.delay_trigger.first && now_time > takeoff_land.delay_trigger.second)) {
-          takeoff_land.delay_trigger.first = false;
-          publish_trigger(odom_data.msg);
-          ROS_INFO("\033[32m[px4ctrl] TRIGGER sent, allow user command.\033[32m");
-        }
-
-        // cout << "des.p=" << des.p.transpose() << endl;
-      }
+  // From the start of the tick, what the FCU sees
+  clk::time_point fast_end = clk::now();
+  fast_time.add(std::chrono::duration<double>(fast_end - tick_start).count());
 
-      break;
-    }
+  // STEP4: Black box
+  if (recorder_ptr) {
+    record_tick(now_time, tick_start, des, u, rotor_low_speed_during_land);
+  }
 
-    case CMD_CTRL: {
-      if (!rc_data.is_hover_mode || !odom_is_received(now_time)) {
-        state = MANUAL_CTRL;
-        toggle_offboard_mode(false);
-
-        ROS_WARN("[px4ctrl] From CMD_CTRL(L3) to MANUAL_CTRL(L1)!");
-      } else if (!rc_data.is_command_mode || !cmd_is_received(now_time)) {
-        state = AUTO_HOVER;
-        set_hov_with_odom();
-        des = get_hover_des();
-        ROS_INFO("[px4ctrl] From CMD_CTRL(L3) to AUTO_HOVER(L2)!");
-      } else {
-        des = get_cmd_des();
-      }
+  if (supervise) {
+    // STEP5: Detect if the drone has landed, with the reference of this tick's state
+    land_detector(state, des, odom_data, now_time);
 
-      if (takeoff_land_data.triggered &&
-          takeoff_land_data.takeoff_land_cmd == quadrotor_msgs::TakeoffLand::LAND) {
-        ROS_ERROR(
-            "[px4ctrl] Reject AUTO_LAND, which must be triggered in AUTO_HOVER. \
-					Stop sending control commands for longer than %fs to let px4ctrl return to AUTO_HOVER first.",
-            param.msg_timeout.cmd);
-      }
+    // STEP6: state machine runs, for the next tick
+    check_acks(now_time);
+    step_fsm(now_time);
 
-      break;
+    // STEP7: Clear flags beyound their lifetime, the supervisory tick has seen them
+    rc_data.enter_hover_mode    = false;
+    rc_data.enter_command_mode  = false;
+    rc_data.toggle_reboot       = false;
+    takeoff_land_data.triggered = false;
+
+    // STEP8: Keep the thrust model for the next flight
+    if (was_armed && !state_data.armed) {
+      save_thrust_model();
     }
+    was_armed = state_data.armed;
 
-    case AUTO_TAKEOFF: {
-      if ((now_time - takeoff_land.toggle_takeoff_land_time).toSec() <
-          AutoTakeoffLand_t::MOTORS_SPEEDUP_TIME)  // Wait for several seconds to warn prople.
-      {
-        des = get_rotor_speed_up_des(now_time);
-      } else if (odom_data.p(2) >= (takeoff_land.start_pose(2) +
-                                    param.takeoff_land.height))  // reach the desired height
-      {
-        state = AUTO_HOVER;
-        set_hov_with_odom();
-        ROS_INFO("\033[32m[px4ctrl] AUTO_TAKEOFF --> AUTO_HOVER(L2)\033[32m");
-
-        takeoff_land.delay_trigger.first = true;
-        takeoff_land.delay_trigger.second =
-            now_time + ros::Duration(AutoTakeoffLand_t::DELAY_TRIGGER_TIME);
-      } else {
-        des = get_takeoff_land_des(param.takeoff_land.speed);
-      }
+    supervisor_time.add(std::chrono::duration<double>(clk::now() - fast_end).count());
+  }
+}
 
-      break;
-    }
+void PX4CtrlFSM::step_fsm(const ros::Time &now) {
+  for (const Transition &tr : TRANSITIONS) {
+    if (tr.from != state) continue;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (!(this->*tr.guard)(now)) continue;
+    state = tr.to;
+    if (tr.action) (this->*tr.action)(now);
+
+    FsmTransition rec;
+    rec.stamp     = now;
+    rec.from      = tr.from;
+    rec.to        = tr.to;
+    rec.guard     = tr.guard_name;
+    rec.action_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() -
+                                                              start)
+                        .count();
+    trace.push(rec);
+
+    if (tr.warn)
+      ROS_WARN("[px4ctrl] %s --> %s (%s)", state_name(tr.from), state_name(tr.to),
+               tr.guard_name);
+    else
+      ROS_INFO("\033[32m[px4ctrl] %s --> %s (%s)\033[32m", state_name(tr.from),
+               state_name(tr.to), tr.guard_name);
+    if (on_transition) on_transition(rec);
+    return;
+  }
 
-    case AUTO_LAND: {
-      if (!rc_data.is_hover_mode || !odom_is_received(now_time)) {
-        state = MANUAL_CTRL;
-        toggle_offboard_mode(false);
-
-        ROS_WARN("[px4ctrl] From AUTO_LAND to MANUAL_CTRL(L1)!");
-      } else if (!rc_data.is_command_mode) {
-        state = AUTO_HOVER;
-        set_hov_with_odom();
-        des = get_hover_des();
-        ROS_INFO("[px4ctrl] From AUTO_LAND to AUTO_HOVER(L2)!");
-      } else if (!get_landed()) {
-        des = get_takeoff_land_des(-param.takeoff_land.speed);
-      } else {
-        rotor_low_speed_during_land = true;
-
-        static bool print_once_flag = true;
-        if (print_once_flag) {
-          ROS_INFO("\033[32m[px4ctrl] Wait for abount 10s to let the drone arm.\033[32m");
-          print_once_flag = false;
-        }
-
-        if (extended_state_data.current_extended_state.landed_state ==
-            mavros_msgs::ExtendedState::LANDED_STATE_ON_GROUND)  // PX4 allows disarm after this
-        {
-          static double last_trial_time = 0;  // Avoid too frequent calls
-          if (now_time.toSec() - last_trial_time > 1.0) {
-            if (toggle_arm_disarm(false))  // disarm
-            {
-              print_once_flag = true;
-              state           = MANUAL_CTRL;
-              toggle_offboard_mode(false);  // toggle off offboard after disarm
-              ROS_INFO("\033[32m[px4ctrl] AUTO_LAND --> MANUAL_CTRL(L1)\033[32m");
-            }
-
-            last_trial_time = now_time.toSec();
-          }
-        }
-      }
+  if (DURING[state - MANUAL_CTRL]) (this->*DURING[state - MANUAL_CTRL])(now);
+}
+
+void PX4CtrlFSM::latency_end(Latency_t k, const ros::Time &now) {
+  if (latency_start[k].isZero()) return;
+  latency[k].add((now - latency_start[k]).toSec());
+  latency_start[k] = ros::Time(0);
+  if (on_latency) on_latency(k, latency[k]);
+}
+
+// Acknowledgements the FCU reports asynchronously, seen one tick after they arrive at the latest
+void PX4CtrlFSM::check_acks(const ros::Time &now) {
+  if (state_data.mode == State_Data_t::OFFBOARD) latency_end(OFFBOARD_ACK, now);
+  if (state_data.armed) latency_end(ARM_ACK, now);
+  if (extended_state_data.current_extended_state.landed_state ==
+      mavros_msgs::ExtendedState::LANDED_STATE_IN_AIR)
+    latency_end(TAKEOFF_AIRBORNE, now);
+}
+
+bool PX4CtrlFSM::takeoff_requested() {
+  return param.takeoff_land.enable && takeoff_land_data.triggered &&
+         takeoff_land_data.takeoff_land_cmd == quadrotor_msgs::TakeoffLand::TAKEOFF;
+}
+
+bool PX4CtrlFSM::cmd_requested(const ros::Time &now) {
+  return rc_data.is_command_mode && cmd_is_received(now);
+}
+
+// ---- MANUAL_CTRL ----
+
+bool PX4CtrlFSM::guard_hover_switch(const ros::Time &now) {
+  if (!rc_data.enter_hover_mode) return false;
 
-      break;
+  if (!odom_is_received(now)) {
+    ROS_ERROR("[px4ctrl] Reject AUTO_HOVER(L2). No odom!");
+    return false;
+  }
+  if (cmd_is_received(now)) {
+    ROS_ERROR(
+        "[px4ctrl] Reject AUTO_HOVER(L2). You are sending commands before toggling into "
+        "AUTO_HOVER, which is not allowed. Stop sending commands now!");
+    return false;
+  }
+  if (odom_data.v.norm() > 3.0) {
+    ROS_ERROR(
+        "[px4ctrl] Reject AUTO_HOVER(L2). Odom_Vel=%fm/s, which seems that the locolization "
+        "module goes wrong!",
+        odom_data.v.norm());
+    return false;
+  }
+  return true;
+}
+
+bool PX4CtrlFSM::guard_takeoff_cmd(const ros::Time &now) {
+  if (rc_data.enter_hover_mode || !takeoff_requested()) return false;
+
+  if (!odom_is_received(now)) {
+    ROS_ERROR("[px4ctrl] Reject AUTO_TAKEOFF. No odom!");
+    return false;
+  }
+  if (cmd_is_received(now)) {
+    ROS_ERROR(
+        "[px4ctrl] Reject AUTO_TAKEOFF. You are sending commands before toggling into "
+        "AUTO_TAKEOFF, which is not allowed. Stop sending commands now!");
+    return false;
+  }
+  if (odom_data.v.norm() > 0.1) {
+    ROS_ERROR("[px4ctrl] Reject AUTO_TAKEOFF. Odom_Vel=%fm/s, non-static takeoff is not allowed!",
+              odom_data.v.norm());
+    return false;
+  }
+  if (!get_landed()) {
+    ROS_ERROR(
+        "[px4ctrl] Reject AUTO_TAKEOFF. land detector says that the drone is not landed now!");
+    return false;
+  }
+  if (rc_is_received(now))  // Check this only if RC is connected.
+  {
+    if (!rc_data.is_hover_mode || !rc_data.is_command_mode || !rc_data.check_centered()) {
+      ROS_ERROR(
+          "[px4ctrl] Reject AUTO_TAKEOFF. If you have your RC connected, keep its switches "
+          "at \"auto hover\" and \"command control\" states, and all sticks at the center, "
+          "then takeoff again.");
+      takeoff_land.rc_recenter_pending = true;  // see during_manual()
+      return false;
     }
+  }
+  return true;
+}
+
+void PX4CtrlFSM::enter_hover_from_manual(const ros::Time &now) {
+  reset_thrust_mapping();
+  set_hov_with_odom(now);
+  latency_begin(OFFBOARD_ACK, now);
+  toggle_offboard_mode(true);
+}
 
-    default:
-      break;
+void PX4CtrlFSM::enter_takeoff(const ros::Time &now) {
+  reset_thrust_mapping();
+  set_start_pose_for_takeoff_land(odom_data, now);
+  latency_begin(TAKEOFF_AIRBORNE, now);
+  latency_begin(TAKEOFF_HOVER, now);
+
+  ROS_INFO("try mode change!");
+  latency_begin(OFFBOARD_ACK, now);
+  toggle_offboard_mode(true);  // toggle on offboard before arm
+
+  // Arm on a later supervisory tick, see during_takeoff()
+  takeoff_land.arm_pending = param.takeoff_land.enable_auto_arm;
+  takeoff_land.toggle_takeoff_land_time = now;
+}
+
+/*
+  Reboot on request, EKF2 based PX4 FCU requires reboot when its state estimator goes wrong. A
+  reboot request in the same tick as a rejected hover or takeoff request is ignored.
+*/
+void PX4CtrlFSM::during_manual(const ros::Time &now) {
+  if (takeoff_land.rc_recenter_pending && rc_data.is_hover_mode && rc_data.is_command_mode &&
+      rc_data.check_centered()) {
+    takeoff_land.rc_recenter_pending = false;
+    ROS_INFO("\033[32m[px4ctrl] OK, you can takeoff again.\033[32m");
   }
 
-  // STEP2: estimate thrust model
-  if (state == AUTO_HOVER || state == CMD_CTRL) {
-    // controller.estimateThrustModel(imu_data.a, bat_data.volt, param);
-    controller_ptr->estimateThrustModel(imu_data.a, param);
+  if (!rc_data.toggle_reboot || rc_data.enter_hover_mode || takeoff_requested()) return;
+
+  if (state_data.armed) {
+    ROS_ERROR("[px4ctrl] Reject reboot! Disarm the drone first!");
+    return;
   }
+  reboot_FCU();
+}
 
-  // STEP3: solve and update new control commands
-  if (rotor_low_speed_during_land)  // used at the start of auto takeoff
-  {
-    motors_idling(imu_data, u);
-  } else {
-    debug_msg              = controller_ptr->calculateControl(des, odom_data, imu_data, u);
-    debug_msg.header.stamp = now_time;
-    debug_pub.publish(debug_msg);
+// ---- AUTO_HOVER, CMD_CTRL ----
+
+bool PX4CtrlFSM::guard_rc_or_odom_lost(const ros::Time &now) {
+  return !rc_data.is_hover_mode || !odom_is_received(now);
+}
+
+void PX4CtrlFSM::enter_manual(const ros::Time &now) {
+  toggle_offboard_mode(false);
+  for (int k = 0; k < LATENCY_NUM; ++k) latency_start[k] = ros::Time(0);  // aborted
+}
+
+// CMD_CTRL also waits for the FCU to acknowledge OFFBOARD
+bool PX4CtrlFSM::guard_cmd_ready(const ros::Time &now) {
+  return cmd_requested(now) && state_data.mode == State_Data_t::OFFBOARD;
+}
+
+bool PX4CtrlFSM::guard_land_cmd(const ros::Time &now) {
+  return !cmd_requested(now) && takeoff_land_data.triggered &&
+         takeoff_land_data.takeoff_land_cmd == quadrotor_msgs::TakeoffLand::LAND;
+}
+
+void PX4CtrlFSM::enter_land(const ros::Time &now) {
+  set_start_pose_for_takeoff_land(odom_data, now);
+  latency_begin(LAND_DISARMED, now);
+}
+
+void PX4CtrlFSM::during_hover(const ros::Time &now) {
+  if (cmd_requested(now)) return;  // until OFFBOARD is acknowledged, see guard_cmd_ready()
+
+  if ((rc_data.enter_command_mode) ||
+      (takeoff_land.delay_trigger.first && now > takeoff_land.delay_trigger.second)) {
+    takeoff_land.delay_trigger.first = false;
+    publish_trigger(*odom_data.msg);
+    ROS_INFO("\033[32m[px4ctrl] TRIGGER sent, allow user command.\033[32m");
   }
+}
 
-  // STEP4: publish control commands to mavros
-  if (param.use_bodyrate_ctrl) {
-    publish_bodyrate_ctrl(u, now_time);
-  } else {
-    publish_attitude_ctrl(u, now_time);
+bool PX4CtrlFSM::guard_land_rejected(const ros::Time &now) {
+  if (takeoff_land_data.triggered &&
+      takeoff_land_data.takeoff_land_cmd == quadrotor_msgs::TakeoffLand::LAND) {
+    ROS_ERROR(
+        "[px4ctrl] Reject AUTO_LAND, which must be triggered in AUTO_HOVER. Stop sending control "
+        "commands for longer than %fs to let px4ctrl return to AUTO_HOVER first.",
+        param.msg_timeout.cmd);
+  }
+  return false;
+}
+
+bool PX4CtrlFSM::guard_cmd_lost(const ros::Time &now) { return !cmd_requested(now); }
+
+void PX4CtrlFSM::enter_hover_here(const ros::Time &now) { set_hov_with_odom(now); }
+
+// ---- AUTO_TAKEOFF ----
+
+bool PX4CtrlFSM::guard_height_reached(const ros::Time &now) {
+  return (now - takeoff_land.toggle_takeoff_land_time).toSec() >=
+             AutoTakeoffLand_t::MOTORS_SPEEDUP_TIME &&
+         odom_data.p(2) >= (takeoff_land.start_pose(2) + param.takeoff_land.height);
+}
+
+// Give the FCU ARM_DELAY to switch to OFFBOARD before arming
+void PX4CtrlFSM::during_takeoff(const ros::Time &now) {
+  if (!takeoff_land.arm_pending ||
+      (now - takeoff_land.toggle_takeoff_land_time).toSec() < AutoTakeoffLand_t::ARM_DELAY)
+    return;
+
+  takeoff_land.arm_pending = false;
+  latency_begin(ARM_ACK, now);
+  toggle_arm_disarm(true);
+}
+
+void PX4CtrlFSM::enter_hover_after_takeoff(const ros::Time &now) {
+  set_hov_with_odom(now);
+  latency_end(TAKEOFF_HOVER, now);
+
+  takeoff_land.delay_trigger.first = true;
+  takeoff_land.delay_trigger.second =
+      now + ros::Duration(AutoTakeoffLand_t::DELAY_TRIGGER_TIME);
+}
+
+// ---- AUTO_LAND ----
+
+bool PX4CtrlFSM::guard_command_switch_off(const ros::Time &now) { return !rc_data.is_command_mode; }
+
+// Asks the FCU, at most once a second, once landed and PX4 allows disarming
+bool PX4CtrlFSM::guard_disarmed(const ros::Time &now) {
+  if (!get_landed() || extended_state_data.current_extended_state.landed_state !=
+                           mavros_msgs::ExtendedState::LANDED_STATE_ON_GROUND)
+    return false;
+  if (now.toSec() - takeoff_land.last_disarm_trial <= 1.0) return false;
+
+  takeoff_land.last_disarm_trial = now.toSec();
+  return toggle_arm_disarm(false);
+}
+
+void PX4CtrlFSM::enter_manual_disarmed(const ros::Time &now) {
+  takeoff_land.disarm_prompted = false;
+  toggle_offboard_mode(false);  // toggle off offboard after disarm
+  latency_end(LAND_DISARMED, now);
+}
+
+void PX4CtrlFSM::during_land(const ros::Time &now) {
+  if (get_landed() && !takeoff_land.disarm_prompted) {
+    ROS_INFO("\033[32m[px4ctrl] Wait for abount 10s to let the drone arm.\033[32m");
+    takeoff_land.disarm_prompted = true;
   }
+}
 
-  // STEP5: Detect if the drone has landed
-  land_detector(state, des, odom_data);
-  // cout << takeoff_land.landed << " ";
-  // fflush(stdout);
+// ---- references, every tick ----
 
-  // STEP6: Clear flags beyound their lifetime
-  rc_data.enter_hover_mode    = false;
-  rc_data.enter_command_mode  = false;
-  rc_data.toggle_reboot       = false;
-  takeoff_land_data.triggered = false;
+void PX4CtrlFSM::reference_hover(Tick &t) {
+  if (cmd_requested(t.now)) return;  // the odometry until CMD_CTRL, see during_hover()
+
+  set_hov_with_rc(t.now);
+  t.des = get_hover_des();
+}
+
+void PX4CtrlFSM::reference_cmd_ctrl(Tick &t) { t.des = get_cmd_des(); }
+
+void PX4CtrlFSM::reference_takeoff(Tick &t) {
+  if ((t.now - takeoff_land.toggle_takeoff_land_time).toSec() <
+      AutoTakeoffLand_t::MOTORS_SPEEDUP_TIME)  // Wait for several seconds to warn prople.
+    t.des = get_rotor_speed_up_des(t.now);
+  else
+    t.des = get_takeoff_land_des(param.takeoff_land.speed, t.now);
+}
+
+void PX4CtrlFSM::reference_land(Tick &t) {
+  if (get_landed())
+    t.rotor_low_speed_during_land = true;
+  else
+    t.des = get_takeoff_land_des(-param.takeoff_land.speed, t.now);
 }
 
 void PX4CtrlFSM::motors_idling(const Imu_Data_t &imu, Controller_Output_t &u) {
@@ -322,15 +536,15 @@ void PX4CtrlFSM::motors_idling(const Imu_Data_t &imu, Controller_Output_t &u) {
 
 void PX4CtrlFSM::land_detector(const State_t          state,
                                const Desired_State_t &des,
-                               const Odom_Data_t     &odom) {
-  static State_t last_state = State_t::MANUAL_CTRL;
-  if (last_state == State_t::MANUAL_CTRL &&
+                               const Odom_Data_t     &odom,
+                               const ros::Time       &now_time) {
+  if (land_detector_last_state == State_t::MANUAL_CTRL &&
       (state == State_t::AUTO_HOVER || state == State_t::AUTO_TAKEOFF)) {
     takeoff_land.landed = false;  // Always holds
   }
-  last_state = state;
+  land_detector_last_state = state;
 
-  if (state == State_t::MANUAL_CTRL && !state_data.current_state.armed) {
+  if (state == State_t::MANUAL_CTRL && !state_data.armed) {
     takeoff_land.landed = true;
     return;  // No need of other decisions
   }
@@ -341,24 +555,23 @@ void PX4CtrlFSM::land_detector(const State_t          state,
   constexpr double VELOCITY_THR_C = 0.1;  // Constraint 2: velocity below VELOCITY_MIN_C m/s.
   constexpr double TIME_KEEP_C    = 3.0;  // Constraint 3: Time(s) the Constraint 1&2 need to keep.
 
-  static ros::Time time_C12_reached;  // time_Constraints12_reached
-  static bool      is_last_C12_satisfy;
   if (takeoff_land.landed) {
-    time_C12_reached    = ros::Time::now();
-    is_last_C12_satisfy = false;
+    takeoff_land.time_C12_reached    = now_time;
+    takeoff_land.is_last_C12_satisfy = false;
   } else {
     bool C12_satisfy =
         (des.p(2) - odom.p(2)) < POSITION_DEVIATION_C && odom.v.norm() < VELOCITY_THR_C;
-    if (C12_satisfy && !is_last_C12_satisfy) {
-      time_C12_reached = ros::Time::now();
-    } else if (C12_satisfy && is_last_C12_satisfy) {
-      if ((ros::Time::now() - time_C12_reached).toSec() > TIME_KEEP_C)  // Constraint 3 reached
+    if (C12_satisfy && !takeoff_land.is_last_C12_satisfy) {
+      takeoff_land.time_C12_reached = now_time;
+    } else if (C12_satisfy && takeoff_land.is_last_C12_satisfy) {
+      if ((now_time - takeoff_land.time_C12_reached).toSec() >
+          TIME_KEEP_C)  // Constraint 3 reached
       {
         takeoff_land.landed = true;
       }
     }
 
-    is_last_C12_satisfy = C12_satisfy;
+    takeoff_land.is_last_C12_satisfy = C12_satisfy;
   }
 }
 
@@ -407,9 +620,8 @@ Desired_State_t PX4CtrlFSM::get_rotor_speed_up_des(const ros::Time now) {
   return des;
 }
 
-Desired_State_t PX4CtrlFSM::get_takeoff_land_des(const double speed) {
-  ros::Time now = ros::Time::now();
-  double    delta_t =
+Desired_State_t PX4CtrlFSM::get_takeoff_land_des(const double speed, const ros::Time &now) {
+  double delta_t =
       (now - takeoff_land.toggle_takeoff_land_time).toSec() -
       (speed > 0 ? AutoTakeoffLand_t::MOTORS_SPEEDUP_TIME : 0);  // speed > 0 means takeoff
   // takeoff_land.last_set_cmd_time = now;
@@ -427,16 +639,43 @@ Desired_State_t PX4CtrlFSM::get_takeoff_land_des(const double speed) {
   return des;
 }
 
-void PX4CtrlFSM::set_hov_with_odom() {
+std::string PX4CtrlFSM::thrust_model_key() {
+  int cells = bat_data.msg ? (int)bat_data.msg->cell_voltage.size() : 0;
+  return param.thr_map.airframe + "/" + std::to_string(cells) + "S";
+}
+
+void PX4CtrlFSM::reset_thrust_mapping() {
+  ThrustModelState s;
+  if (thrust_store_ptr && thrust_store_ptr->find(thrust_model_key(), s))
+    controller_ptr->warmStartThrustMapping(s);
+  else  // e.g. a battery swap to a pack with another cell count, never reuse the last one
+    controller_ptr->clearWarmStart();
+  controller_ptr->resetThrustMapping(bat_data.volt);
+}
+
+void PX4CtrlFSM::save_thrust_model() {
+  ThrustModelState s;
+  if (!thrust_store_ptr || !controller_ptr->getThrustModelState(s)) return;
+
+  std::string key = thrust_model_key();
+  thrust_store_ptr->set(key, s);
+  if (thrust_store_ptr->save())
+    ROS_INFO("[px4ctrl] Thrust model of %s saved to %s, thr2acc=%.3f at %.2fV", key.c_str(),
+             thrust_store_ptr->path().c_str(), s.thr2acc, s.volt);
+  else
+    ROS_ERROR("[px4ctrl] Failed to save the thrust model to %s",
+              thrust_store_ptr->path().c_str());
+}
+
+void PX4CtrlFSM::set_hov_with_odom(const ros::Time &now) {
   hover_pose.head<3>() = odom_data.p;
   hover_pose(3)        = get_yaw_from_quaternion(odom_data.q);
 
-  last_set_hover_pose_time = ros::Time::now();
+  last_set_hover_pose_time = now;
 }
 
-void PX4CtrlFSM::set_hov_with_rc() {
-  ros::Time now            = ros::Time::now();
-  double    delta_t        = (now - last_set_hover_pose_time).toSec();
+void PX4CtrlFSM::set_hov_with_rc(const ros::Time &now) {
+  double delta_t           = (now - last_set_hover_pose_time).toSec();
   last_set_hover_pose_time = now;
 
   hover_pose(0) +=
@@ -461,11 +700,11 @@ void PX4CtrlFSM::set_hov_with_rc() {
   // }
 }
 
-void PX4CtrlFSM::set_start_pose_for_takeoff_land(const Odom_Data_t &odom) {
+void PX4CtrlFSM::set_start_pose_for_takeoff_land(const Odom_Data_t &odom, const ros::Time &now) {
   takeoff_land.start_pose.head<3>() = odom_data.p;
   takeoff_land.start_pose(3)        = get_yaw_from_quaternion(odom_data.q);
 
-  takeoff_land.toggle_takeoff_land_time = ros::Time::now();
+  takeoff_land.toggle_takeoff_land_time = now;
 }
 
 bool PX4CtrlFSM::rc_is_received(const ros::Time &now_time) {
@@ -498,66 +737,124 @@ bool PX4CtrlFSM::recv_new_odom() {
 }
 
 void PX4CtrlFSM::publish_bodyrate_ctrl(const Controller_Output_t &u, const ros::Time &stamp) {
-  mavros_msgs::AttitudeTarget msg;
-
-  msg.header.stamp    = stamp;
-  msg.header.frame_id = std::string("FCU");
-
-  msg.type_mask = mavros_msgs::AttitudeTarget::IGNORE_ATTITUDE;
+  if (mavlink_out_ptr) {
+    mavlink_out_ptr->send_attitude_target(stamp, bodyrate_target_msg->type_mask, u.q, u.bodyrates,
+                                          u.thrust);
+    return;
+  }
+  if (!ctrl_FCU_pub && !ctrl_FCU_hook) return;
 
-  msg.body_rate.x = u.bodyrates.x();
-  msg.body_rate.y = u.bodyrates.y();
-  msg.body_rate.z = u.bodyrates.z();
+  mavros_msgs::AttitudeTarget &msg = writable(bodyrate_target_msg);
 
-  msg.thrust = u.thrust;
+  msg.header.stamp = stamp;
+  msg.body_rate.x  = u.bodyrates.x();
+  msg.body_rate.y  = u.bodyrates.y();
+  msg.body_rate.z  = u.bodyrates.z();
+  msg.thrust       = u.thrust;
 
-  ctrl_FCU_pub.publish(msg);
+  publish_FCU_setpoint(bodyrate_target_msg);
 }
 
 void PX4CtrlFSM::publish_attitude_ctrl(const Controller_Output_t &u, const ros::Time &stamp) {
-  mavros_msgs::AttitudeTarget msg;
-
-  msg.header.stamp    = stamp;
-  msg.header.frame_id = std::string("FCU");
+  if (mavlink_out_ptr) {
+    mavlink_out_ptr->send_attitude_target(stamp, attitude_target_msg->type_mask, u.q, u.bodyrates,
+                                          u.thrust);
+    return;
+  }
+  if (!ctrl_FCU_pub && !ctrl_FCU_hook) return;
 
-  msg.type_mask = mavros_msgs::AttitudeTarget::IGNORE_ROLL_RATE |
-                  mavros_msgs::AttitudeTarget::IGNORE_PITCH_RATE |
-                  mavros_msgs::AttitudeTarget::IGNORE_YAW_RATE;
+  mavros_msgs::AttitudeTarget &msg = writable(attitude_target_msg);
 
+  msg.header.stamp  = stamp;
   msg.orientation.x = u.q.x();
   msg.orientation.y = u.q.y();
   msg.orientation.z = u.q.z();
   msg.orientation.w = u.q.w();
+  msg.thrust        = u.thrust;
 
-  msg.thrust = u.thrust;
-
-  ctrl_FCU_pub.publish(msg);
+  publish_FCU_setpoint(attitude_target_msg);
 }
 
 void PX4CtrlFSM::publish_trigger(const nav_msgs::Odometry &odom_msg) {
-  geometry_msgs::PoseStamped msg;
-  msg.header.frame_id = "world";
-  msg.pose            = odom_msg.pose.pose;
+  if (!traj_start_trigger_pub) return;
+
+  geometry_msgs::PoseStamped &msg = writable(trigger_msg);
+  msg.pose                        = odom_msg.pose.pose;
+
+  traj_start_trigger_pub.publish(trigger_msg);
+}
 
-  traj_start_trigger_pub.publish(msg);
+void PX4CtrlFSM::record_tick(const ros::Time                              &now_time,
+                             const std::chrono::steady_clock::time_point &tick_start,
+                             const Desired_State_t                        &des,
+                             const Controller_Output_t                    &u,
+                             bool rotor_low_speed_during_land) {
+  FlightRecord             r;
+  std::chrono::nanoseconds tick_duration = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - tick_start);
+
+  r.seq              = record_seq++;
+  r.t_ns             = now_time.toNSec();
+  r.tick_duration_ns = tick_duration.count();
+  r.state            = state;
+  r.landed           = takeoff_land.landed;
+  r.armed            = state_data.armed;
+  r.rotor_low_speed  = rotor_low_speed_during_land;
+
+  r.odom_rcv_ns = odom_data.rcv_stamp.toNSec();
+  Eigen::Map<Eigen::Vector3d>(r.odom_p) = odom_data.p;
+  Eigen::Map<Eigen::Vector3d>(r.odom_v) = odom_data.v;
+  Eigen::Map<Eigen::Vector4d>(r.odom_q) << odom_data.q.w(), odom_data.q.vec();
+  Eigen::Map<Eigen::Vector3d>(r.odom_w) = odom_data.w;
+
+  r.imu_rcv_ns = imu_data.rcv_stamp.toNSec();
+  Eigen::Map<Eigen::Vector3d>(r.imu_a) = imu_data.a;
+  Eigen::Map<Eigen::Vector3d>(r.imu_w) = imu_data.w;
+  Eigen::Map<Eigen::Vector4d>(r.imu_q) << imu_data.q.w(), imu_data.q.vec();
+
+  r.cmd_rcv_ns = cmd_data.rcv_stamp.toNSec();
+  Eigen::Map<Eigen::Vector3d>(r.cmd_p) = cmd_data.p;
+  Eigen::Map<Eigen::Vector3d>(r.cmd_v) = cmd_data.v;
+  Eigen::Map<Eigen::Vector3d>(r.cmd_a) = cmd_data.a;
+  Eigen::Map<Eigen::Vector3d>(r.cmd_j) = cmd_data.j;
+  r.cmd_yaw      = cmd_data.yaw;
+  r.cmd_yaw_rate = cmd_data.yaw_rate;
+
+  Eigen::Map<Eigen::Vector3d>(r.des_p) = des.p;
+  Eigen::Map<Eigen::Vector3d>(r.des_v) = des.v;
+  Eigen::Map<Eigen::Vector3d>(r.des_a) = des.a;
+  r.des_yaw = des.yaw;
+
+  r.u_thrust = u.thrust;
+  Eigen::Map<Eigen::Vector4d>(r.u_q) << u.q.w(), u.q.vec();
+  Eigen::Map<Eigen::Vector3d>(r.u_bodyrates) = u.bodyrates;
+
+  r.thr2acc   = controller_ptr->getThr2acc();
+  r.thr2acc_P = controller_ptr->getThrustModelCovariance();
+  r.bat_volt  = bat_data.volt;
+
+  recorder_ptr->write(r);
 }
 
 bool PX4CtrlFSM::toggle_offboard_mode(bool on_off) {
   mavros_msgs::SetMode offb_set_mode;
 
   if (on_off) {
-    state_data.state_before_offboard = state_data.current_state;
-    if (state_data.state_before_offboard.mode == "OFFBOARD")  // Not allowed
-      state_data.state_before_offboard.mode = "MANUAL";
+    state_data.mode_before_offboard = state_data.mode;
+    if (state_data.mode_before_offboard == State_Data_t::OFFBOARD ||
+        state_data.mode_before_offboard == State_Data_t::MODE_UNKNOWN)  // Not allowed
+      state_data.mode_before_offboard = State_Data_t::MANUAL;
 
     offb_set_mode.request.custom_mode = "OFFBOARD";
-    if (!(set_FCU_mode_srv.call(offb_set_mode) && offb_set_mode.response.mode_sent)) {
+    if (!(call_FCU_srv(set_FCU_mode_srv, set_FCU_mode_hook, offb_set_mode) &&
+          offb_set_mode.response.mode_sent)) {
       ROS_ERROR("Enter OFFBOARD rejected by PX4!");
       return false;
     }
   } else {
-    offb_set_mode.request.custom_mode = state_data.state_before_offboard.mode;
-    if (!(set_FCU_mode_srv.call(offb_set_mode) && offb_set_mode.response.mode_sent)) {
+    offb_set_mode.request.custom_mode = State_Data_t::mode_name(state_data.mode_before_offboard);
+    if (!(call_FCU_srv(set_FCU_mode_srv, set_FCU_mode_hook, offb_set_mode) &&
+          offb_set_mode.response.mode_sent)) {
       ROS_ERROR("Exit OFFBOARD rejected by PX4!");
       return false;
     }
@@ -572,7 +869,7 @@ bool PX4CtrlFSM::toggle_offboard_mode(bool on_off) {
 bool PX4CtrlFSM::toggle_arm_disarm(bool arm) {
   mavros_msgs::CommandBool arm_cmd;
   arm_cmd.request.value = arm;
-  if (!(arming_client_srv.call(arm_cmd) && arm_cmd.response.success)) {
+  if (!(call_FCU_srv(arming_client_srv, arming_hook, arm_cmd) && arm_cmd.response.success)) {
     if (arm)
       ROS_ERROR("ARM rejected by PX4!");
     else
@@ -593,7 +890,7 @@ void PX4CtrlFSM::reboot_FCU() {
   reboot_srv.request.param2       = 0;    // Do nothing for onboard computer
   reboot_srv.request.confirmation = true;
 
-  reboot_FCU_srv.call(reboot_srv);
+  call_FCU_srv(reboot_FCU_srv, reboot_FCU_hook, reboot_srv);
 
   ROS_INFO("Reboot FCU");
 
@@ -1,10 +1,14 @@
 #ifndef __PX4CTRLFSM_H
 #define __PX4CTRLFSM_H
 
+#include <chrono>
+#include <functional>
+
 #include <ros/assert.h>
 #include <ros/ros.h>
 
 #include <geometry_msgs/PoseStamped.h>
+#include <mavros_msgs/AttitudeTarget.h>
 #include <mavros_msgs/CommandBool.h>
 #include <mavros_msgs/CommandLong.h>
 #include <mavros_msgs/SetMode.h>
@@ -12,7 +16,12 @@
 
 #include "input.h"
 // #include "ThrustCurve.h"
+#include "control_watchdog.h"
 #include "controller.h"
+#include "debug_output.h"
+#include "mavlink_output.h"
+#include "flight_recorder.h"
+#include "fsm_trace.h"
 
 struct AutoTakeoffLand_t {
   bool                       landed{true};
@@ -20,10 +29,23 @@ struct AutoTakeoffLand_t {
   std::pair<bool, ros::Time> delay_trigger{std::pair<bool, ros::Time>(false, ros::Time(0))};
   Eigen::Vector4d            start_pose;
 
+  // AUTO_TAKEOFF request handling, both checked on later supervisory ticks
+  bool rc_recenter_pending{false};  // rejected for the RC, waiting for it to be recentered
+  bool arm_pending{false};          // OFFBOARD requested, arm after ARM_DELAY
+
+  // AUTO_LAND after touchdown
+  bool   disarm_prompted{false};  // the wait-for-disarm message was printed
+  double last_disarm_trial{0};    // s, avoid too frequent disarm calls
+
+  // land_detector(), Constraints 1&2
+  ros::Time time_C12_reached;
+  bool      is_last_C12_satisfy{false};
+
   static constexpr double MOTORS_SPEEDUP_TIME =
       3.0;  // motors idle running for 3 seconds before takeoff
   static constexpr double DELAY_TRIGGER_TIME =
       2.0;  // Time to be delayed when reach at target height
+  static constexpr double ARM_DELAY = 0.1;  // allow mode change by FMU before arming
 };
 
 class PX4CtrlFSM {
@@ -40,15 +62,33 @@ class PX4CtrlFSM {
   Takeoff_Land_Data_t  takeoff_land_data;
 
   std::shared_ptr<ControlBase> controller_ptr;
+  std::shared_ptr<Clock>       clock;  // change it with set_clock() only
 
   ros::Publisher     traj_start_trigger_pub;
   ros::Publisher     ctrl_FCU_pub;
-  ros::Publisher     debug_pub;  // debug
   ros::ServiceClient set_FCU_mode_srv;
   ros::ServiceClient arming_client_srv;
   ros::ServiceClient reboot_FCU_srv;
 
-  quadrotor_msgs::Px4ctrlDebug debug_msg;  // debug
+  std::shared_ptr<MavlinkSetpointOutput> mavlink_out_ptr;  // bypasses ctrl_FCU_pub if set
+  std::shared_ptr<FlightRecorder>        recorder_ptr;     // black box, optional
+  std::shared_ptr<ThrustModelStore>      thrust_store_ptr;  // thrust model warm start, optional
+  std::shared_ptr<DebugOutput>           debug_out_ptr;     // debugPx4ctrl, optional
+  std::shared_ptr<ControlWatchdog>       watchdog_ptr;      // fallback setpoints, optional
+
+  // Stand-ins for the mavros services when running without ROS (replay, simulation)
+  std::function<bool(mavros_msgs::SetMode &)>     set_FCU_mode_hook;
+  std::function<bool(mavros_msgs::CommandBool &)> arming_hook;
+  std::function<bool(mavros_msgs::CommandLong &)> reboot_FCU_hook;
+  // and for ctrl_FCU_pub, gets what roscpp would hand to a subscriber in this process
+  std::function<void(const mavros_msgs::AttitudeTargetConstPtr &)> ctrl_FCU_hook;
+
+  Controller_Output_t ctrl_output;  // last command sent to the FCU
+
+  // Messages allocated once, only the numeric fields change when they are published
+  mavros_msgs::AttitudeTargetPtr bodyrate_target_msg;
+  mavros_msgs::AttitudeTargetPtr attitude_target_msg;
+  geometry_msgs::PoseStampedPtr  trigger_msg;
 
   Eigen::Vector4d hover_pose;
   ros::Time       last_set_hover_pose_time;
@@ -62,7 +102,21 @@ class PX4CtrlFSM {
     AUTO_LAND
   };
 
+  // Latencies from a request to its outcome, on the FSM clock and at tick resolution
+  enum Latency_t {
+    OFFBOARD_ACK,      // leaving MANUAL_CTRL (OFFBOARD requested) -> FCU reports OFFBOARD
+    ARM_ACK,           // auto arm requested -> FCU reports armed
+    TAKEOFF_AIRBORNE,  // AUTO_TAKEOFF entered -> FCU reports in air
+    TAKEOFF_HOVER,     // AUTO_TAKEOFF entered -> takeoff height reached, AUTO_HOVER
+    LAND_DISARMED,     // AUTO_LAND entered -> disarmed
+    LATENCY_NUM
+  };
+
+  std::function<void(const FsmTransition &)>          on_transition;  // after every transition
+  std::function<void(Latency_t, const LatencyStat &)> on_latency;     // after every new sample
+
   PX4CtrlFSM(Parameter_t &, std::shared_ptr<ControlBase>);
+  void    set_clock(std::shared_ptr<Clock> clock_);  // also used to stamp the inputs
   void    process();
   bool    rc_is_received(const ros::Time &now_time);
   bool    cmd_is_received(const ros::Time &now_time);
@@ -73,9 +127,96 @@ class PX4CtrlFSM {
   State_t get_state() { return state; }
   bool    get_landed() { return takeoff_land.landed; }
 
+  const FsmTrace    &get_trace() const { return trace; }
+  const LatencyStat &get_latency(Latency_t k) const { return latency[k]; }
+  static const char *state_name(int s);
+  static const char *latency_name(int k);
+  // Per tick, from its start to the setpoint being published (the fast rate group, which goes
+  // first), and the execution time of the supervisory rate group after it, s
+  const LatencyStat &get_fast_time() const { return fast_time; }
+  const LatencyStat &get_supervisor_time() const { return supervisor_time; }
+
  private:
   State_t           state;  // Should only be changed in PX4CtrlFSM::process() function!
+  State_t           land_detector_last_state{MANUAL_CTRL};
   AutoTakeoffLand_t takeoff_land;
+  uint64_t          record_seq{0};
+  bool              was_armed{false};
+
+  // ---- rate groups ----
+  int         supervisor_divider;  // the supervisory tick is every supervisor_divider-th
+  int         debug_divider;       // debug_out_ptr gets every debug_divider-th tick
+  uint64_t    tick_count{0};
+  LatencyStat fast_time, supervisor_time;
+
+  // ---- transition table ----
+  // What the fast rate group computes from the state the supervisory one left
+  struct Tick {
+    ros::Time       now;
+    Desired_State_t des;  // the odometry unless the reference function sets it
+    bool            rotor_low_speed_during_land;
+
+    Tick(const ros::Time &now_, Odom_Data_t &odom)
+        : now(now_)
+        , des(odom)
+        , rotor_low_speed_during_land(false) {}
+  };
+  typedef bool (PX4CtrlFSM::*Guard)(const ros::Time &);
+  typedef void (PX4CtrlFSM::*Action)(const ros::Time &);
+  typedef void (PX4CtrlFSM::*Reference)(Tick &);
+
+  // The first row of the current state whose guard holds fires, then its action runs
+  struct Transition {
+    State_t     from, to;
+    const char *guard_name;
+    Guard       guard;
+    Action      action;
+    bool        warn;  // logged as a warning, a fallback rather than a request
+  };
+  static const Transition TRANSITIONS[];
+  static const Action     DURING[];     // by state, when no transition fires
+  static const Reference  REFERENCE[];  // by state, every tick
+
+  FsmTrace    trace;
+  LatencyStat latency[LATENCY_NUM];
+  ros::Time   latency_start[LATENCY_NUM];  // zero while not pending
+
+  void step_fsm(const ros::Time &now);
+  void latency_begin(Latency_t k, const ros::Time &now) { latency_start[k] = now; }
+  void latency_end(Latency_t k, const ros::Time &now);
+  void check_acks(const ros::Time &now);
+
+  bool guard_hover_switch(const ros::Time &now);
+  bool guard_takeoff_cmd(const ros::Time &now);
+  bool guard_rc_or_odom_lost(const ros::Time &now);
+  bool guard_cmd_ready(const ros::Time &now);
+  bool guard_land_cmd(const ros::Time &now);
+  bool guard_land_rejected(const ros::Time &now);
+  bool guard_cmd_lost(const ros::Time &now);
+  bool guard_height_reached(const ros::Time &now);
+  bool guard_command_switch_off(const ros::Time &now);
+  bool guard_disarmed(const ros::Time &now);
+
+  void enter_hover_from_manual(const ros::Time &now);
+  void enter_takeoff(const ros::Time &now);
+  void enter_manual(const ros::Time &now);
+  void enter_land(const ros::Time &now);
+  void enter_hover_here(const ros::Time &now);
+  void enter_hover_after_takeoff(const ros::Time &now);
+  void enter_manual_disarmed(const ros::Time &now);
+
+  void during_manual(const ros::Time &now);
+  void during_hover(const ros::Time &now);
+  void during_takeoff(const ros::Time &now);
+  void during_land(const ros::Time &now);
+
+  void reference_hover(Tick &t);
+  void reference_cmd_ctrl(Tick &t);
+  void reference_takeoff(Tick &t);
+  void reference_land(Tick &t);
+
+  bool takeoff_requested();
+  bool cmd_requested(const ros::Time &now);
 
   // ---- control related ----
   Desired_State_t get_hover_des();
@@ -85,14 +226,20 @@ class PX4CtrlFSM {
   void            motors_idling(const Imu_Data_t &imu, Controller_Output_t &u);
   void            land_detector(const State_t          state,
                                 const Desired_State_t &des,
-                                const Odom_Data_t     &odom);  // Detect landing
-  void            set_start_pose_for_takeoff_land(const Odom_Data_t &odom);
+                                const Odom_Data_t     &odom,
+                                const ros::Time       &now_time);  // Detect landing
+  void            set_start_pose_for_takeoff_land(const Odom_Data_t &odom, const ros::Time &now);
   Desired_State_t get_rotor_speed_up_des(const ros::Time now);
-  Desired_State_t get_takeoff_land_des(const double speed);
+  Desired_State_t get_takeoff_land_des(const double speed, const ros::Time &now);
+
+  // ---- thrust model warm start ----
+  std::string thrust_model_key();
+  void        reset_thrust_mapping();
+  void        save_thrust_model();
 
   // ---- tools ----
-  void set_hov_with_odom();
-  void set_hov_with_rc();
+  void set_hov_with_odom(const ros::Time &now);
+  void set_hov_with_rc(const ros::Time &now);
 
   bool toggle_offboard_mode(bool on_off);  // It will only try to toggle once, so not blocked.
   bool toggle_arm_disarm(bool arm);        // It will only try to toggle once, so not blocked.
@@ -101,6 +248,24 @@ class PX4CtrlFSM {
   void publish_bodyrate_ctrl(const Controller_Output_t &u, const ros::Time &stamp);
   void publish_attitude_ctrl(const Controller_Output_t &u, const ros::Time &stamp);
   void publish_trigger(const nav_msgs::Odometry &odom_msg);
+  void publish_FCU_setpoint(const mavros_msgs::AttitudeTargetPtr &msg) {
+    if (ctrl_FCU_hook)
+      ctrl_FCU_hook(msg);
+    else
+      ctrl_FCU_pub.publish(msg);
+  }
+
+  template <typename TSrv>
+  bool call_FCU_srv(ros::ServiceClient                  &client,
+                    const std::function<bool(TSrv &)> &hook,
+                    TSrv                               &srv) {
+    return hook ? hook(srv) : client.call(srv);
+  }
+  void record_tick(const ros::Time                              &now_time,
+                   const std::chrono::steady_clock::time_point &tick_start,
+                   const Desired_State_t                        &des,
+                   const Controller_Output_t                    &u,
+                   bool                                          rotor_low_speed_during_land);
 };
 
 #endif
@@ -1,10 +1,67 @@
 #include "PX4CtrlParam.h"
+#include <yaml-cpp/yaml.h>
+#include <algorithm>
 
 Parameter_t::Parameter_t()
 {
 }
 
 void Parameter_t::config_from_ros_handle(const ros::NodeHandle &nh)
+{
+	read_all_params(nh);
+	check_params();
+}
+
+bool Parameter_t::config_from_yaml_file(const std::string &path)
+{
+	YAML::Node root;
+	try
+	{
+		root = YAML::LoadFile(path);
+	}
+	catch (const YAML::Exception &e)
+	{
+		ROS_ERROR_STREAM("Load param file: " << path << " failed. " << e.what());
+		return false;
+	}
+
+	read_all_params(root);
+	check_params();
+	return true;
+}
+
+template <typename TName, typename TVal>
+void Parameter_t::read_essential_param(const YAML::Node &root, const TName &name, TVal &val)
+{
+	// "gain/Kp0" -> root["gain"]["Kp0"], same names as on the parameter server
+	std::string key(name);
+	try
+	{
+		std::vector<YAML::Node> path{root};
+		std::string::size_type begin = 0, end;
+		while ((end = key.find('/', begin)) != std::string::npos)
+		{
+			path.push_back(path.back()[key.substr(begin, end - begin)]);
+			begin = end + 1;
+		}
+		YAML::Node node = path.back()[key.substr(begin)];
+		if (node.IsDefined())
+		{
+			val = node.as<TVal>();
+			return;
+		}
+	}
+	catch (const YAML::Exception &e)
+	{
+		// fall through
+	}
+
+	ROS_ERROR_STREAM("Read param: " << name << " failed.");
+	ROS_BREAK();
+}
+
+template <typename TSource>
+void Parameter_t::read_all_params(const TSource &nh)
 {
 	read_essential_param(nh, "gain/Kp0", gain.Kp0);
 	read_essential_param(nh, "gain/Kp1", gain.Kp1);
@@ -30,11 +87,14 @@ void Parameter_t::config_from_ros_handle(const ros::NodeHandle &nh)
 	read_essential_param(nh, "msg_timeout/imu", msg_timeout.imu);
 	read_essential_param(nh, "msg_timeout/bat", msg_timeout.bat);
 
+	read_essential_param(nh, "controller", controller);
 	read_essential_param(nh, "pose_solver", pose_solver);
 	read_essential_param(nh, "mass", mass);
 	read_essential_param(nh, "gra", gra);
 	read_essential_param(nh, "ctrl_freq_max", ctrl_freq_max);
+	read_essential_param(nh, "supervisor_freq", supervisor_freq);
 	read_essential_param(nh, "use_bodyrate_ctrl", use_bodyrate_ctrl);
+	read_essential_param(nh, "steady_clock", steady_clock);
 	read_essential_param(nh, "max_manual_vel", max_manual_vel);
 	read_essential_param(nh, "max_angle", max_angle);
 	read_essential_param(nh, "low_voltage", low_voltage);
@@ -56,8 +116,63 @@ void Parameter_t::config_from_ros_handle(const ros::NodeHandle &nh)
 	read_essential_param(nh, "thrust_model/K3", thr_map.K3);
 	read_essential_param(nh, "thrust_model/accurate_thrust_model", thr_map.accurate_thrust_model);
 	read_essential_param(nh, "thrust_model/hover_percentage", thr_map.hover_percentage);
+	read_essential_param(nh, "thrust_model/warm_start_file", thr_map.warm_start_file);
+	read_essential_param(nh, "thrust_model/airframe", thr_map.airframe);
+
+	read_essential_param(nh, "mavlink_output/enable", mav_out.enable);
+	read_essential_param(nh, "mavlink_output/url", mav_out.url);
+	read_essential_param(nh, "mavlink_output/system_id", mav_out.system_id);
+	read_essential_param(nh, "mavlink_output/component_id", mav_out.component_id);
+	read_essential_param(nh, "mavlink_output/target_system", mav_out.target_system);
+	read_essential_param(nh, "mavlink_output/target_component", mav_out.target_component);
+
+	read_essential_param(nh, "flight_recorder/enable", flight_rec.enable);
+	read_essential_param(nh, "flight_recorder/path", flight_rec.path);
+	read_essential_param(nh, "flight_recorder/capacity", flight_rec.capacity);
+
+	read_essential_param(nh, "imu_filter/enable", imu_filter.enable);
+	read_essential_param(nh, "imu_filter/sample_rate", imu_filter.sample_rate);
+	read_essential_param(nh, "imu_filter/lpf_cutoff", imu_filter.lpf_cutoff);
+	read_essential_param(nh, "imu_filter/notch_num", imu_filter.notch_num);
+	read_essential_param(nh, "imu_filter/notch_freq", imu_filter.notch_freq);
+	read_essential_param(nh, "imu_filter/notch_q", imu_filter.notch_q);
+
+	read_essential_param(nh, "vibration_analyzer/enable", vib.enable);
+	read_essential_param(nh, "vibration_analyzer/min_freq", vib.min_freq);
+	read_essential_param(nh, "vibration_analyzer/publish_rate", vib.publish_rate);
+	read_essential_param(nh, "vibration_analyzer/drive_notches", vib.drive_notches);
+
+	read_essential_param(nh, "mpc/horizon", mpc.horizon);
+	read_essential_param(nh, "mpc/dt", mpc.dt);
+	read_essential_param(nh, "mpc/Qp_xy", mpc.Qp_xy);
+	read_essential_param(nh, "mpc/Qp_z", mpc.Qp_z);
+	read_essential_param(nh, "mpc/Qv_xy", mpc.Qv_xy);
+	read_essential_param(nh, "mpc/Qv_z", mpc.Qv_z);
+	read_essential_param(nh, "mpc/R", mpc.R);
+	read_essential_param(nh, "mpc/max_iter", mpc.max_iter);
+
+	read_essential_param(nh, "indi/enable", indi.enable);
+	read_essential_param(nh, "indi/gain", indi.gain);
+	read_essential_param(nh, "indi/max_correction", indi.max_correction);
+	read_essential_param(nh, "indi/motor_time_constant", indi.motor_time_constant);
+
+	read_essential_param(nh, "debug/rate", debug.rate);
+	read_essential_param(nh, "debug/reference", debug.reference);
+	read_essential_param(nh, "debug/output", debug.output);
+	read_essential_param(nh, "debug/thrust_model", debug.thrust_model);
+	read_essential_param(nh, "debug/indi", debug.indi);
+
+	read_essential_param(nh, "watchdog/enable", watchdog.enable);
+	read_essential_param(nh, "watchdog/timeout", watchdog.timeout);
+	read_essential_param(nh, "watchdog/descend_acc", watchdog.descend_acc);
+	read_essential_param(nh, "watchdog/max_duration", watchdog.max_duration);
+	read_essential_param(nh, "watchdog/priority", watchdog.priority);
 	
 
+}
+
+void Parameter_t::check_params()
+{
 	max_angle /= (180.0 / M_PI);
 
 	if ( takeoff_land.enable_auto_arm && !takeoff_land.enable )
@@ -71,6 +186,60 @@ void Parameter_t::config_from_ros_handle(const ros::NodeHandle &nh)
 		ROS_ERROR("\"no_RC\" is only allowd with both \"auto_takeoff_land\" and \"enable_auto_arm\" enabled.");
 	}
 
+	if ( vib.drive_notches && (!vib.enable || !imu_filter.enable || imu_filter.notch_num <= 0) )
+	{
+		vib.drive_notches = false;
+		ROS_ERROR("\"drive_notches\" needs \"vibration_analyzer\" and \"imu_filter\" enabled with \"notch_num\" > 0.");
+	}
+
+	if ( mpc.horizon < 1 || mpc.dt <= 0 || mpc.R <= 0 || mpc.max_iter < 1 )
+	{
+		ROS_ERROR("Invalid mpc params, horizon, dt, R and max_iter must be positive.");
+		ROS_BREAK();
+	}
+
+	if ( indi.enable && controller == "linear" )
+	{
+		ROS_WARN("\"indi\" has no effect with the linear controller.");
+	}
+	if ( indi.gain < 0 || indi.gain > 1 || indi.motor_time_constant < 0 )
+	{
+		ROS_ERROR("Invalid indi params, gain must be in 0~1 and motor_time_constant non-negative.");
+		ROS_BREAK();
+	}
+
+	if ( supervisor_freq < 0 || supervisor_freq > ctrl_freq_max )
+	{
+		supervisor_freq = 0;
+		ROS_WARN("\"supervisor_freq\" must be in 0~ctrl_freq_max, the state machine runs every control tick.");
+	}
+
+	if ( debug.rate < 0 || debug.rate > ctrl_freq_max )
+	{
+		debug.rate = 0;
+		ROS_WARN("\"debug/rate\" must be in 0~ctrl_freq_max, debugPx4ctrl disabled.");
+	}
+
+	if ( watchdog.enable && (watchdog.timeout <= 0 || watchdog.max_duration <= 0) )
+	{
+		watchdog.enable = false;
+		ROS_ERROR("\"watchdog/timeout\" and \"watchdog/max_duration\" must be positive, watchdog disabled.");
+	}
+
+	if ( watchdog.descend_acc < 0 || watchdog.descend_acc > 0.5 * gra )
+	{
+		watchdog.descend_acc = std::min(std::max(watchdog.descend_acc, 0.0), 0.5 * gra);
+		ROS_WARN("\"watchdog/descend_acc\" must be in 0~gra/2, clamped to %.2f.", watchdog.descend_acc);
+	}
+
+	// 512 byte records, all of them locked in RAM: 1 << 18 are 128 MB, half an hour at 150 Hz
+	if ( flight_rec.capacity <= 0 || flight_rec.capacity > (1 << 18) )
+	{
+		flight_rec.enable = false;
+		flight_rec.capacity = 0; // FlightRecorder::open() refuses it, also for px4ctrl_sim --record
+		ROS_ERROR("\"flight_recorder/capacity\" must be in 1~262144 records, flight recorder disabled.");
+	}
+
 	if ( thr_map.print_val )
 	{
 		ROS_WARN("You should disable \"print_value\" if you are in regular usage.");
@@ -3,6 +3,11 @@
 
 #include <ros/ros.h>
 
+namespace YAML
+{
+	class Node;
+}
+
 class Parameter_t
 {
 public:
@@ -38,6 +43,8 @@ public:
 		double K3;
 		bool accurate_thrust_model;
 		double hover_percentage;
+		std::string warm_start_file; // empty: every flight starts from the values above
+		std::string airframe;
 	};
 
 	struct RCReverse
@@ -57,29 +64,119 @@ public:
 		double speed;
 	};
 
+	struct MavlinkOutput
+	{
+		bool enable;
+		std::string url;
+		int system_id;
+		int component_id;
+		int target_system;
+		int target_component;
+	};
+
+	struct FlightRecorder
+	{
+		bool enable;
+		std::string path;
+		int capacity;
+	};
+
+	struct ImuFilter
+	{
+		bool enable;
+		double sample_rate; // Hz, of /mavros/imu/data
+		double lpf_cutoff;
+		int notch_num;
+		double notch_freq;
+		double notch_q;
+	};
+
+	struct VibrationAnalysis
+	{
+		bool enable;
+		double min_freq;
+		double publish_rate;
+		bool drive_notches;
+	};
+
+	struct Mpc
+	{
+		int horizon; // steps
+		double dt;
+		double Qp_xy, Qp_z; // weights of the position error
+		double Qv_xy, Qv_z; // weights of the velocity error
+		double R; // weight of the acceleration away from des.a
+		int max_iter; // of the QP solver, bounds the solve time
+	};
+
+	struct Indi
+	{
+		bool enable;
+		double gain; // share of the measured acceleration error removed, 0~1
+		double max_correction; // m/s^2
+		double motor_time_constant; // s, first order lag of the thrust after the actuation delay
+	};
+
+	struct Debug
+	{
+		double rate; // Hz, of debugPx4ctrl, 0 disables it
+		bool reference; // des_p, des_v, des_a
+		bool output; // des_q, des_thr
+		bool thrust_model; // thr2acc, hover_percentage, voltage
+		bool indi; // fb_a, the INDI correction
+	};
+
+	struct Watchdog
+	{
+		bool enable;
+		double timeout; // s without a setpoint from process() before the watchdog sends its own
+		double descend_acc; // m/s^2 of the fallback, 0 hovers
+		double max_duration; // s the watchdog bridges, then PX4's failsafe takes over
+		int priority; // SCHED_FIFO priority of the watchdog thread, 0 keeps the default policy
+	};
+
 	Gain gain;
 	RotorDrag rt_drag;
 	MsgTimeout msg_timeout;
 	RCReverse rc_reverse;
 	ThrustMapping thr_map;
 	AutoTakeoffLand takeoff_land;
+	MavlinkOutput mav_out;
+	FlightRecorder flight_rec;
+	ImuFilter imu_filter;
+	VibrationAnalysis vib;
+	Mpc mpc;
+	Indi indi;
+	Debug debug;
+	Watchdog watchdog;
 
+	std::string controller; // linear, geometric or mpc
 	int pose_solver;
 	double mass;
 	double gra;
 	double max_angle;
 	double ctrl_freq_max;
+	double supervisor_freq; // state machine rate, 0 for every control tick
 	double max_manual_vel;
 	double low_voltage;
 
 	bool use_bodyrate_ctrl;
+	bool steady_clock; // time the control loop with CLOCK_MONOTONIC instead of ROS time
 	// bool print_dbg;
 
 	Parameter_t();
 	void config_from_ros_handle(const ros::NodeHandle &nh);
+	bool config_from_yaml_file(const std::string &path); // for offline tools without a ROS master
 	void config_full_thrust(double hov);
 
 private:
+	template <typename TSource>
+	void read_all_params(const TSource &src);
+	void check_params();
+
+	template <typename TName, typename TVal>
+	void read_essential_param(const YAML::Node &root, const TName &name, TVal &val);
+
 	template <typename TName, typename TVal>
 	void read_essential_param(const ros::NodeHandle &nh, const TName &name, TVal &val)
 	{
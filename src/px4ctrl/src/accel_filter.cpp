@@ -0,0 +1,91 @@
+#include "accel_filter.h"
+
+#include <cmath>
+
+AccelFilter::AccelFilter() : fs_(0), notch_q_(1), notches_(0), initialized_(false) {
+  for (int i = 0; i < MAX_NOTCHES; ++i) notch_freq_[i] = 0;
+  for (int i = 0; i < MAX_SECTIONS; ++i) set_pass(sec_[i]);
+}
+
+void AccelFilter::set_pass(Section &s) {
+  s.b0 = 1;
+  s.b1 = s.b2 = s.a1 = s.a2 = 0;
+}
+
+void AccelFilter::configure(double sample_rate,
+                            double lpf_cutoff,
+                            int    notches,
+                            double notch_freq,
+                            double notch_q) {
+  fs_          = sample_rate;
+  notch_q_     = notch_q > 0 ? notch_q : 1;
+  notches_     = notches < 0 ? 0 : (notches > MAX_NOTCHES ? MAX_NOTCHES : notches);
+  initialized_ = false;
+
+  // Second order Butterworth by the bilinear transform, as LowPassFilter2p in PX4
+  Section &lpf = sec_[0];
+  set_pass(lpf);
+  if (lpf_cutoff > 0 && lpf_cutoff < 0.5 * fs_) {
+    double ohm = std::tan(M_PI * lpf_cutoff / fs_);
+    double c   = 1 + 2 * std::cos(M_PI / 4) * ohm + ohm * ohm;
+    lpf.b0     = ohm * ohm / c;
+    lpf.b1     = 2 * lpf.b0;
+    lpf.b2     = lpf.b0;
+    lpf.a1     = 2 * (ohm * ohm - 1) / c;
+    lpf.a2     = (1 - 2 * std::cos(M_PI / 4) * ohm + ohm * ohm) / c;
+  }
+
+  for (int i = 0; i < MAX_NOTCHES; ++i) set_notch(i, i < notches_ ? notch_freq : 0);
+}
+
+void AccelFilter::set_notch(int i, double center_freq) {
+  if (i < 0 || i >= MAX_NOTCHES) return;
+  notch_freq_[i] = i < notches_ ? center_freq : 0;
+  set_notch_coeffs(sec_[1 + i], notch_freq_[i]);
+}
+
+void AccelFilter::set_notch_coeffs(Section &s, double center_freq) {
+  if (center_freq <= 0 || center_freq >= 0.5 * fs_) {
+    set_pass(s);
+    return;
+  }
+
+  // RBJ cookbook notch, unit gain away from the center
+  double w0    = 2 * M_PI * center_freq / fs_;
+  double alpha = std::sin(w0) / (2 * notch_q_);
+  double a0    = 1 + alpha;
+  s.b0         = 1 / a0;
+  s.b1         = -2 * std::cos(w0) / a0;
+  s.b2         = 1 / a0;
+  s.a1         = s.b1;
+  s.a2         = (1 - alpha) / a0;
+}
+
+// Steady state for a constant input x, all sections have unit DC gain
+void AccelFilter::set_state(Section &s, const double *x) {
+  for (int l = 0; l < LANES; ++l) {
+    s.z1[l] = x[l] - s.b0 * x[l];
+    s.z2[l] = s.b2 * x[l] - s.a2 * x[l];
+  }
+}
+
+Eigen::Vector3d AccelFilter::apply(const Eigen::Vector3d &a) {
+  double x[LANES] = {a(0), a(1), a(2), 0};
+
+  if (!initialized_) {
+    for (int i = 0; i < MAX_SECTIONS; ++i) set_state(sec_[i], x);
+    initialized_ = true;
+  }
+
+  for (int i = 0; i < MAX_SECTIONS; ++i) {
+    Section &s = sec_[i];
+    for (int l = 0; l < LANES; ++l) {
+      double y = s.b0 * x[l] + s.z1[l];
+      s.z1[l]  = s.b1 * x[l] - s.a1 * y + s.z2[l];
+      s.z2[l]  = s.b2 * x[l] - s.a2 * y;
+      x[l]     = y;
+    }
+  }
+
+  return Eigen::Vector3d(x[0], x[1], x[2]);
+}
@@ -0,0 +1,54 @@
+#ifndef __ACCEL_FILTER_H
+#define __ACCEL_FILTER_H
+
+/*
+  Accelerometer filter: an optional second order Butterworth low-pass followed by up to
+  MAX_NOTCHES notches, all biquads in transposed direct form II. The sections are cascaded over
+  4 lanes (x, y, z and a pad), so the inner loops are plain fixed-length loops the compiler
+  vectorizes, and all state is fixed-size, nothing is allocated.
+
+  The notch centers can be moved at any time with set_notch() (e.g. to follow the motor
+  frequency), only the coefficients change and the filter state is kept.
+*/
+
+#include <Eigen/Dense>
+
+class AccelFilter {
+ public:
+  static constexpr int MAX_NOTCHES = 4;
+
+  AccelFilter();
+
+  // lpf_cutoff <= 0 disables the low-pass, notch centers <= 0 disable the notch
+  void configure(double sample_rate, double lpf_cutoff, int notches, double notch_freq,
+                 double notch_q);
+  void set_notch(int i, double center_freq);
+
+  int    notches() const { return notches_; }
+  double notch_freq(int i) const { return notch_freq_[i]; }
+  double sample_rate() const { return fs_; }
+
+  Eigen::Vector3d apply(const Eigen::Vector3d &a);
+  void            reset() { initialized_ = false; }
+
+ private:
+  static constexpr int LANES        = 4;
+  static constexpr int MAX_SECTIONS = 1 + MAX_NOTCHES;
+
+  struct Section {
+    double b0, b1, b2, a1, a2;
+    double z1[LANES], z2[LANES];
+  };
+
+  double  fs_, notch_q_;
+  int     notches_;
+  double  notch_freq_[MAX_NOTCHES];
+  Section sec_[MAX_SECTIONS];  // sec_[0] is the low-pass
+  bool    initialized_;
+
+  static void set_pass(Section &s);
+  void        set_state(Section &s, const double *x);
+  void        set_notch_coeffs(Section &s, double center_freq);
+};
+
+#endif
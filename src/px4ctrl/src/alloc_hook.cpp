@@ -0,0 +1,24 @@
+#include "alloc_hook.h"
+
+#include <stddef.h>
+
+thread_local uint64_t *alloc_hook_counter = nullptr;
+
+extern "C" void *__libc_malloc(size_t n);
+extern "C" void *__libc_calloc(size_t n, size_t size);
+extern "C" void *__libc_realloc(void *p, size_t n);
+
+extern "C" void *malloc(size_t n) noexcept {
+  if (alloc_hook_counter) ++*alloc_hook_counter;
+  return __libc_malloc(n);
+}
+
+extern "C" void *calloc(size_t n, size_t size) noexcept {
+  if (alloc_hook_counter) ++*alloc_hook_counter;
+  return __libc_calloc(n, size);
+}
+
+extern "C" void *realloc(void *p, size_t n) noexcept {
+  if (alloc_hook_counter) ++*alloc_hook_counter;
+  return __libc_realloc(p, n);
+}
@@ -0,0 +1,15 @@
+#ifndef __ALLOC_HOOK_H
+#define __ALLOC_HOOK_H
+
+#include <stdint.h>
+
+/*
+  Heap allocation counter of px4ctrl_sim --alloc-check. alloc_hook.cpp replaces malloc, calloc
+  and realloc of the whole process, so it is only built with -DPX4CTRL_ALLOC_CHECK=ON.
+
+  While alloc_hook_counter is set, every allocation of the calling thread increments it. glibc's
+  operator new, std::allocator, boost and Eigen all end up in malloc.
+*/
+extern thread_local uint64_t *alloc_hook_counter;
+
+#endif
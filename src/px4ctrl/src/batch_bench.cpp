@@ -0,0 +1,154 @@
+/*
+  Throughput of GeometricBatch against GeometricControl::calculateControl(), and a check that
+  both give the same outputs.
+
+  usage: px4ctrl_batch_bench <param.yaml> [--vehicles <n>] [--steps <n>] [--seed <n>]
+
+  --vehicles random states and references are drawn around hover: attitudes tilted up to 30 degrees
+  with any heading, an IMU attitude that differs from the odometry in yaw. The scalar path has
+  CONTROLLERS GeometricControl instances with thrust mappings 20% around the param file, vehicle i
+  uses instance i % CONTROLLERS. Every vehicle goes through both paths once and the largest
+  difference of the thrust and of the attitude quaternion is reported. Then both paths run over all
+  vehicles --steps times and the throughput is printed in vehicles per second.
+
+  The exit code is non-zero if the paths differ by more than rounding.
+*/
+
+#include <chrono>
+#include <random>
+
+#include "controller.h"
+#include "geometric_batch.h"
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s <param.yaml> [--vehicles <n>] [--steps <n>] [--seed <n>]\n", name);
+}
+
+static const double TOLERANCE   = 1e-9;
+static const int    CONTROLLERS = 16;
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  int      vehicles = 4096;
+  int      steps    = 200;
+  uint32_t seed     = 0;
+  for (int i = 2; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--vehicles" && i + 1 < argc)
+      vehicles = atoi(argv[++i]);
+    else if (arg == "--steps" && i + 1 < argc)
+      steps = atoi(argv[++i]);
+    else if (arg == "--seed" && i + 1 < argc)
+      seed = strtoul(argv[++i], nullptr, 10);
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (vehicles < 1 || steps < 1) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  Parameter_t param;
+  if (!param.config_from_yaml_file(argv[1])) return 1;
+  param.controller                    = "geometric";
+  param.indi.enable                   = false;
+  param.thr_map.accurate_thrust_model = false;
+
+  // Scalar inputs, the batch is filled from them
+  std::mt19937                                                            rng(seed);
+  std::uniform_real_distribution<double>                                  uni(-1.0, 1.0);
+  std::vector<Odom_Data_t, Eigen::aligned_allocator<Odom_Data_t>>         odom(vehicles);
+  std::vector<Imu_Data_t, Eigen::aligned_allocator<Imu_Data_t>>           imu(vehicles);
+  std::vector<Desired_State_t, Eigen::aligned_allocator<Desired_State_t>> des(vehicles);
+  std::vector<std::shared_ptr<ControlBase>>                               ctrl(CONTROLLERS);
+  std::vector<double>                                                     thr2acc(CONTROLLERS);
+  for (int c = 0; c < CONTROLLERS; ++c) {
+    Parameter_t p              = param;
+    p.thr_map.hover_percentage = param.thr_map.hover_percentage * (1 + 0.2 * uni(rng));
+    ctrl[c]                    = createController(p);
+    thr2acc[c]                 = p.gra / p.thr_map.hover_percentage;
+  }
+
+  GeometricBatch batch;
+  batch.resize(vehicles);
+  for (int i = 0; i < vehicles; ++i) {
+    Eigen::Vector3d tilt(uni(rng), uni(rng), 0);
+    double          angle = M_PI / 6 * std::abs(uni(rng));
+    double          yaw   = M_PI * uni(rng);
+    odom[i].p             = 5 * Eigen::Vector3d(uni(rng), uni(rng), 1 + uni(rng));
+    odom[i].v             = 2 * Eigen::Vector3d(uni(rng), uni(rng), 0.5 * uni(rng));
+    odom[i].q             = Eigen::AngleAxisd(yaw, Eigen::Vector3d::UnitZ()) *
+                Eigen::AngleAxisd(angle, tilt.normalized());
+    imu[i].q = Eigen::AngleAxisd(0.1 * uni(rng), Eigen::Vector3d::UnitZ()) * odom[i].q;
+
+    des[i].p   = odom[i].p + Eigen::Vector3d(uni(rng), uni(rng), 0.5 * uni(rng));
+    des[i].v   = 2 * Eigen::Vector3d(uni(rng), uni(rng), 0.5 * uni(rng));
+    des[i].a   = 3 * Eigen::Vector3d(uni(rng), uni(rng), 0.5 * uni(rng));
+    des[i].j   = Eigen::Vector3d::Zero();
+    des[i].q   = odom[i].q;
+    des[i].yaw = M_PI * uni(rng);
+
+    batch.thr2acc[i] = thr2acc[i % CONTROLLERS];
+
+    for (int k = 0; k < 3; ++k) {
+      batch.p[k][i]     = odom[i].p(k);
+      batch.v[k][i]     = odom[i].v(k);
+      batch.des_p[k][i] = des[i].p(k);
+      batch.des_v[k][i] = des[i].v(k);
+      batch.des_a[k][i] = des[i].a(k);
+    }
+    batch.qw[i]      = odom[i].q.w();
+    batch.qx[i]      = odom[i].q.x();
+    batch.qy[i]      = odom[i].q.y();
+    batch.qz[i]      = odom[i].q.z();
+    batch.imu_qw[i]  = imu[i].q.w();
+    batch.imu_qx[i]  = imu[i].q.x();
+    batch.imu_qy[i]  = imu[i].q.y();
+    batch.imu_qz[i]  = imu[i].q.z();
+    batch.des_yaw[i] = des[i].yaw;
+  }
+
+  // Equivalence
+  ros::Time                        now(1000.0);
+  std::vector<Controller_Output_t> u(vehicles);
+  for (int i = 0; i < vehicles; ++i)
+    ctrl[i % CONTROLLERS]->calculateControl(des[i], odom[i], imu[i], now, u[i]);
+  batch.compute(param);
+
+  double max_thr = 0, max_q = 0;
+  for (int i = 0; i < vehicles; ++i) {
+    max_thr = std::max(max_thr, std::abs(batch.thrust[i] - u[i].thrust));
+    Eigen::Vector4d d(batch.out_qw[i] - u[i].q.w(), batch.out_qx[i] - u[i].q.x(),
+                      batch.out_qy[i] - u[i].q.y(), batch.out_qz[i] - u[i].q.z());
+    max_q = std::max(max_q, d.lpNorm<Eigen::Infinity>());
+  }
+  printf("%d vehicles, max difference: thrust %.2e, quaternion %.2e\n", vehicles, max_thr, max_q);
+
+  // Throughput
+  typedef std::chrono::steady_clock clk;
+  clk::time_point                   t0 = clk::now();
+  for (int s = 0; s < steps; ++s)
+    for (int i = 0; i < vehicles; ++i)
+      ctrl[i % CONTROLLERS]->calculateControl(des[i], odom[i], imu[i], now, u[i]);
+  double scalar_time = std::chrono::duration<double>(clk::now() - t0).count();
+
+  t0 = clk::now();
+  for (int s = 0; s < steps; ++s) batch.compute(param);
+  double batch_time = std::chrono::duration<double>(clk::now() - t0).count();
+
+  double total = (double)vehicles * steps;
+  printf("scalar: %.3g vehicles/s\n", total / scalar_time);
+  printf("batch:  %.3g vehicles/s, %.1fx\n", total / batch_time, scalar_time / batch_time);
+
+  if (max_thr > TOLERANCE || max_q > TOLERANCE) {
+    fprintf(stderr, "batch and scalar outputs differ by more than %.0e\n", TOLERANCE);
+    return 1;
+  }
+  return 0;
+}
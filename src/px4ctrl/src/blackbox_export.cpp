@@ -0,0 +1,145 @@
+/*
+  Export a px4ctrl flight recorder ring file to CSV, oldest record first.
+
+  usage: px4ctrl_blackbox_export <ring file> [output.csv]   (stdout if no output is given)
+
+  The file may be read while px4ctrl is still writing it. Records overwritten during the export
+  are detected by their sequence number and the write counter, and skipped.
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "flight_recorder.h"
+
+static void print_vec(FILE *f, const double *v, int n) {
+  for (int i = 0; i < n; ++i) fprintf(f, ",%.9g", v[i]);
+}
+
+static void print_vec_header(FILE *f, const char *name, const char *const *suffix, int n) {
+  for (int i = 0; i < n; ++i) fprintf(f, ",%s_%s", name, suffix[i]);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <ring file> [output.csv]\n", argv[0]);
+    return 1;
+  }
+
+  int fd = open(argv[1], O_RDONLY);
+  if (fd < 0) {
+    perror("open");
+    return 1;
+  }
+  struct stat st;
+  fstat(fd, &st);
+  if ((size_t)st.st_size < sizeof(FlightRecorderHeader)) {
+    fprintf(stderr, "%s is not a flight recorder file\n", argv[1]);
+    return 1;
+  }
+
+  const char *base =
+      static_cast<const char *>(mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0));
+  if (base == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+
+  const FlightRecorderHeader *hdr = reinterpret_cast<const FlightRecorderHeader *>(base);
+  if (memcmp(hdr->magic, FLIGHT_RECORDER_MAGIC, sizeof(hdr->magic)) != 0 ||
+      hdr->version != FLIGHT_RECORDER_VERSION || hdr->record_size != sizeof(FlightRecord) ||
+      sizeof(FlightRecorderHeader) + hdr->capacity * sizeof(FlightRecord) > (size_t)st.st_size) {
+    fprintf(stderr, "%s: unsupported or corrupted flight recorder file\n", argv[1]);
+    return 1;
+  }
+  const FlightRecord *records =
+      reinterpret_cast<const FlightRecord *>(base + sizeof(FlightRecorderHeader));
+
+  FILE *out = stdout;
+  if (argc >= 3) {
+    out = fopen(argv[2], "w");
+    if (!out) {
+      perror("fopen");
+      return 1;
+    }
+  }
+
+  static const char *const xyz[]  = {"x", "y", "z"};
+  static const char *const wxyz[] = {"w", "x", "y", "z"};
+
+  fprintf(out, "seq,t,tick_duration_us,state,landed,armed,rotor_low_speed,odom_rcv_t");
+  print_vec_header(out, "odom_p", xyz, 3);
+  print_vec_header(out, "odom_v", xyz, 3);
+  print_vec_header(out, "odom_q", wxyz, 4);
+  print_vec_header(out, "odom_w", xyz, 3);
+  fprintf(out, ",imu_rcv_t");
+  print_vec_header(out, "imu_a", xyz, 3);
+  print_vec_header(out, "imu_w", xyz, 3);
+  print_vec_header(out, "imu_q", wxyz, 4);
+  fprintf(out, ",cmd_rcv_t");
+  print_vec_header(out, "cmd_p", xyz, 3);
+  print_vec_header(out, "cmd_v", xyz, 3);
+  print_vec_header(out, "cmd_a", xyz, 3);
+  print_vec_header(out, "cmd_j", xyz, 3);
+  fprintf(out, ",cmd_yaw,cmd_yaw_rate");
+  print_vec_header(out, "des_p", xyz, 3);
+  print_vec_header(out, "des_v", xyz, 3);
+  print_vec_header(out, "des_a", xyz, 3);
+  fprintf(out, ",des_yaw,u_thrust");
+  print_vec_header(out, "u_q", wxyz, 4);
+  print_vec_header(out, "u_bodyrates", xyz, 3);
+  fprintf(out, ",thr2acc,thr2acc_P,bat_volt\n");
+
+  uint64_t count   = __atomic_load_n(&hdr->write_count, __ATOMIC_ACQUIRE);
+  // Once the ring has wrapped, the oldest slot is the next one to be written, leave it out
+  uint64_t first   = count >= hdr->capacity ? count - hdr->capacity + 1 : 0;
+  uint64_t skipped = 0;
+
+  for (uint64_t n = first; n < count; ++n) {
+    FlightRecord r = records[n % hdr->capacity];
+    // Slot n is rewritten by write number n + capacity, which may be in progress right now
+    uint64_t now_count = __atomic_load_n(&hdr->write_count, __ATOMIC_ACQUIRE);
+    if (r.seq != n || now_count >= n + hdr->capacity) {
+      skipped++;
+      continue;
+    }
+
+    fprintf(out, "%llu,%.9f,%.3f,%u,%u,%u,%u,%.9f", (unsigned long long)r.seq, r.t_ns * 1e-9,
+            r.tick_duration_ns * 1e-3, r.state, r.landed, r.armed, r.rotor_low_speed,
+            r.odom_rcv_ns * 1e-9);
+    print_vec(out, r.odom_p, 3);
+    print_vec(out, r.odom_v, 3);
+    print_vec(out, r.odom_q, 4);
+    print_vec(out, r.odom_w, 3);
+    fprintf(out, ",%.9f", r.imu_rcv_ns * 1e-9);
+    print_vec(out, r.imu_a, 3);
+    print_vec(out, r.imu_w, 3);
+    print_vec(out, r.imu_q, 4);
+    fprintf(out, ",%.9f", r.cmd_rcv_ns * 1e-9);
+    print_vec(out, r.cmd_p, 3);
+    print_vec(out, r.cmd_v, 3);
+    print_vec(out, r.cmd_a, 3);
+    print_vec(out, r.cmd_j, 3);
+    fprintf(out, ",%.9g,%.9g", r.cmd_yaw, r.cmd_yaw_rate);
+    print_vec(out, r.des_p, 3);
+    print_vec(out, r.des_v, 3);
+    print_vec(out, r.des_a, 3);
+    fprintf(out, ",%.9g,%.9g", r.des_yaw, r.u_thrust);
+    print_vec(out, r.u_q, 4);
+    print_vec(out, r.u_bodyrates, 3);
+    fprintf(out, ",%.9g,%.9g,%.9g\n", r.thr2acc, r.thr2acc_P, r.bat_volt);
+  }
+
+  fprintf(stderr, "exported %llu records (%llu skipped)\n",
+          (unsigned long long)(count - first - skipped), (unsigned long long)skipped);
+
+  if (out != stdout) fclose(out);
+  munmap((void *)base, st.st_size);
+  close(fd);
+
+  return 0;
+}
@@ -0,0 +1,50 @@
+#include "box_qp.h"
+
+#include <algorithm>
+#include <cmath>
+
+void BoxQP::setup(const Eigen::MatrixXd &H) {
+  const int n = H.rows();
+
+  // The geometric mean of the extreme eigenvalues balances the primal and dual convergence
+  Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> eig(H, Eigen::EigenvaluesOnly);
+  rho_ = std::sqrt(std::max(eig.eigenvalues()(0), 1e-9) * eig.eigenvalues()(n - 1));
+
+  M_ = (H + rho_ * Eigen::MatrixXd::Identity(n, n)).inverse();
+  x_.setZero(n);
+  z_.setZero(n);
+  z_prev_.setZero(n);
+  w_.setZero(n);
+  rhs_.setZero(n);
+}
+
+void BoxQP::reset() {
+  z_.setZero();
+  w_.setZero();
+}
+
+int BoxQP::solve(const Eigen::VectorXd &f,
+                 const Eigen::VectorXd &lb,
+                 const Eigen::VectorXd &ub,
+                 int                    max_iter,
+                 double                 eps) {
+  // The warm start may lie outside of new bounds
+  z_ = z_.cwiseMax(lb).cwiseMin(ub);
+
+  int it = 0;
+  while (it < max_iter) {
+    it++;
+    rhs_ = rho_ * (z_ - w_) - f;
+    x_.noalias() = M_ * rhs_;
+
+    z_prev_ = z_;
+    rhs_    = ALPHA * x_ + (1 - ALPHA) * z_prev_;  // relaxed x
+    z_      = (rhs_ + w_).cwiseMax(lb).cwiseMin(ub);
+    w_ += rhs_ - z_;
+
+    double r_prim = (x_ - z_).lpNorm<Eigen::Infinity>();
+    double r_dual = rho_ * (z_ - z_prev_).lpNorm<Eigen::Infinity>();
+    if (r_prim < eps && r_dual < eps) break;
+  }
+  return it;
+}
@@ -0,0 +1,41 @@
+#ifndef __BOX_QP_H
+#define __BOX_QP_H
+
+/*
+  Solver for min 0.5 x'Hx + f'x subject to lb <= x <= ub, with H positive definite and fixed.
+
+  ADMM on the splitting x = z, z in the box: every iteration is one product with the
+  precomputed (H + rho I)^-1, a clip and a vector update, so its cost is fixed and the solve time
+  is bounded by the iteration cap. setup() allocates all the workspace, solve() allocates
+  nothing. Each solve starts from the previous solution, which is a good guess when f and the
+  bounds change little between calls.
+*/
+
+#include <Eigen/Dense>
+
+class BoxQP {
+ public:
+  BoxQP() : rho_(1) {}
+
+  void setup(const Eigen::MatrixXd &H);
+  void reset();  // cold start
+
+  // Returns the number of iterations, max_iter if it stopped on the cap
+  int solve(const Eigen::VectorXd &f,
+            const Eigen::VectorXd &lb,
+            const Eigen::VectorXd &ub,
+            int                    max_iter,
+            double                 eps);
+
+  // Always within the bounds, also when the iteration cap is hit
+  const Eigen::VectorXd &solution() const { return z_; }
+
+ private:
+  static constexpr double ALPHA = 1.6;  // over-relaxation
+
+  Eigen::MatrixXd M_;  // (H + rho I)^-1
+  Eigen::VectorXd x_, z_, z_prev_, w_, rhs_;
+  double          rho_;
+};
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef __CLOCK_H
+#define __CLOCK_H
+
+#include <ros/ros.h>
+#include <chrono>
+
+/*
+  Time source of px4ctrl. PX4CtrlFSM::process() samples it once per tick and passes that time
+  down to the land detector, reference generation and the controller, so everything in one tick
+  sees the same instant. The input classes stamp received messages with the same clock.
+*/
+class Clock {
+ public:
+  virtual ~Clock(){};
+  virtual ros::Time now() = 0;
+};
+
+// ROS time, follows /clock when use_sim_time is set (Gazebo, rosbag play --clock)
+class RosClock : public Clock {
+ public:
+  ros::Time now() override { return ros::Time::now(); }
+};
+
+// CLOCK_MONOTONIC, immune to NTP/chrony steps of the system time on the companion computer
+class SteadyClock : public Clock {
+ public:
+  ros::Time now() override {
+    ros::Time t;
+    t.fromNSec(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+                   .count());
+    return t;
+  }
+};
+
+// Virtual time, only moves when told to. Used by replay and simulation.
+class SimClock : public Clock {
+ public:
+  ros::Time now() override { return t_; }
+
+  void set(const ros::Time &t) { t_ = t; }
+  void advance(const ros::Duration &dt) { t_ += dt; }
+
+ private:
+  ros::Time t_;
+};
+
+#endif
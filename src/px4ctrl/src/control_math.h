@@ -0,0 +1,176 @@
+#ifndef __CONTROL_MATH_H
+#define __CONTROL_MATH_H
+
+/*
+  The geometric control law on plain scalars, templated on the scalar type so that it runs in
+  float as well as in double. Everything is inline and free of branches and libm calls other than
+  sqrt, so a loop over vehicles that calls it still vectorizes (GeometricBatchT).
+
+  ControlBase computes it in ControlScalar: double, or float when built with
+  PX4CTRL_FLOAT_CONTROL for the NEON of ARM companion computers, where float is faster and
+  precise enough for attitude and thrust. The estimators stay in double either way.
+*/
+
+#include <cmath>
+
+#ifdef PX4CTRL_FLOAT_CONTROL
+typedef float ControlScalar;
+#else
+typedef double ControlScalar;
+#endif
+
+namespace control_math {
+
+// Nearest integer, adding 1.5 * 2^52 (2^23 in float) leaves no fraction bits. |x| < 2^51 (2^22).
+inline double nearest(double x) {
+  const double MAGIC = 6755399441055744.0;
+  return (x + MAGIC) - MAGIC;
+}
+inline float nearest(float x) {
+  const float MAGIC = 12582912.0f;
+  return (x + MAGIC) - MAGIC;
+}
+
+// sin and cos of r in [-pi/4, pi/4], the polynomials of Cephes sin.c and sinf.c
+inline void sincos_reduced(double r, double &s, double &c) {
+  double rr = r * r;
+  double ps = 1.58962301576546568060E-10;
+  ps        = ps * rr - 2.50507477628578072866E-8;
+  ps        = ps * rr + 2.75573136213857245213E-6;
+  ps        = ps * rr - 1.98412698295895385996E-4;
+  ps        = ps * rr + 8.33333333332211858878E-3;
+  ps        = ps * rr - 1.66666666666666307295E-1;
+  double pc = -1.13585365213876817300E-11;
+  pc        = pc * rr + 2.08757008419747316778E-9;
+  pc        = pc * rr - 2.75573141792967388112E-7;
+  pc        = pc * rr + 2.48015872888517045348E-5;
+  pc        = pc * rr - 1.38888888888730564116E-3;
+  pc        = pc * rr + 4.16666666666665929218E-2;
+  s         = r + r * rr * ps;
+  c         = 1 - 0.5 * rr + rr * rr * pc;
+}
+inline void sincos_reduced(float r, float &s, float &c) {
+  float rr = r * r;
+  float ps = -1.9515295891E-4f;
+  ps       = ps * rr + 8.3321608736E-3f;
+  ps       = ps * rr - 1.6666654611E-1f;
+  float pc = 2.443315711809948E-5f;
+  pc       = pc * rr - 1.388731625493765E-3f;
+  pc       = pc * rr + 4.166664568298827E-2f;
+  s        = r + r * rr * ps;
+  c        = 1 - 0.5f * rr + rr * rr * pc;
+}
+
+// pi / 2 in three parts, the products with the first two are exact for the quadrants of a heading
+template <typename Scalar>
+struct PiOver2;
+template <>
+struct PiOver2<double> {
+  static double p1() { return 1.57079625129699707031E0; }
+  static double p2() { return 7.54978941586159635336E-8; }
+  static double p3() { return 5.39030285815811905290E-15; }
+};
+template <>
+struct PiOver2<float> {
+  static float p1() { return 1.5703125f; }
+  static float p2() { return 4.837512969970703125E-4f; }
+  static float p3() { return 7.54978995489188216E-8f; }
+};
+
+/*
+  sin and cos without branches, libm has no vector version without -ffast-math. Within an ulp or
+  two of libm for headings, i.e. |x| up to a few thousand radians.
+*/
+template <typename Scalar>
+inline void sincos_branchless(Scalar x, Scalar &s, Scalar &c) {
+  Scalar q = nearest(x * Scalar(M_2_PI));
+  Scalar r = ((x - q * PiOver2<Scalar>::p1()) - q * PiOver2<Scalar>::p2()) -
+             q * PiOver2<Scalar>::p3();
+  Scalar sr, cr;
+  sincos_reduced(r, sr, cr);
+
+  // quadrant q mod 4, floor(q / 4) is the nearest integer of q / 4 - 3 / 8
+  Scalar m = q - 4 * nearest(q * Scalar(0.25) - Scalar(0.375));
+  s        = m == 0 ? sr : m == 1 ? cr : m == 2 ? -sr : -cr;
+  c        = m == 0 ? cr : m == 1 ? -sr : m == 2 ? -cr : sr;
+}
+
+/*
+  The output of the geometric controller for the desired acceleration acc (gravity included) and
+  heading (sin_yaw, cos_yaw): the thrust acceleration along the current b3 of q_odom, and the
+  attitude q_out with b3 along acc, expressed against the FCU attitude q_imu. Quaternions are
+  w, x, y, z. Every candidate of a select is computed before it, the compiler does not speculate
+  floating point operations.
+*/
+template <typename Scalar>
+inline void geometric_output(const Scalar acc[3],
+                             Scalar       sin_yaw,
+                             Scalar       cos_yaw,
+                             const Scalar q_odom[4],
+                             const Scalar q_imu[4],
+                             Scalar      &thr_acc,
+                             Scalar       q_out[4]) {
+  const Scalar ax = acc[0], ay = acc[1], az = acc[2];
+  const Scalar qw = q_odom[0], qx = q_odom[1], qy = q_odom[2], qz = q_odom[3];
+
+  // project the desired acceleration onto the current b3
+  Scalar tx = 2 * qx, ty = 2 * qy, tz = 2 * qz;
+  Scalar b3x = tz * qx + ty * qw;
+  Scalar b3y = tz * qy - tx * qw;
+  Scalar b3z = 1 - (tx * qx + ty * qy);
+  thr_acc    = ax * b3x + ay * b3y + az * b3z;
+
+  // desired rotation, columns x = b2c x b3c, y = b2c, z = b3c, b2c perpendicular to the heading
+  Scalar inv = 1 / std::sqrt(ax * ax + ay * ay + az * az);
+  Scalar zx = ax * inv, zy = ay * inv, zz = az * inv;
+  Scalar yx = -zz * sin_yaw;
+  Scalar yy = zz * cos_yaw;
+  Scalar yz = zx * sin_yaw - zy * cos_yaw;
+  inv       = 1 / std::sqrt(yx * yx + yy * yy + yz * yz);
+  yx *= inv;
+  yy *= inv;
+  yz *= inv;
+  Scalar xx = yy * zz - yz * zy;
+  Scalar xy = yz * zx - yx * zz;
+  Scalar xz = yx * zy - yy * zx;
+
+  // rotation matrix to quaternion, the four cases of Eigen blended so that the sign matches
+  Scalar tr  = xx + yy + zz;
+  bool   c0  = !(tr > 0) & !(yy > xx) & !(zz > xx);
+  bool   c1  = !(tr > 0) & (yy > xx) & !(zz > yy);
+  bool   c2  = !(tr > 0) & !c0 & !c1;
+  Scalar d0  = xx - yy - zz + 1;
+  Scalar d1  = yy - zz - xx + 1;
+  Scalar d2  = zz - xx - yy + 1;
+  Scalar d3  = tr + 1;
+  Scalar s   = std::sqrt(c0 ? d0 : c1 ? d1 : c2 ? d2 : d3);
+  Scalar h   = Scalar(0.5) * s;
+  Scalar r   = Scalar(0.5) / s;
+  Scalar a0  = (yz - zy) * r;  // m(2,1) - m(1,2)
+  Scalar a1  = (zx - xz) * r;  // m(0,2) - m(2,0)
+  Scalar a2  = (xy - yx) * r;  // m(1,0) - m(0,1)
+  Scalar s01 = (yx + xy) * r;
+  Scalar s02 = (zx + xz) * r;
+  Scalar s12 = (zy + yz) * r;
+  Scalar dw  = c0 ? a0 : c1 ? a1 : c2 ? a2 : h;
+  Scalar dx  = c0 ? h : c1 ? s01 : c2 ? s02 : a0;
+  Scalar dy  = c0 ? s01 : c1 ? h : c2 ? s12 : a1;
+  Scalar dz  = c0 ? s02 : c1 ? s12 : c2 ? h : a2;
+
+  // q_imu * q_odom^-1 * q
+  inv       = 1 / (qw * qw + qx * qx + qy * qy + qz * qz);
+  Scalar jw = qw * inv, jx = -qx * inv, jy = -qy * inv, jz = -qz * inv;
+  Scalar iw = q_imu[0], ix = q_imu[1], iy = q_imu[2], iz = q_imu[3];
+  Scalar ew = iw * jw - ix * jx - iy * jy - iz * jz;
+  Scalar ex = iw * jx + ix * jw + iy * jz - iz * jy;
+  Scalar ey = iw * jy + iy * jw + iz * jx - ix * jz;
+  Scalar ez = iw * jz + iz * jw + ix * jy - iy * jx;
+  q_out[0]  = ew * dw - ex * dx - ey * dy - ez * dz;
+  q_out[1]  = ew * dx + ex * dw + ey * dz - ez * dy;
+  q_out[2]  = ew * dy + ey * dw + ez * dx - ex * dz;
+  q_out[3]  = ew * dz + ez * dw + ex * dy - ey * dx;
+}
+
+}  // namespace control_math
+
+#endif
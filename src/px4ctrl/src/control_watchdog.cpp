@@ -0,0 +1,130 @@
+#include "control_watchdog.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+#include <chrono>
+
+ControlWatchdog::ControlWatchdog(const Parameter_t                            &param,
+                                 const std::shared_ptr<Clock>                 &clock,
+                                 const ros::Publisher                         &pub,
+                                 const std::shared_ptr<MavlinkSetpointOutput> &mavlink_out)
+    : param_(param.watchdog)
+    , descend_scale_(1 - param.watchdog.descend_acc / param.gra)
+    , send_period_(1.0 / param.ctrl_freq_max)
+    , clock_(clock)
+    , pub_(pub)
+    , mavlink_out_(mavlink_out)
+    , beat_ns_(0)
+    , yaw_(0)
+    , hover_thrust_(0)
+    , flying_(false)
+    , running_(false) {
+  msg_.header.frame_id = "FCU";
+  msg_.type_mask       = mavros_msgs::AttitudeTarget::IGNORE_ROLL_RATE |
+                         mavros_msgs::AttitudeTarget::IGNORE_PITCH_RATE |
+                         mavros_msgs::AttitudeTarget::IGNORE_YAW_RATE;
+}
+
+void ControlWatchdog::beat(const Eigen::Quaterniond &q, double hover_thrust, bool flying) {
+  // heading of the body x axis, the fallback keeps it
+  double yaw =
+      std::atan2(2 * (q.w() * q.z() + q.x() * q.y()), 1 - 2 * (q.y() * q.y() + q.z() * q.z()));
+  yaw_.store(yaw, std::memory_order_relaxed);
+  hover_thrust_.store(hover_thrust, std::memory_order_relaxed);
+  flying_.store(flying, std::memory_order_relaxed);
+  beat_ns_.store(clock_->now().toNSec(), std::memory_order_release);
+}
+
+void ControlWatchdog::start() {
+  if (thread_.joinable()) return;
+  running_ = true;
+  thread_  = std::thread(&ControlWatchdog::run, this);
+
+  if (param_.priority > 0) {
+    sched_param sp;
+    sp.sched_priority = param_.priority;
+    int err           = pthread_setschedparam(thread_.native_handle(), SCHED_FIFO, &sp);
+    if (err)
+      ROS_WARN("[px4ctrl] Watchdog runs at normal priority, SCHED_FIFO %d refused: %s",
+               param_.priority, strerror(err));
+  }
+}
+
+void ControlWatchdog::stop() {
+  running_ = false;
+  if (thread_.joinable()) thread_.join();
+}
+
+void ControlWatchdog::run() {
+  const int64_t timeout_ns = (int64_t)(param_.timeout * 1e9);
+  const int64_t max_ns     = (int64_t)(param_.max_duration * 1e9);
+  const std::chrono::nanoseconds check(timeout_ns / 4);
+  const std::chrono::nanoseconds send_period((int64_t)(send_period_ * 1e9));
+
+  bool          stalled = false;
+  WatchdogStall stall;
+  int64_t       stall_beat = 0;  // beat_ns_ when the stall was detected
+
+  while (running_.load(std::memory_order_relaxed)) {
+    int64_t beat = beat_ns_.load(std::memory_order_acquire);
+    int64_t now  = clock_->now().toNSec();
+
+    if (stalled && beat != stall_beat) {
+      stall.length = (beat - stall_beat) * 1e-9;
+      ROS_WARN("[px4ctrl] Control loop back after %.3f s, the watchdog sent %d setpoints.",
+               stall.length, stall.setpoints);
+      if (on_stall) on_stall(stall);
+      stalled = false;
+    }
+
+    if (!stalled && beat && now - beat > timeout_ns && flying_.load(std::memory_order_relaxed)) {
+      stalled         = true;
+      stall_beat      = beat;
+      stall.start.fromNSec(beat);
+      stall.setpoints = 0;
+      stall.expired   = false;
+      ROS_ERROR("[px4ctrl] Control loop stalled for %.3f s, the watchdog %s.", (now - beat) * 1e-9,
+                param_.descend_acc > 0 ? "descends" : "hovers");
+    }
+
+    if (stalled && !stall.expired) {
+      if (now - stall_beat > max_ns) {
+        stall.expired = true;
+        ROS_ERROR("[px4ctrl] Control loop stalled for more than %.1f s, the watchdog gives up.",
+                  param_.max_duration);
+      } else {
+        // process() may have come back since the check above, never send after its setpoint
+        if (beat_ns_.load(std::memory_order_acquire) != stall_beat) continue;
+        send(clock_->now());
+        stall.setpoints++;
+        std::this_thread::sleep_for(send_period);
+        continue;
+      }
+    }
+    std::this_thread::sleep_for(check);
+  }
+}
+
+void ControlWatchdog::send(const ros::Time &stamp) {
+  double yaw    = yaw_.load(std::memory_order_relaxed);
+  double thrust = hover_thrust_.load(std::memory_order_relaxed) * descend_scale_;
+
+  if (mavlink_out_) {
+    mavlink_out_->send_attitude_target(
+        stamp, msg_.type_mask, Eigen::Quaterniond(Eigen::AngleAxisd(yaw, Eigen::Vector3d::UnitZ())),
+        Eigen::Vector3d::Zero(), thrust);
+    return;
+  }
+
+  msg_.header.stamp  = stamp;
+  msg_.orientation.w = std::cos(yaw / 2);
+  msg_.orientation.x = 0;
+  msg_.orientation.y = 0;
+  msg_.orientation.z = std::sin(yaw / 2);
+  msg_.thrust        = thrust;
+
+  // by reference, roscpp serializes it before returning
+  pub_.publish(msg_);
+}
@@ -0,0 +1,85 @@
+#ifndef __CONTROL_WATCHDOG_H
+#define __CONTROL_WATCHDOG_H
+
+#include <mavros_msgs/AttitudeTarget.h>
+#include <ros/ros.h>
+#include <Eigen/Dense>
+
+#include <atomic>
+#include <functional>
+#include <thread>
+
+#include "PX4CtrlParam.h"
+#include "clock.h"
+#include "mavlink_output.h"
+
+/*
+  Keeps setpoints going to the FCU while process() stalls: a blocking service call, a slow
+  callback. Without them PX4 leaves OFFBOARD after COM_OF_LOSS_T and falls back to whatever
+  COM_OBL_RC_ACT says.
+
+  process() beat()s right after it sent its setpoint, with the attitude of that setpoint, the hover
+  thrust of the current thrust mapping and whether px4ctrl flies the vehicle. A thread, SCHED_FIFO
+  at watchdog/priority if it may, wakes up every quarter of watchdog/timeout and checks the age of
+  the last beat. Ages, the timeout and max_duration are on the FSM clock, like the beats; only the
+  sleeps between checks and between fallback setpoints are wall time. Past the timeout, and only if
+  px4ctrl was flying, it sends a level attitude with the last heading and the thrust of a descent at
+  watchdog/descend_acc (0: hover) at the control rate, until the beats come back or for
+  watchdog/max_duration at most, after which PX4's own failsafe takes over. The fallback is open
+  loop, it bridges stalls, it does not fly.
+
+  Every stall is logged and handed to on_stall when it ends, with its length from the last beat
+  before to the first beat after. The setpoints take the same way as those of process(), the
+  MAVLink output if there is one, mavros/setpoint_raw/attitude otherwise.
+
+  The clock is read from the watchdog thread, RosClock and SteadyClock are fine with that.
+*/
+
+struct WatchdogStall {
+  ros::Time start;      // of the last beat before the stall
+  double    length;     // s, between the beats around the stall
+  int       setpoints;  // sent by the watchdog
+  bool      expired;    // max_duration was reached and the watchdog gave up
+};
+
+class ControlWatchdog {
+ public:
+  ControlWatchdog(const Parameter_t                            &param,
+                  const std::shared_ptr<Clock>                 &clock,
+                  const ros::Publisher                         &pub,
+                  const std::shared_ptr<MavlinkSetpointOutput> &mavlink_out);
+  ~ControlWatchdog() { stop(); }
+
+  // The control loop, after every setpoint. q: attitude setpoint, hover_thrust: 0~1
+  void beat(const Eigen::Quaterniond &q, double hover_thrust, bool flying);
+
+  void start();
+  void stop();
+
+  std::function<void(const WatchdogStall &)> on_stall;  // on the watchdog thread
+
+ private:
+  Parameter_t::Watchdog param_;
+  double                descend_scale_;  // of the hover thrust
+  double                send_period_;    // s
+
+  std::shared_ptr<Clock>                 clock_;
+  ros::Publisher                         pub_;
+  std::shared_ptr<MavlinkSetpointOutput> mavlink_out_;  // instead of pub_ if set
+
+  // written by beat() only
+  std::atomic<int64_t> beat_ns_;  // FSM clock, 0 before the first beat
+  std::atomic<double>  yaw_, hover_thrust_;
+  std::atomic<bool>    flying_;
+
+  // watchdog thread only
+  mavros_msgs::AttitudeTarget msg_;
+
+  std::thread       thread_;
+  std::atomic<bool> running_;
+
+  void run();
+  void send(const ros::Time &stamp);
+};
+
+#endif
@@ -1,6 +1,8 @@
 #include "controller.h"
 #include "Eigen/src/Geometry/Quaternion.h"
 
+#include <chrono>
+
 using namespace std;
 
 double ControlBase::fromQuaternion2yaw(Eigen::Quaterniond q) {
@@ -13,37 +15,176 @@ double ControlBase::fromQuaternion2yaw(Eigen::Quaterniond q) {
   compute throttle percentage
 */
 double ControlBase::computeDesiredCollectiveThrustSignal(const Eigen::Vector3d &des_acc) {
-  double throttle_percentage(0.0);
+  return computeThrustSignal(des_acc(2));
+}
 
+double ControlBase::computeThrustSignal(double des_acc_z) {
   /* compute throttle, thr2acc has been estimated before */
-  throttle_percentage = des_acc(2) / thr2acc_;
+  if (!useThrustModel()) return des_acc_z / thr2acc_;
+
+  /* invert F = K1 * V^K2 * (K3 * u^2 + (1 - K3) * u) */
+  double K2 = thr_model_(1);
+  double K3 = thr_model_(2);
+  double h  = param_.mass * des_acc_z /
+             std::exp(thr_model_(0) + K2 * (std::log(volt_) - log_volt_ref_));
+  if (h <= 0 || K3 < 1e-6) return h;
+  return (-(1 - K3) + std::sqrt((1 - K3) * (1 - K3) + 4 * K3 * h)) / (2 * K3);
+}
+
+void ControlBase::computeGeometricOutput(Eigen::Vector3d     &des_acc,
+                                         double               des_yaw,
+                                         const Odom_Data_t   &odom,
+                                         const Imu_Data_t    &imu,
+                                         const ros::Time     &now,
+                                         Controller_Output_t &u) {
+  if (param_.indi.enable) {
+    indi_corr_ = indiCorrection(odom, imu, now);
+    des_acc -= indi_corr_;
+  }
+
+  // in ControlScalar, see control_math.h
+  typedef ControlScalar S;
+  S acc[3]    = {(S)des_acc(0), (S)des_acc(1), (S)des_acc(2)};
+  S q_odom[4] = {(S)odom.q.w(), (S)odom.q.x(), (S)odom.q.y(), (S)odom.q.z()};
+  S q_imu[4]  = {(S)imu.q.w(), (S)imu.q.x(), (S)imu.q.y(), (S)imu.q.z()};
+  S thr_acc, q[4];
+  control_math::geometric_output(acc, (S)std::sin(des_yaw), (S)std::cos(des_yaw), q_odom, q_imu,
+                                 thr_acc, q);
+  u.thrust = computeThrustSignal(thr_acc);
+
+  if (param_.indi.enable) {
+    indi_head_                = (indi_head_ + 1) % (int)indi_t_.size();
+    indi_t_[indi_head_]       = now.toSec();
+    indi_thr_acc_[indi_head_] = thr_acc;
+    indi_count_               = std::min(indi_count_ + 1, (int)indi_t_.size());
+  }
+
+  // b3 along des_acc, b2 perpendicular to it and to the heading, expressed against imu.q
+  u.q = Eigen::Quaterniond(q[0], q[1], q[2], q[3]);
+  /* see https://blog.csdn.net/weixin_44684139/article/details/109817172. convert the q in ENU frame
+   * (defaut in ROS, also in odom)  into the NED frame (used in FCU). because we use the
+   * setpoint_raw/attitude message, so we need to convert it manually. setpoint_attitude/attitude
+   * uses ENU and no need to convert. */
+}
+
+Eigen::Vector3d ControlBase::indiCorrection(const Odom_Data_t &odom,
+                                            const Imu_Data_t  &imu,
+                                            const ros::Time   &now) {
+  if (!indi_active_ || (now - imu.rcv_stamp).toSec() > kIndiImuTimeout_) {
+    indi_model_t_ = 0;
+    return Eigen::Vector3d::Zero();
+  }
+
+  // The thrust acting now was commanded one actuation delay ago, and a_filt lags the true
+  // acceleration by the group delay of the low-pass
+  double t = now.toSec() - delay_est_.delay() - indi_filter_delay_;
+  int    i = indi_head_;
+  int    n = 0;
+  while (n < indi_count_ && indi_t_[i] > t) {
+    i = (i + (int)indi_t_.size() - 1) % (int)indi_t_.size();
+    n++;
+  }
+  if (n == indi_count_) return Eigen::Vector3d::Zero();
+
+  // The motors follow the delayed command with a first order lag
+  double dt = indi_model_t_ > 0 ? now.toSec() - indi_model_t_ : 0;
+  if (dt <= 0 || dt > kIndiImuTimeout_) {
+    indi_thr_model_ = indi_thr_acc_[i];
+  } else if (param_.indi.motor_time_constant > 0) {
+    indi_thr_model_ += (indi_thr_acc_[i] - indi_thr_model_) *
+                       (1 - std::exp(-dt / param_.indi.motor_time_constant));
+  } else {
+    indi_thr_model_ = indi_thr_acc_[i];
+  }
+  indi_model_t_ = now.toSec();
+
+  Eigen::Matrix3d R    = odom.q.toRotationMatrix();
+  Eigen::Vector3d corr = R * imu.a_filt - indi_thr_model_ * R.col(2);
+  double          norm = corr.norm();
+  if (norm > param_.indi.max_correction) corr *= param_.indi.max_correction / norm;
+  return param_.indi.gain * corr;
+}
+
+void ControlBase::recordOutput(const Desired_State_t     &des,
+                               const Eigen::Vector3d     &des_acc,
+                               const ros::Time           &now,
+                               const Controller_Output_t &u) {
+  // used for debug, DebugOutput publishes the groups that are enabled
+  debug_msg_.des_p_x = des.p(0);
+  debug_msg_.des_p_y = des.p(1);
+  debug_msg_.des_p_z = des.p(2);
+
+  debug_msg_.des_v_x = des.v(0);
+  debug_msg_.des_v_y = des.v(1);
+  debug_msg_.des_v_z = des.v(2);
+
+  debug_msg_.des_a_x = des_acc(0);
+  debug_msg_.des_a_y = des_acc(1);
+  debug_msg_.des_a_z = des_acc(2);
+
+  debug_msg_.des_q_x = u.q.x();
+  debug_msg_.des_q_y = u.q.y();
+  debug_msg_.des_q_z = u.q.z();
+  debug_msg_.des_q_w = u.q.w();
+
+  debug_msg_.des_thr = u.thrust;
+
+  debug_msg_.fb_a_x = indi_corr_(0);
+  debug_msg_.fb_a_y = indi_corr_(1);
+  debug_msg_.fb_a_z = indi_corr_(2);
+
+  debug_msg_.thr2acc          = thr2acc_;
+  debug_msg_.hover_percentage = param_.gra / thr2acc_;
+  debug_msg_.voltage          = volt_;
+
+  // Used for thrust-accel mapping estimation
+  timed_thrust_.push(std::pair<ros::Time, double>(now, u.thrust));
+}
+
+double ControlBase::maxThrustAcc(void) const {
+  if (!useThrustModel()) return thr2acc_;
+  return std::exp(thr_model_(0) + thr_model_(1) * (std::log(volt_) - log_volt_ref_)) / param_.mass;
+}
 
-  return throttle_percentage;
+bool ControlBase::useThrustModel(void) const {
+  return param_.thr_map.accurate_thrust_model && volt_ > 0;
 }
 
-bool ControlBase::estimateThrustModel(const Eigen::Vector3d &est_a, const Parameter_t &param) {
-  ros::Time t_now = ros::Time::now();
+bool ControlBase::estimateThrustModel(const Eigen::Vector3d &est_a,
+                                      double                 volt,
+                                      const ros::Time       &t_now,
+                                      const Parameter_t     &param) {
+  if (volt > 0) volt_ = volt;
+  if (!timed_thrust_.empty())
+    delay_est_.feed(t_now.toSec(), timed_thrust_.back().second, est_a(2));
+
+  // Choose data from delay -5ms ~ delay +5ms ago
+  double delay = delay_est_.delay();
   while (timed_thrust_.size() >= 1) {
-    // Choose data before 35~45ms ago
     std::pair<ros::Time, double> t_t         = timed_thrust_.front();
     double                       time_passed = (t_now - t_t.first).toSec();
-    if (time_passed > 0.045)  // 45ms
-    {
+    if (time_passed > delay + 0.005) {
       // printf("continue, time_passed=%f\n", time_passed);
       timed_thrust_.pop();
       continue;
     }
-    if (time_passed < 0.035)  // 35ms
-    {
+    if (time_passed < delay - 0.005) {
       // printf("skip, time_passed=%f\n", time_passed);
       return false;
     }
 
+    double thr = t_t.second;
+    timed_thrust_.pop();
+
+    thr_updates_++;
+    if (useThrustModel()) {
+      updateThrustModel(est_a(2), thr, param);
+      return true;
+    }
+
     /***********************************************************/
     /* Recursive least squares algorithm with vanishing memory */
     /***********************************************************/
-    double thr = t_t.second;
-    timed_thrust_.pop();
 
     /***********************************/
     /* Model: est_a(2) = thr1acc_ * thr */
@@ -61,9 +202,91 @@ bool ControlBase::estimateThrustModel(const Eigen::Vector3d &est_a, const Parame
   return false;
 }
 
-void ControlBase::resetThrustMapping(void) {
+void ControlBase::updateThrustModel(double acc_z, double thr, const Parameter_t &param) {
+  // Rebase the scale to the present voltage on the first update, see thr_model_
+  double log_volt = std::log(volt_);
+  if (log_volt_ref_ == 0) {
+    thr_model_(0) += thr_model_(1) * log_volt;
+    log_volt_ref_ = log_volt;
+  }
+
+  /******************************************************************/
+  /* Extended Kalman filter, random walk parameters                  */
+  /* Model: acc_z = K1 * V^K2 * (K3 * thr^2 + (1 - K3) * thr) / mass */
+  /******************************************************************/
+  double             dv    = log_volt - log_volt_ref_;
+  double             K3    = thr_model_(2);
+  double             scale = std::exp(thr_model_(0) + thr_model_(1) * dv) / param.mass;
+  double             acc   = scale * (K3 * thr * thr + (1 - K3) * thr);
+  Eigen::RowVector3d H(acc, acc * dv, scale * (thr * thr - thr));
+
+  // Unlike the forgetting factor of the scalar model, the process noise does not let the variance
+  // of K2 and K3 wind up while hover hardly excites them, they stay near the calibration instead.
+  thr_model_P_ += thr_model_Q_;
+  double          gamma = 1 / (kThrustModelAccVar_ + (H * thr_model_P_ * H.transpose())(0));
+  Eigen::Vector3d K     = gamma * thr_model_P_ * H.transpose();
+  thr_model_ += K * (acc_z - acc);
+  thr_model_P_ -= K * H * thr_model_P_;
+  thr_model_(1) = std::min(std::max(thr_model_(1), 0.0), 4.0);
+  thr_model_(2) = std::min(std::max(thr_model_(2), 0.0), 1.0);
+
+  // Equivalent linear mapping at hover, for debugging and the flight recorder
+  thr2acc_ = param.gra / computeThrustSignal(param.gra);
+  P_       = thr_model_P_(0, 0);
+}
+
+Eigen::Vector3d ControlBase::getThrustModel(void) const {
+  return Eigen::Vector3d(std::exp(thr_model_(0) - thr_model_(1) * log_volt_ref_), thr_model_(1),
+                         thr_model_(2));
+}
+
+Eigen::Vector3d ControlBase::thrustModelInitialVar(void) {
+  return Eigen::Vector3d(0.2 * 0.2, 0.3 * 0.3, 0.05 * 0.05);
+}
+
+void ControlBase::resetThrustMapping(double volt) {
+  if (volt > 0) volt_ = volt;
+  thr_updates_ = 0;
+
   thr2acc_ = param_.gra / param_.thr_map.hover_percentage;
   P_       = 1e6;
+
+  thr_model_ << std::log(param_.thr_map.K1), param_.thr_map.K2, param_.thr_map.K3;
+  thr_model_P_  = thrustModelInitialVar().asDiagonal();
+  thr_model_Q_  = Eigen::Vector3d(1e-6, 1e-8, 1e-8).asDiagonal();
+  log_volt_ref_ = 0;
+
+  if (!has_warm_start_) return;
+
+  // thr2acc scales with V^K2 and with the inverse of the mass
+  const ThrustModelState &w = warm_start_;
+  thr2acc_                  = w.thr2acc * w.mass / param_.mass;
+  if (volt_ > 0 && w.volt > 0) thr2acc_ *= std::pow(volt_ / w.volt, param_.thr_map.K2);
+  P_ = std::min(w.P * kWarmStartInflation_, 1e6);
+
+  if (w.has_K) {
+    thr_model_ << std::log(w.K(0)), w.K(1), w.K(2);
+    for (int i = 0; i < 3; ++i)
+      thr_model_P_(i, i) = std::min(w.K_var(i) * kWarmStartInflation_, thr_model_P_(i, i));
+  }
+}
+
+void ControlBase::warmStartThrustMapping(const ThrustModelState &s) {
+  warm_start_     = s;
+  has_warm_start_ = true;
+}
+
+bool ControlBase::getThrustModelState(ThrustModelState &s) const {
+  if (thr_updates_ < kMinUpdatesToSave_ || volt_ <= 0) return false;
+
+  s.volt    = volt_;
+  s.mass    = param_.mass;
+  s.thr2acc = thr2acc_;
+  s.P       = P_;
+  s.has_K   = useThrustModel();
+  s.K       = getThrustModel();
+  s.K_var   = thr_model_P_.diagonal();
+  return true;
 }
 
 /**
@@ -72,13 +295,15 @@ void ControlBase::resetThrustMapping(void) {
  * @param des desired state
  * @param odom odometry data at current time
  * @param imu imu data at current time
+ * @param now time of the current control tick
  * @param u output of controller, including thrust and attitude
- * @return quadrotor_msgs::Px4ctrlDebug debug message
+ * @return quadrotor_msgs::Px4ctrlDebug debug message, valid until the next call
  */
-quadrotor_msgs::Px4ctrlDebug LinearControl::calculateControl(const Desired_State_t &des,
-                                                             const Odom_Data_t     &odom,
-                                                             const Imu_Data_t      &imu,
-                                                             Controller_Output_t   &u) {
+const quadrotor_msgs::Px4ctrlDebug &LinearControl::calculateControl(const Desired_State_t &des,
+                                                                    const Odom_Data_t     &odom,
+                                                                    const Imu_Data_t      &imu,
+                                                                    const ros::Time       &now,
+                                                                    Controller_Output_t   &u) {
   // compute disired acceleration
   Eigen::Vector3d des_acc(0.0, 0.0, 0.0);
   Eigen::Vector3d Kp, Kv;
@@ -105,31 +330,7 @@ quadrotor_msgs::Px4ctrlDebug LinearControl::calculateControl(const Desired_State
    * setpoint_raw/attitude message, so we need to convert it manually. setpoint_attitude/attitude
    * uses ENU and no need to convert. */
 
-  // used for debug
-  //  debug_msg_.des_p_x = des.p(0);
-  //  debug_msg_.des_p_y = des.p(1);
-  //  debug_msg_.des_p_z = des.p(2);
-
-  debug_msg_.des_v_x = des.v(0);
-  debug_msg_.des_v_y = des.v(1);
-  debug_msg_.des_v_z = des.v(2);
-
-  debug_msg_.des_a_x = des_acc(0);
-  debug_msg_.des_a_y = des_acc(1);
-  debug_msg_.des_a_z = des_acc(2);
-
-  debug_msg_.des_q_x = u.q.x();
-  debug_msg_.des_q_y = u.q.y();
-  debug_msg_.des_q_z = u.q.z();
-  debug_msg_.des_q_w = u.q.w();
-
-  debug_msg_.des_thr = u.thrust;
-
-  // Used for thrust-accel mapping estimation
-  timed_thrust_.push(std::pair<ros::Time, double>(ros::Time::now(), u.thrust));
-  while (timed_thrust_.size() > 100) {
-    timed_thrust_.pop();
-  }
+  recordOutput(des, des_acc, now, u);
   return debug_msg_;
 }
 
@@ -139,13 +340,15 @@ quadrotor_msgs::Px4ctrlDebug LinearControl::calculateControl(const Desired_State
  * @param des desired state
  * @param odom odometry data at current time
  * @param imu imu data at current time
+ * @param now time of the current control tick
  * @param u output of controller, including thrust and attitude
- * @return quadrotor_msgs::Px4ctrlDebug debug message
+ * @return quadrotor_msgs::Px4ctrlDebug debug message, valid until the next call
  */
-quadrotor_msgs::Px4ctrlDebug GeometricControl::calculateControl(const Desired_State_t &des,
-                                                                const Odom_Data_t     &odom,
-                                                                const Imu_Data_t      &imu,
-                                                                Controller_Output_t   &u) {
+const quadrotor_msgs::Px4ctrlDebug &GeometricControl::calculateControl(const Desired_State_t &des,
+                                                                       const Odom_Data_t     &odom,
+                                                                       const Imu_Data_t      &imu,
+                                                                       const ros::Time       &now,
+                                                                       Controller_Output_t   &u) {
   // compute disired acceleration
   Eigen::Vector3d des_acc(0.0, 0.0, 0.0);
   Eigen::Vector3d Kp, Kv;
@@ -155,64 +358,142 @@ quadrotor_msgs::Px4ctrlDebug GeometricControl::calculateControl(const Desired_St
   des_acc = des.a + Kv.asDiagonal() * (des.v - odom.v) + Kp.asDiagonal() * (des.p - odom.p);
   des_acc += Eigen::Vector3d(0, 0, param_.gra);
 
-  Eigen::Vector3d b3 = odom.q.toRotationMatrix().col(2);
-
-  // project desired acceleration onto b3
-  u.thrust = des_acc.dot(b3) / thr2acc_;
-
-  // align b3 with desired acceleration
-  Eigen::Vector3d b3c = des_acc.normalized();
+  computeGeometricOutput(des_acc, des.yaw, odom, imu, now, u);
 
-  // b2c should be perpendicular to b3c and a_yaw
-  Eigen::Vector3d a_yaw = Eigen::Vector3d(std::cos(des.yaw), std::sin(des.yaw), 0);
-  Eigen::Vector3d b2c   = b3c.cross(a_yaw).normalized();
-
-  // desired rotation matrix
-  Eigen::Matrix3d R_des = Eigen::Matrix3d::Zero();
-  R_des.col(0)          = b2c.cross(b3c);
-  R_des.col(1)          = b2c;
-  R_des.col(2)          = b3c;
-
-  // desired attitude
-  Eigen::Quaterniond q = Eigen::Quaterniond(R_des);
-  std::cout << "q_des: " << q.x() << " " << q.y() << " " << q.z() << " " << q.w() << std::endl;
-  std::cout << "q_cur: " << odom.q.x() << " " << odom.q.y() << " " << odom.q.z() << " "
-            << odom.q.w() << std::endl;
+  recordOutput(des, des_acc, now, u);
+  return debug_msg_;
+}
 
-  // error vector
-  // Eigen::Vector3d e_R = 0.5 * veeMap(R_des.transpose() * odom.q.toRotationMatrix() -
-  //                                    odom.q.toRotationMatrix().transpose() * R_des);
+MpcControl::MpcControl(Parameter_t &param)
+    : ControlBase(param)
+    , N_(param.mpc.horizon)
+    , dt_(param.mpc.dt)
+    , period_(1.0 / param.ctrl_freq_max)
+    , R_(param.mpc.R)
+    , solve_worst_(0)
+    , solve_sum_(0)
+    , solves_(0)
+    , capped_(0) {
+  // Double integrator per axis, state k + 1 after the inputs 0 ~ k
+  Phi_.setZero(2 * N_, 2);
+  Eigen::MatrixXd Gamma = Eigen::MatrixXd::Zero(2 * N_, N_);
+  for (int k = 0; k < N_; ++k) {
+    Phi_(2 * k, 0)     = 1;
+    Phi_(2 * k, 1)     = (k + 1) * dt_;
+    Phi_(2 * k + 1, 1) = 1;
+    for (int j = 0; j <= k; ++j) {
+      Gamma(2 * k, j)     = dt_ * dt_ * (0.5 + k - j);
+      Gamma(2 * k + 1, j) = dt_;
+    }
+  }
 
-  u.q = imu.q * odom.q.inverse() * q;
-  /* see https://blog.csdn.net/weixin_44684139/article/details/109817172. convert the q in ENU frame
-   * (defaut in ROS, also in odom)  into the NED frame (used in FCU). because we use the
-   * setpoint_raw/attitude message, so we need to convert it manually. setpoint_attitude/attitude
-   * uses ENU and no need to convert. */
+  Eigen::Matrix2d A;
+  Eigen::Vector2d B(dt_ * dt_ / 2, dt_);
+  A << 1, dt_, 0, 1;
+  for (int a = 0; a < 3; ++a) {
+    Eigen::Matrix2d Q = Eigen::Vector2d(a < 2 ? param.mpc.Qp_xy : param.mpc.Qp_z,
+                                        a < 2 ? param.mpc.Qv_xy : param.mpc.Qv_z)
+                            .asDiagonal();
+
+    // The terminal weight is the cost-to-go of the LQR, so without active constraints the MPC
+    // is the infinite horizon LQR whatever the horizon
+    Eigen::Matrix2d P = Q;
+    for (int i = 0; i < 10000; ++i) {
+      Eigen::Vector2d PB     = P * B;
+      Eigen::Matrix2d P_next = Q + A.transpose() * (P - PB * PB.transpose() / (R_ + B.dot(PB))) * A;
+      bool            done   = (P_next - P).cwiseAbs().maxCoeff() < 1e-9 * P.cwiseAbs().maxCoeff();
+      P                      = P_next;
+      if (done) break;
+    }
 
-  // used for debug
-  //  debug_msg_.des_p_x = des.p(0);
-  //  debug_msg_.des_p_y = des.p(1);
-  //  debug_msg_.des_p_z = des.p(2);
+    Eigen::MatrixXd Qbar = Eigen::MatrixXd::Zero(2 * N_, 2 * N_);
+    for (int k = 0; k < N_; ++k) Qbar.block<2, 2>(2 * k, 2 * k) = k + 1 < N_ ? Q : P;
+    G_[a]             = Gamma.transpose() * Qbar;
+    Eigen::MatrixXd H = G_[a] * Gamma;
+    H.diagonal().array() += R_;
+    qp_[a].setup(H);
+  }
 
-  debug_msg_.des_v_x = des.v(0);
-  debug_msg_.des_v_y = des.v(1);
-  debug_msg_.des_v_z = des.v(2);
+  x_ref_.setZero(2 * N_);
+  e_.setZero(2 * N_);
+  f_.setZero(N_);
+  u_ref_.setZero(N_);
+  lb_.setZero(N_);
+  ub_.setZero(N_);
+}
 
-  debug_msg_.des_a_x = des_acc(0);
-  debug_msg_.des_a_y = des_acc(1);
-  debug_msg_.des_a_z = des_acc(2);
+const quadrotor_msgs::Px4ctrlDebug &MpcControl::calculateControl(const Desired_State_t &des,
+                                                                 const Odom_Data_t     &odom,
+                                                                 const Imu_Data_t      &imu,
+                                                                 const ros::Time       &now,
+                                                                 Controller_Output_t   &u) {
+  std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+
+  // Input bounds: the thrust range on z, a box inside the tilt cone at hover on x and y
+  double tan_max = param_.max_angle > 0 ? std::tan(param_.max_angle) : 0;
+  double cos_max = param_.max_angle > 0 ? std::cos(param_.max_angle) : 1;
+  double z_lb    = kMinNormalizedCollectiveThrust_ - param_.gra;
+  double z_ub    = std::max(maxThrustAcc() * cos_max - param_.gra, z_lb);
+  double xy_max  = param_.max_angle > 0 ? param_.gra * tan_max / std::sqrt(2.0) : 1e3;
+
+  Eigen::Vector3d des_acc;
+  bool            capped = false;
+  for (int a = 0; a < 3; ++a) {
+    // Reference: des extrapolated with constant jerk
+    for (int k = 0; k < N_; ++k) {
+      double t          = (k + 1) * dt_;
+      x_ref_(2 * k)     = des.p(a) + des.v(a) * t + des.a(a) * t * t / 2 + des.j(a) * t * t * t / 6;
+      x_ref_(2 * k + 1) = des.v(a) + des.a(a) * t + des.j(a) * t * t / 2;
+      u_ref_(k)         = des.a(a) + des.j(a) * k * dt_;
+    }
+    e_.noalias() = Phi_ * Eigen::Vector2d(odom.p(a), odom.v(a));
+    e_ -= x_ref_;
+    f_.noalias() = G_[a] * e_;
+    f_ -= R_ * u_ref_;
+    lb_.setConstant(a < 2 ? -xy_max : z_lb);
+    ub_.setConstant(a < 2 ? xy_max : z_ub);
+
+    int iters = qp_[a].solve(f_, lb_, ub_, param_.mpc.max_iter, kSolverTolerance_);
+    capped |= iters >= param_.mpc.max_iter;
+    des_acc(a) = qp_[a].solution()(0);
+  }
+  des_acc(2) += param_.gra;
+
+  // The box is conservative, clip the first input to the cone itself
+  double h = des_acc.head<2>().norm();
+  if (param_.max_angle > 0 && h > tan_max * des_acc(2))
+    des_acc.head<2>() *= tan_max * des_acc(2) / h;
+
+  double solve_time =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  solve_sum_ += solve_time;
+  solves_++;
+  if (capped) capped_++;
+  if (solve_time > solve_worst_) {
+    solve_worst_ = solve_time;
+    if (solve_worst_ > 0.5 * period_)
+      ROS_WARN("[px4ctrl] MPC solve took %.3f ms, control period %.3f ms", solve_worst_ * 1e3,
+               period_ * 1e3);
+  }
 
-  debug_msg_.des_q_x = u.q.x();
-  debug_msg_.des_q_y = u.q.y();
-  debug_msg_.des_q_z = u.q.z();
-  debug_msg_.des_q_w = u.q.w();
+  computeGeometricOutput(des_acc, des.yaw, odom, imu, now, u);
 
-  debug_msg_.des_thr = u.thrust;
+  recordOutput(des, des_acc, now, u);
+  return debug_msg_;
+}
 
-  // Used for thrust-accel mapping estimation
-  timed_thrust_.push(std::pair<ros::Time, double>(ros::Time::now(), u.thrust));
-  while (timed_thrust_.size() > 100) {
-    timed_thrust_.pop();
+std::shared_ptr<ControlBase> createController(Parameter_t &param) {
+  if (param.controller == "linear") {
+    ROS_INFO("[px4ctrl] Controller: Linear control");
+    return std::make_shared<LinearControl>(param);
   }
-  return debug_msg_;
+  if (param.controller == "mpc") {
+    ROS_INFO("[px4ctrl] Controller: MPC, %d steps of %.3f s", param.mpc.horizon, param.mpc.dt);
+    return std::make_shared<MpcControl>(param);
+  }
+  if (param.controller != "geometric")
+    ROS_ERROR("[px4ctrl] Unknown controller \"%s\", using geometric control.",
+              param.controller.c_str());
+  ROS_INFO("[px4ctrl] Controller: Geometric control");
+  return std::make_shared<GeometricControl>(param);
 }
@@ -7,10 +7,15 @@
 
 #include <mavros_msgs/AttitudeTarget.h>
 #include <quadrotor_msgs/Px4ctrlDebug.h>
-#include <queue>
 
 #include <Eigen/Dense>
+#include <vector>
+#include "box_qp.h"
+#include "control_math.h"
+#include "delay_estimator.h"
+#include "fixed_queue.h"
 #include "input.h"
+#include "thrust_model_store.h"
 
 struct Desired_State_t {
   Eigen::Vector3d    p;
@@ -48,53 +53,203 @@ struct Controller_Output_t {
 
 class ControlBase {
  public:
-  ControlBase(Parameter_t &param) : param_(param) { resetThrustMapping(); }
+  ControlBase(Parameter_t &param)
+      : param_(param)
+      , volt_(0)
+      , delay_est_(1.0 / param.ctrl_freq_max, kMaxActuationDelay_, 10.0, 0.04)
+      , indi_head_(0)
+      , indi_count_(0)
+      , indi_active_(false)
+      , indi_corr_(Eigen::Vector3d::Zero())
+      , indi_thr_model_(0)
+      , indi_model_t_(0)
+      , has_warm_start_(false) {
+    resetThrustMapping();
+    // sqrt(2) / omega_c for the second order Butterworth
+    indi_filter_delay_ = param.imu_filter.enable && param.imu_filter.lpf_cutoff > 0
+                             ? std::sqrt(2.0) / (2 * M_PI * param.imu_filter.lpf_cutoff)
+                             : 0;
+    // Back to the command of the longest delay the estimator reports, at the highest tick rate
+    int indi_history = (int)std::ceil((kMaxActuationDelay_ + indi_filter_delay_) *
+                                      param.ctrl_freq_max) + kIndiHistoryMargin_;
+    indi_t_.assign(indi_history, 0);
+    indi_thr_acc_.assign(indi_history, 0);
+  }
   ~ControlBase(){};
-  virtual quadrotor_msgs::Px4ctrlDebug calculateControl(const Desired_State_t &des,
-                                                        const Odom_Data_t     &odom,
-                                                        const Imu_Data_t      &imu,
-                                                        Controller_Output_t   &u) = 0;
-  virtual bool estimateThrustModel(const Eigen::Vector3d &est_v, const Parameter_t &param);
-
-  void resetThrustMapping(void);
+  // The returned debug message is a member, valid until the next call
+  virtual const quadrotor_msgs::Px4ctrlDebug &calculateControl(const Desired_State_t &des,
+                                                               const Odom_Data_t     &odom,
+                                                               const Imu_Data_t      &imu,
+                                                               const ros::Time       &now,
+                                                               Controller_Output_t   &u) = 0;
+  virtual bool estimateThrustModel(const Eigen::Vector3d &est_v,
+                                   double                 volt,
+                                   const ros::Time       &now,
+                                   const Parameter_t     &param);
+
+  // volt: present battery voltage, used to scale a warm start, 0 if unknown
+  void resetThrustMapping(double volt = 0);
+  // The next resetThrustMapping() starts from s instead of hover_percentage and K1, K2, K3
+  void warmStartThrustMapping(const ThrustModelState &s);
+  void clearWarmStart() { has_warm_start_ = false; }  // back to hover_percentage and K1, K2, K3
+  bool getThrustModelState(ThrustModelState &s) const;  // false if the estimate has not converged
+
+  double getThr2acc(void) const { return thr2acc_; }
+  double getThrustModelCovariance(void) const { return P_; }
+  // K1, K2, K3 of the voltage thrust model, as estimated with accurate_thrust_model
+  Eigen::Vector3d getThrustModel(void) const;
+  // from the thrust command to the measured acceleration, estimated in AUTO_HOVER and CMD_CTRL
+  double getActuationDelay(void) const { return delay_est_.delay(); }
+
+  // The INDI correction (indi/enable) is only applied in flight, the FSM switches it
+  void setIndiActive(bool active) { indi_active_ = active; }
 
  protected:
-  Parameter_t                              param_;
-  quadrotor_msgs::Px4ctrlDebug             debug_msg_;
-  std::queue<std::pair<ros::Time, double>> timed_thrust_;
-  static constexpr double                  kMinNormalizedCollectiveThrust_ = 3.0;
+  Parameter_t                                   param_;
+  quadrotor_msgs::Px4ctrlDebug                  debug_msg_;
+  FixedQueue<std::pair<ros::Time, double>, 100> timed_thrust_;  // the last 100 ticks
+  static constexpr double                       kMinNormalizedCollectiveThrust_ = 3.0;
 
   // Thrust-accel mapping params
   const double rho2_ = 0.998;  // do not change
   double       thr2acc_;
   double       P_;
 
+  // Voltage thrust model F = K1 * V^K2 * (K3 * u^2 + (1 - K3) * u), used with
+  // thr_map.accurate_thrust_model. The state is (log(K1 * V_ref^K2), K2, K3) with V_ref the voltage
+  // at the first update, which decouples the scale from K2 while the voltage changes little.
+  Eigen::Vector3d         thr_model_;
+  Eigen::Matrix3d         thr_model_P_;
+  Eigen::Matrix3d         thr_model_Q_;  // per update
+  double                  log_volt_ref_;  // 0 until the first update
+  double                  volt_;          // latest battery voltage
+  static constexpr double kThrustModelAccVar_ = 1.0;  // IMU z acceleration noise, (m/s^2)^2
+
+  // Aligns the thrust history with the acceleration for the estimators above
+  static constexpr double kMaxActuationDelay_ = 0.15;  // s, searched by delay_est_
+  DelayEstimator          delay_est_;
+
+  /*
+    INDI: the accelerometer measures the specific force the vehicle actually gets. The thrust
+    acceleration commanded one actuation delay ago, passed through the motor lag and along the
+    measured b3, is what the model expected; their difference is the drag, the disturbances and
+    the thrust model error, and is removed from the next command. This cancels at the control
+    rate what the PD terms would leave as a steady error. Only GeometricControl and MpcControl
+    use it, through computeGeometricOutput().
+  */
+  static constexpr int    kIndiHistoryMargin_ = 4;     // control ticks beyond the max delay
+  static constexpr double kIndiImuTimeout_    = 0.05;  // s, no correction from older IMU data
+  std::vector<double>     indi_t_;        // sized in the constructor, never grows
+  std::vector<double>     indi_thr_acc_;  // commanded thrust acceleration
+  int                     indi_head_, indi_count_;
+  bool                    indi_active_;
+  Eigen::Vector3d         indi_corr_;
+  double                  indi_thr_model_;     // thrust acceleration the motors should deliver now
+  double                  indi_model_t_;       // of the last model update, 0 to restart
+  double                  indi_filter_delay_;  // s, of the accelerometer low-pass at low frequency
+
+  ThrustModelState        warm_start_;
+  bool                    has_warm_start_;
+  int                     thr_updates_;  // since the last reset
+  static constexpr int    kMinUpdatesToSave_   = 1000;
+  static constexpr double kWarmStartInflation_ = 10.0;  // on the covariance of the last flight
+
+  static Eigen::Vector3d thrustModelInitialVar(void);
+
   double computeDesiredCollectiveThrustSignal(const Eigen::Vector3d &des_acc);
+  double computeThrustSignal(double des_acc_z);  // along the body z axis
+  double maxThrustAcc(void) const;               // at full throttle, from the thrust estimate
+  bool   useThrustModel(void) const;
+  void   updateThrustModel(double acc_z, double thr, const Parameter_t &param);
   double fromQuaternion2yaw(Eigen::Quaterniond q);
+
+  // u.thrust and u.q that realize des_acc (gravity included) by aligning b3 with it, des_acc is
+  // corrected by INDI first if enabled
+  void computeGeometricOutput(Eigen::Vector3d     &des_acc,
+                              double               des_yaw,
+                              const Odom_Data_t   &odom,
+                              const Imu_Data_t    &imu,
+                              const ros::Time     &now,
+                              Controller_Output_t &u);
+  Eigen::Vector3d indiCorrection(const Odom_Data_t &odom,
+                                 const Imu_Data_t  &imu,
+                                 const ros::Time   &now);
+  // Fills debug_msg_ and keeps the thrust for estimateThrustModel()
+  void recordOutput(const Desired_State_t     &des,
+                    const Eigen::Vector3d     &des_acc,
+                    const ros::Time           &now,
+                    const Controller_Output_t &u);
 };
 
 class LinearControl : public ControlBase {
  public:
-  LinearControl(Parameter_t &param) : ControlBase(param) {
-    ROS_INFO("[px4ctrl] Controller: Linear control");
-  }
+  LinearControl(Parameter_t &param) : ControlBase(param) {}
   ~LinearControl(){};
-  quadrotor_msgs::Px4ctrlDebug calculateControl(const Desired_State_t &des,
-                                                const Odom_Data_t     &odom,
-                                                const Imu_Data_t      &imu,
-                                                Controller_Output_t   &u) override;
+  const quadrotor_msgs::Px4ctrlDebug &calculateControl(const Desired_State_t &des,
+                                                       const Odom_Data_t     &odom,
+                                                       const Imu_Data_t      &imu,
+                                                       const ros::Time       &now,
+                                                       Controller_Output_t   &u) override;
 };
 
-#endif
-
 class GeometricControl : public ControlBase {
  public:
-  GeometricControl(Parameter_t &param) : ControlBase(param) {
-    ROS_INFO("[px4ctrl] Controller: Geometric control");
-  }
+  GeometricControl(Parameter_t &param) : ControlBase(param) {}
   ~GeometricControl(){};
-  quadrotor_msgs::Px4ctrlDebug calculateControl(const Desired_State_t &des,
-                                                const Odom_Data_t     &odom,
-                                                const Imu_Data_t      &imu,
-                                                Controller_Output_t   &u) override;
+  const quadrotor_msgs::Px4ctrlDebug &calculateControl(const Desired_State_t &des,
+                                                       const Odom_Data_t     &odom,
+                                                       const Imu_Data_t      &imu,
+                                                       const ros::Time       &now,
+                                                       Controller_Output_t   &u) override;
+};
+
+/*
+  Linear MPC on the translational double integrator, p'' = a, the input being the acceleration
+  that GeometricControl turns into thrust and attitude. The reference over the horizon is des
+  extrapolated with constant jerk, so des.a and des.j are followed ahead of time. The axes are
+  decoupled, so the condensed QP is three QPs of horizon size with box constraints: the z input
+  within the thrust range, the horizontal inputs within a box inside the max_angle cone. The
+  thrust range follows the online thrust estimate.
+
+  Each QP is solved by BoxQP with mpc/max_iter as a hard cap, warm started from the previous
+  tick. The worst solve time is logged whenever it grows beyond half of the control period.
+*/
+class MpcControl : public ControlBase {
+ public:
+  MpcControl(Parameter_t &param);
+  ~MpcControl(){};
+  const quadrotor_msgs::Px4ctrlDebug &calculateControl(const Desired_State_t &des,
+                                                       const Odom_Data_t     &odom,
+                                                       const Imu_Data_t      &imu,
+                                                       const ros::Time       &now,
+                                                       Controller_Output_t   &u) override;
+
+  double worstSolveTime(void) const { return solve_worst_; }  // s, all three axes
+  double meanSolveTime(void) const { return solves_ ? solve_sum_ / solves_ : 0.0; }
+  int    cappedSolves(void) const { return capped_; }  // stopped on mpc/max_iter
+
+ private:
+  static constexpr double kSolverTolerance_ = 1e-4;  // m/s^2
+
+  int    N_;
+  double dt_;
+  double period_;  // control period, the solve time budget
+
+  Eigen::MatrixXd Phi_;   // 2N x 2, stacked states from the initial state, (p, v) per step
+  Eigen::MatrixXd G_[3];  // N x 2N, Gamma' * Q per axis, Gamma maps the inputs to the states
+  double          R_;
+  BoxQP           qp_[3];
+
+  // workspace
+  Eigen::VectorXd x_ref_, e_, f_, u_ref_, lb_, ub_;
+
+  double   solve_worst_, solve_sum_;
+  uint64_t solves_;
+  int      capped_;
 };
+
+// By param.controller: "linear", "geometric" or "mpc". The constructors themselves are quiet,
+// this logs the choice.
+std::shared_ptr<ControlBase> createController(Parameter_t &param);
+
+#endif
@@ -0,0 +1,86 @@
+#include "debug_output.h"
+
+#include <algorithm>
+#include <chrono>
+
+DebugOutput::DebugOutput(const Parameter_t::Debug &param, const ros::Publisher &pub)
+    : param_(param)
+    , pub_(pub)
+    , head_(0)
+    , tail_(0)
+    , dropped_(0)
+    , running_(false) {}
+
+void DebugOutput::push(const quadrotor_msgs::Px4ctrlDebug &msg, const ros::Time &stamp) {
+  uint64_t h = head_.load(std::memory_order_relaxed);
+  if (h - tail_.load(std::memory_order_acquire) >= (uint64_t)RING) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  quadrotor_msgs::Px4ctrlDebug &s = ring_[h % RING];
+  s.header.stamp                  = stamp;
+  if (param_.reference) {
+    s.des_p_x = msg.des_p_x;
+    s.des_p_y = msg.des_p_y;
+    s.des_p_z = msg.des_p_z;
+    s.des_v_x = msg.des_v_x;
+    s.des_v_y = msg.des_v_y;
+    s.des_v_z = msg.des_v_z;
+    s.des_a_x = msg.des_a_x;
+    s.des_a_y = msg.des_a_y;
+    s.des_a_z = msg.des_a_z;
+  }
+  if (param_.output) {
+    s.des_q_x = msg.des_q_x;
+    s.des_q_y = msg.des_q_y;
+    s.des_q_z = msg.des_q_z;
+    s.des_q_w = msg.des_q_w;
+    s.des_thr = msg.des_thr;
+  }
+  if (param_.thrust_model) {
+    s.thr2acc          = msg.thr2acc;
+    s.hover_percentage = msg.hover_percentage;
+    s.voltage          = msg.voltage;
+  }
+  if (param_.indi) {
+    s.fb_a_x = msg.fb_a_x;
+    s.fb_a_y = msg.fb_a_y;
+    s.fb_a_z = msg.fb_a_z;
+  }
+  head_.store(h + 1, std::memory_order_release);
+}
+
+void DebugOutput::start() {
+  if (thread_.joinable()) return;
+  running_ = true;
+  thread_  = std::thread(&DebugOutput::run, this);
+}
+
+void DebugOutput::stop() {
+  running_ = false;
+  if (thread_.joinable()) thread_.join();
+}
+
+void DebugOutput::run() {
+  // About four times per ring, and at least at 20 Hz so that plots stay live
+  const double idle_s = std::min(0.05, 0.25 * RING / std::max(param_.rate, 1.0));
+  const std::chrono::microseconds idle((int64_t)(idle_s * 1e6));
+  while (running_.load(std::memory_order_relaxed)) {
+    drain();
+    std::this_thread::sleep_for(idle);
+  }
+  drain();
+}
+
+int DebugOutput::drain() {
+  uint64_t h = head_.load(std::memory_order_acquire);
+  uint64_t t = tail_.load(std::memory_order_relaxed);
+  int      n = 0;
+  for (; t < h; ++t, ++n) {
+    // by reference, roscpp serializes it before returning and the slot is free again
+    if (pub_) pub_.publish(ring_[t % RING]);
+    tail_.store(t + 1, std::memory_order_release);
+  }
+  return n;
+}
@@ -0,0 +1,53 @@
+#ifndef __DEBUG_OUTPUT_H
+#define __DEBUG_OUTPUT_H
+
+#include <quadrotor_msgs/Px4ctrlDebug.h>
+#include <ros/ros.h>
+
+#include <atomic>
+#include <thread>
+
+#include "PX4CtrlParam.h"
+
+/*
+  debugPx4ctrl, off the control path.
+
+  process() push()es the debug message of the controller every debug/rate. That copies the
+  enabled field groups into a single-producer single-consumer ring, two atomic accesses and a few
+  stores. A background thread drains the ring and publishes every sample, so serialization and
+  the socket writes never run in the control loop. Fields of disabled groups stay 0. A full ring
+  drops the sample, which is counted. Without a valid publisher drain() only empties the ring.
+*/
+class DebugOutput {
+ public:
+  DebugOutput(const Parameter_t::Debug &param, const ros::Publisher &pub);
+  ~DebugOutput() { stop(); }
+
+  // Producer side, process()
+  void push(const quadrotor_msgs::Px4ctrlDebug &msg, const ros::Time &stamp);
+
+  // Consumer side. start() calls drain() on a background thread, without it the owner calls
+  // drain() itself, but never both.
+  void start();
+  void stop();
+  int  drain();  // samples published
+
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+ private:
+  static constexpr int RING = 64;
+
+  Parameter_t::Debug param_;
+  ros::Publisher     pub_;
+
+  quadrotor_msgs::Px4ctrlDebug ring_[RING];
+  std::atomic<uint64_t>        head_, tail_;
+  std::atomic<uint64_t>        dropped_;
+
+  std::thread       thread_;
+  std::atomic<bool> running_;
+
+  void run();
+};
+
+#endif
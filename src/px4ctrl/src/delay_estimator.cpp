@@ -0,0 +1,99 @@
+#include "delay_estimator.h"
+
+#include <algorithm>
+#include <cmath>
+
+DelayEstimator::DelayEstimator(double sample_period,
+                               double max_delay,
+                               double window,
+                               double initial_delay)
+    : dt_(std::max(sample_period, max_delay / (MAX_LAGS - 1)))
+    , alpha_(std::min(dt_ / window, 1.0))
+    , slow_(std::min(2 * M_PI * SLOW_CUTOFF * dt_, 1.0))
+    , fast_(std::min(2 * M_PI * FAST_CUTOFF * dt_, 1.0))
+    , initial_delay_(initial_delay)
+    , lags_(std::max(3, std::min((int)MAX_LAGS, (int)std::ceil(max_delay / dt_ - 1e-9) + 1))) {
+  reset();
+}
+
+void DelayEstimator::reset() {
+  delay_      = initial_delay_;
+  confidence_ = 0;
+  bin_start_  = -1;
+  u_held_ = a_sum_ = a_last_ = 0;
+  a_cnt_           = 0;
+  u_slow_ = a_slow_ = u_band_ = a_band_ = 0;
+  head_ = samples_ = 0;
+  var_u_ = var_a_ = 0;
+  for (int k = 0; k < MAX_LAGS; ++k) u_[k] = corr_[k] = 0;
+}
+
+void DelayEstimator::feed(double t, double thrust, double acc_z) {
+  // first call, a gap in the data or the clock jumped back: start over at t
+  if (bin_start_ < 0 || t < bin_start_ || t - bin_start_ > MAX_LAGS * dt_) {
+    bin_start_ = t;
+    a_sum_     = 0;
+    a_cnt_     = 0;
+    samples_   = 0;
+  }
+
+  // close the bins that ended before t, empty ones repeat the last acceleration
+  while (t - bin_start_ >= dt_) {
+    sample(u_held_, a_cnt_ > 0 ? a_sum_ / a_cnt_ : a_last_);
+    a_sum_ = 0;
+    a_cnt_ = 0;
+    bin_start_ += dt_;
+  }
+
+  u_held_ = thrust;
+  a_last_ = acc_z;
+  a_sum_ += acc_z;
+  a_cnt_++;
+}
+
+void DelayEstimator::sample(double u, double a) {
+  if (samples_ == 0) {
+    u_slow_ = u;
+    a_slow_ = a;
+    u_band_ = a_band_ = 0;
+  }
+
+  // the same band-pass on both signals, so it adds no relative delay
+  u_slow_ += slow_ * (u - u_slow_);
+  a_slow_ += slow_ * (a - a_slow_);
+  u_band_ += fast_ * (u - u_slow_ - u_band_);
+  a_band_ += fast_ * (a - a_slow_ - a_band_);
+
+  head_     = (head_ + 1) % MAX_LAGS;
+  u_[head_] = u_band_;
+
+  int n = std::min(samples_ + 1, lags_);
+  for (int k = 0; k < n; ++k) {
+    double u_k = u_[(head_ - k + MAX_LAGS) % MAX_LAGS];
+    corr_[k] += alpha_ * (u_k * a_band_ - corr_[k]);
+  }
+  var_u_ += alpha_ * (u_band_ * u_band_ - var_u_);
+  var_a_ += alpha_ * (a_band_ * a_band_ - var_a_);
+  samples_ = std::min(samples_ + 1, 1 << 30);
+
+  // a full window of data before the first estimate
+  if (samples_ * alpha_ > 1) update_delay();
+}
+
+void DelayEstimator::update_delay() {
+  int best = 0;
+  for (int k = 1; k < lags_; ++k)
+    if (corr_[k] > corr_[best]) best = k;
+
+  double confidence = corr_[best] / std::sqrt(var_u_ * var_a_ + 1e-12);
+  if (confidence < MIN_CONFIDENCE) return;  // keep the last estimate
+
+  double offset = 0;
+  if (best > 0 && best < lags_ - 1) {
+    double c0 = corr_[best - 1], c1 = corr_[best], c2 = corr_[best + 1];
+    double d  = c0 - 2 * c1 + c2;
+    if (d < 0) offset = 0.5 * (c0 - c2) / d;
+  }
+  delay_      = (best + offset) * dt_;
+  confidence_ = confidence;
+}
@@ -0,0 +1,65 @@
+#ifndef __DELAY_ESTIMATOR_H
+#define __DELAY_ESTIMATOR_H
+
+/*
+  Estimates the actuation delay between the commanded thrust and the measured z acceleration.
+
+  Both signals are resampled to a fixed period (zero-order hold for the thrust, bin mean for the
+  acceleration) and pass the same band-pass, which removes the hover offset and the IMU noise
+  without shifting one against the other. The cross-correlation at every candidate lag is an
+  exponentially weighted mean over the last ~window seconds, updated incrementally: each sample
+  costs one multiply-add per lag, whatever the window length, and nothing is allocated. The delay
+  is the lag of the correlation peak, refined by a parabola through its neighbours. It covers the
+  link and FCU latency plus part of the spin-up of the motors, i.e. the shift that best aligns
+  the thrust with the acceleration.
+
+  sample_period is the finest resampling period. When max_delay would need more than MAX_LAGS
+  lags at it, the samples are taken max_delay / (MAX_LAGS - 1) apart instead, so the search always
+  covers max_delay at a fixed cost per sample, with the parabola making up for the coarser grid.
+
+  Until the data excites the thrust enough to give a clear peak, delay() returns the initial
+  guess.
+*/
+class DelayEstimator {
+ public:
+  static constexpr int MAX_LAGS = 64;
+
+  DelayEstimator(double sample_period, double max_delay, double window, double initial_delay);
+
+  void reset();
+  // At any rate, t in s. thrust is the command in effect at t.
+  void feed(double t, double thrust, double acc_z);
+
+  double delay() const { return delay_; }
+  // normalized cross-correlation at the peak, 0 while the initial guess is used
+  double confidence() const { return confidence_; }
+
+ private:
+  static constexpr double MIN_CONFIDENCE = 0.1;
+  static constexpr double SLOW_CUTOFF    = 0.5;   // Hz, band-pass
+  static constexpr double FAST_CUTOFF    = 10.0;  // Hz
+
+  double dt_, alpha_, slow_, fast_, initial_delay_;
+  int    lags_;
+
+  double delay_, confidence_;
+
+  // current resampling bin
+  double bin_start_;
+  double u_held_, a_sum_, a_last_;
+  int    a_cnt_;
+
+  // band-passed samples, u_[head_] is the latest
+  double u_slow_, a_slow_, u_band_, a_band_;
+  double u_[MAX_LAGS];
+  int    head_, samples_;
+
+  // exponentially weighted moments
+  double corr_[MAX_LAGS];  // E[u(n - k) * a(n)]
+  double var_u_, var_a_;
+
+  void sample(double u, double a);
+  void update_delay();
+};
+
+#endif
@@ -0,0 +1,183 @@
+/*
+  Stand-in FCU for bench testing the setpoint link without hardware.
+
+  It receives MAVLink over UDP or a pseudo terminal, answers with a 1 Hz PX4 HEARTBEAT (so mavros
+  can connect to it as well), decodes SET_ATTITUDE_TARGET and prints per-sender statistics once
+  per second. Latency is "receive time - time_boot_ms", which works because both px4ctrl's direct
+  output and mavros' setpoint_raw plugin fill time_boot_ms with the ROS stamp in milliseconds.
+  Run everything on the same machine so that the clocks agree.
+
+  usage:
+    fake_fcu udp <listen_port>   e.g. mavlink_output/url = udp://127.0.0.1:<listen_port>,
+                                      mavros fcu_url = udp://:14555@127.0.0.1:<listen_port>
+    fake_fcu pty                 prints the slave device, use serial://<device>:921600
+*/
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+
+#include "mavlink_codec.h"
+
+using namespace mavlink_codec;
+
+struct SenderStats {
+  uint64_t count{0};
+  uint64_t total_count{0};
+  uint64_t lost{0};
+  uint8_t  last_seq{0};
+  double   lat_sum_ms{0};
+  double   lat_min_ms{1e9};
+  double   lat_max_ms{-1e9};
+  float    last_thrust{0};
+};
+
+static double now_realtime_ms() {
+  timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+static double now_monotonic_s() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void usage() {
+  fprintf(stderr, "usage: fake_fcu udp <listen_port>\n       fake_fcu pty\n");
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    usage();
+    return 1;
+  }
+
+  std::string mode = argv[1];
+  int         fd   = -1;
+  bool        udp  = false;
+
+  if (mode == "udp" && argc >= 3) {
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(atoi(argv[2]));
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (fd < 0 || bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0) {
+      perror("bind");
+      return 1;
+    }
+    udp = true;
+    printf("fake_fcu listening on udp port %s\n", argv[2]);
+  } else if (mode == "pty") {
+    fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0) {
+      perror("posix_openpt");
+      return 1;
+    }
+    termios tio;
+    tcgetattr(fd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(fd, TCSANOW, &tio);
+    printf("fake_fcu serial device: %s\n", ptsname(fd));
+  } else {
+    usage();
+    return 1;
+  }
+  fflush(stdout);
+
+  FrameParser                        parser;
+  std::map<uint16_t, SenderStats>    stats;  // key: sysid << 8 | compid
+  sockaddr_in                        peer;
+  socklen_t                          peer_len = 0;
+  uint8_t                            hb_seq   = 0;
+  uint8_t                            rx[2048];
+  uint8_t                            tx[MAVLINK_MAX_FRAME_LEN];
+  double                             last_report_t = now_monotonic_s();
+
+  while (true) {
+    pollfd pfd{fd, POLLIN, 0};
+    int    ret = poll(&pfd, 1, 100);
+    if (ret < 0 && errno != EINTR) {
+      perror("poll");
+      return 1;
+    }
+
+    if (ret > 0 && (pfd.revents & POLLIN)) {
+      ssize_t n;
+      if (udp) {
+        peer_len = sizeof(peer);
+        n        = recvfrom(fd, rx, sizeof(rx), 0, (sockaddr *)&peer, &peer_len);
+      } else {
+        n = read(fd, rx, sizeof(rx));
+      }
+      double rcv_ms = now_realtime_ms();
+
+      for (ssize_t i = 0; i < n; ++i) {
+        if (!parser.parse_char(rx[i])) continue;
+        if (parser.msgid != MSG_ID_SET_ATTITUDE_TARGET || !parser.crc_ok) continue;
+
+        SetAttitudeTarget m;
+        unpack_set_attitude_target(parser.payload, parser.payload_len, m);
+
+        SenderStats &s = stats[(uint16_t)(parser.sysid << 8 | parser.compid)];
+        if (s.total_count > 0) s.lost += (uint8_t)(parser.seq - s.last_seq - 1);
+        s.last_seq = parser.seq;
+        s.count++;
+        s.total_count++;
+        s.last_thrust = m.thrust;
+
+        // time_boot_ms is a truncated epoch time, compare modulo 2^32
+        double lat = (double)(int32_t)((uint32_t)(uint64_t)rcv_ms - m.time_boot_ms) +
+                     (rcv_ms - (double)(uint64_t)rcv_ms);
+        s.lat_sum_ms += lat;
+        s.lat_min_ms = std::min(s.lat_min_ms, lat);
+        s.lat_max_ms = std::max(s.lat_max_ms, lat);
+      }
+    }
+
+    double t = now_monotonic_s();
+    if (t - last_report_t < 1.0) continue;
+    double dt     = t - last_report_t;
+    last_report_t = t;
+
+    // Heartbeat from an armed-capable PX4 quadrotor, so mavros sees a connected FCU
+    size_t len = pack_heartbeat(tx, hb_seq++, 1, 1, 0, 2 /* MAV_TYPE_QUADROTOR */,
+                                12 /* MAV_AUTOPILOT_PX4 */, 0x01 /* CUSTOM_MODE_ENABLED */,
+                                4 /* MAV_STATE_ACTIVE */);
+    if (udp && peer_len > 0)
+      sendto(fd, tx, len, 0, (sockaddr *)&peer, peer_len);
+    else if (!udp)
+      (void)!write(fd, tx, len);
+
+    for (auto &kv : stats) {
+      SenderStats &s = kv.second;
+      if (s.count == 0) continue;
+      printf("[%3d:%3d] rate %7.1f Hz  latency mean %6.2f min %6.2f max %6.2f ms  lost %llu  "
+             "thrust %.3f\n",
+             kv.first >> 8, kv.first & 0xff, s.count / dt, s.lat_sum_ms / s.count, s.lat_min_ms,
+             s.lat_max_ms, (unsigned long long)s.lost, s.last_thrust);
+      s.count      = 0;
+      s.lat_sum_ms = 0;
+      s.lat_min_ms = 1e9;
+      s.lat_max_ms = -1e9;
+    }
+    fflush(stdout);
+  }
+
+  return 0;
+}
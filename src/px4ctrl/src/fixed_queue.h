@@ -0,0 +1,36 @@
+#ifndef __FIXED_QUEUE_H
+#define __FIXED_QUEUE_H
+
+/*
+  The part of std::queue the controllers use, on a fixed array so that the control loop does not
+  allocate. push() on a full queue drops the front element.
+*/
+
+template <typename T, int N>
+class FixedQueue {
+ public:
+  FixedQueue() : head_(0), size_(0) {}
+
+  void push(const T &v) {
+    ring_[(head_ + size_) % N] = v;
+    if (size_ < N)
+      size_++;
+    else
+      head_ = (head_ + 1) % N;
+  }
+  void pop() {
+    head_ = (head_ + 1) % N;
+    size_--;
+  }
+
+  const T &front() const { return ring_[head_]; }
+  const T &back() const { return ring_[(head_ + size_ - 1) % N]; }
+  int      size() const { return size_; }
+  bool     empty() const { return size_ == 0; }
+
+ private:
+  T   ring_[N];
+  int head_, size_;
+};
+
+#endif
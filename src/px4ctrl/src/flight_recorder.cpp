@@ -0,0 +1,90 @@
+#include "flight_recorder.h"
+
+#include <ros/ros.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+FlightRecorder::FlightRecorder()
+    : fd_(-1)
+    , map_len_(0)
+    , header_(nullptr)
+    , records_(nullptr) {}
+
+FlightRecorder::~FlightRecorder() { close(); }
+
+bool FlightRecorder::open(const std::string &path, uint64_t capacity) {
+  close();
+  if (capacity == 0) return false;
+
+  // Keep the previous flight, replacing the one before it
+  std::string prev = path + ".1";
+  if (rename(path.c_str(), prev.c_str()) != 0 && errno != ENOENT) {
+    ROS_ERROR("[px4ctrl] flight recorder: rename(%s, %s) failed: %s", path.c_str(), prev.c_str(),
+              strerror(errno));
+    return false;
+  }
+
+  fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd_ < 0) {
+    ROS_ERROR("[px4ctrl] flight recorder: open(%s) failed: %s", path.c_str(), strerror(errno));
+    return false;
+  }
+
+  map_len_ = sizeof(FlightRecorderHeader) + capacity * sizeof(FlightRecord);
+
+  // Allocate the blocks now, a write into a hole would otherwise allocate on the page fault
+  int err = posix_fallocate(fd_, 0, map_len_);
+  if (err != 0) {
+    ROS_ERROR("[px4ctrl] flight recorder: fallocate(%zu) failed: %s", map_len_, strerror(err));
+    close();
+    return false;
+  }
+
+  void *p = mmap(nullptr, map_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, 0);
+  if (p == MAP_FAILED) {
+    ROS_ERROR("[px4ctrl] flight recorder: mmap failed: %s", strerror(errno));
+    map_len_ = 0;
+    close();
+    return false;
+  }
+
+  // Touch every page so that the first write of each slot does not fault, then pin them.
+  memset(p, 0, map_len_);
+  if (mlock(p, map_len_) != 0) {
+    ROS_WARN(
+        "[px4ctrl] flight recorder: mlock failed (%s), writes may occasionally page fault. "
+        "Raise RLIMIT_MEMLOCK to avoid it.",
+        strerror(errno));
+  }
+
+  header_  = static_cast<FlightRecorderHeader *>(p);
+  records_ =
+      reinterpret_cast<FlightRecord *>(static_cast<char *>(p) + sizeof(FlightRecorderHeader));
+
+  memcpy(header_->magic, FLIGHT_RECORDER_MAGIC, sizeof(header_->magic));
+  header_->version     = FLIGHT_RECORDER_VERSION;
+  header_->record_size = sizeof(FlightRecord);
+  header_->capacity    = capacity;
+  header_->write_count = 0;
+
+  return true;
+}
+
+void FlightRecorder::close() {
+  if (header_) {
+    msync(header_, map_len_, MS_ASYNC);
+    munlock(header_, map_len_);
+    munmap(header_, map_len_);
+    header_  = nullptr;
+    records_ = nullptr;
+  }
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+}
@@ -0,0 +1,82 @@
+#ifndef __FLIGHT_RECORDER_H
+#define __FLIGHT_RECORDER_H
+
+/*
+  In-process black box: one fixed-layout record per PX4CtrlFSM::process() tick, written into a
+  memory-mapped ring file. The file is preallocated, pre-faulted and locked when it is opened, so
+  a write is a single memcpy into RAM plus an atomic counter store; the kernel flushes the pages
+  to disk in the background and the file survives a crash of px4ctrl. Opening a path that exists
+  renames the previous flight to <path>.1 first.
+
+  This header has no ROS dependency so that the export tool can be built standalone.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+static constexpr char     FLIGHT_RECORDER_MAGIC[8] = {'P', 'X', '4', 'C', 'B', 'B', 'X', '1'};
+static constexpr uint32_t FLIGHT_RECORDER_VERSION  = 1;
+
+struct FlightRecord {
+  uint64_t seq;               // tick counter, also used to detect torn records
+  int64_t  t_ns;              // tick time (the now_time of process())
+  uint32_t tick_duration_ns;  // process() execution time up to the recorder write
+  uint8_t  state;             // PX4CtrlFSM::State_t
+  uint8_t  landed;
+  uint8_t  armed;
+  uint8_t  rotor_low_speed;
+
+  int64_t odom_rcv_ns;
+  double  odom_p[3], odom_v[3], odom_q[4], odom_w[3];  // q: w, x, y, z
+
+  int64_t imu_rcv_ns;
+  double  imu_a[3], imu_w[3], imu_q[4];
+
+  int64_t cmd_rcv_ns;
+  double  cmd_p[3], cmd_v[3], cmd_a[3], cmd_j[3], cmd_yaw, cmd_yaw_rate;
+
+  double des_p[3], des_v[3], des_a[3], des_yaw;
+
+  double u_thrust, u_q[4], u_bodyrates[3];
+
+  double thr2acc, thr2acc_P;
+  double bat_volt;
+};
+static_assert(sizeof(FlightRecord) == 512,
+              "FlightRecord must be 512 bytes, bump FLIGHT_RECORDER_VERSION when changing it");
+
+struct FlightRecorderHeader {
+  char     magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint64_t capacity;     // number of record slots
+  uint64_t write_count;  // total records written, slot = (write_count - 1) % capacity
+  uint8_t  reserved[32];
+};
+static_assert(sizeof(FlightRecorderHeader) == 64, "FlightRecorderHeader must be 64 bytes");
+
+class FlightRecorder {
+ public:
+  FlightRecorder();
+  ~FlightRecorder();
+
+  bool open(const std::string &path, uint64_t capacity);
+  void close();
+  bool is_open() const { return header_ != nullptr; }
+
+  // Bounded time: one memcpy of sizeof(FlightRecord) bytes into locked memory, no syscalls
+  void write(const FlightRecord &rec) {
+    uint64_t n = __atomic_load_n(&header_->write_count, __ATOMIC_RELAXED);
+    records_[n % header_->capacity] = rec;
+    __atomic_store_n(&header_->write_count, n + 1, __ATOMIC_RELEASE);
+  }
+
+ private:
+  int                   fd_;
+  size_t                map_len_;
+  FlightRecorderHeader *header_;
+  FlightRecord         *records_;
+};
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef __FSM_TRACE_H
+#define __FSM_TRACE_H
+
+/*
+  Bookkeeping of the PX4CtrlFSM transition table: the last transitions in a ring, and the
+  statistics of the latencies between a request and its outcome.
+
+  Everything is updated from process() only and allocates nothing after construction.
+*/
+
+#include <ros/ros.h>
+
+#include <algorithm>
+
+// One transition of the FSM
+struct FsmTransition {
+  ros::Time   stamp;      // FSM clock, the tick it fired in
+  int         from, to;   // PX4CtrlFSM::State_t
+  const char *guard;      // name of the guard that fired, static storage
+  double      action_us;  // wall time of the guard and the action, service calls included
+};
+
+// The last CAPACITY transitions, oldest first
+class FsmTrace {
+ public:
+  static constexpr int CAPACITY = 64;
+
+  FsmTrace() : head_(0), size_(0) {}
+
+  void push(const FsmTransition &t) {
+    ring_[head_] = t;
+    head_        = (head_ + 1) % CAPACITY;
+    size_        = std::min(size_ + 1, (int)CAPACITY);
+  }
+
+  int                  size() const { return size_; }
+  const FsmTransition &operator[](int i) const {
+    return ring_[(head_ - size_ + i + CAPACITY) % CAPACITY];
+  }
+
+ private:
+  FsmTransition ring_[CAPACITY];
+  int           head_, size_;
+};
+
+// Count, mean and extremes of one kind of latency, s
+struct LatencyStat {
+  int    count{0};
+  double last{0}, sum{0}, min{0}, max{0};
+
+  void add(double dt) {
+    min  = count ? std::min(min, dt) : dt;
+    max  = count ? std::max(max, dt) : dt;
+    last = dt;
+    sum += dt;
+    count++;
+  }
+  double mean() const { return count ? sum / count : 0.0; }
+};
+
+#endif
@@ -0,0 +1,126 @@
+#include "geometric_batch.h"
+
+#include "control_math.h"
+
+// The default build only assumes SSE2 on x86-64, so the kernel is cloned for AVX2 and dispatched
+// by the loader. FMA is left out on purpose, it would round differently from the scalar path.
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__)
+#define GEOMETRIC_BATCH_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define GEOMETRIC_BATCH_CLONES
+#endif
+
+template <typename Scalar>
+void GeometricBatchT<Scalar>::resize(int n) {
+  n_ = n;
+  for (int i = 0; i < 3; ++i) {
+    p[i].resize(n);
+    v[i].resize(n);
+    des_p[i].resize(n);
+    des_v[i].resize(n);
+    des_a[i].resize(n);
+  }
+  qw.resize(n, 1);
+  qx.resize(n);
+  qy.resize(n);
+  qz.resize(n);
+  imu_qw.resize(n, 1);
+  imu_qx.resize(n);
+  imu_qy.resize(n);
+  imu_qz.resize(n);
+  des_yaw.resize(n);
+  thr2acc.resize(n);
+  thrust.resize(n);
+  out_qw.resize(n);
+  out_qx.resize(n);
+  out_qy.resize(n);
+  out_qz.resize(n);
+}
+
+namespace {
+
+template <typename Scalar>
+struct Gains {
+  Scalar kp[3], kv[3], gra;
+};
+
+// One vehicle per iteration, all arrays are distinct and the loop has no branches
+template <typename Scalar>
+GEOMETRIC_BATCH_CLONES void geometric_kernel(int                      n,
+                                             const Gains<Scalar>     &g,
+                                             const Scalar *__restrict px,
+                                             const Scalar *__restrict py,
+                                             const Scalar *__restrict pz,
+                                             const Scalar *__restrict vx,
+                                             const Scalar *__restrict vy,
+                                             const Scalar *__restrict vz,
+                                             const Scalar *__restrict qw,
+                                             const Scalar *__restrict qx,
+                                             const Scalar *__restrict qy,
+                                             const Scalar *__restrict qz,
+                                             const Scalar *__restrict iw,
+                                             const Scalar *__restrict ix,
+                                             const Scalar *__restrict iy,
+                                             const Scalar *__restrict iz,
+                                             const Scalar *__restrict dpx,
+                                             const Scalar *__restrict dpy,
+                                             const Scalar *__restrict dpz,
+                                             const Scalar *__restrict dvx,
+                                             const Scalar *__restrict dvy,
+                                             const Scalar *__restrict dvz,
+                                             const Scalar *__restrict dax,
+                                             const Scalar *__restrict day,
+                                             const Scalar *__restrict daz,
+                                             const Scalar *__restrict yaw,
+                                             const Scalar *__restrict thr2acc,
+                                             Scalar *__restrict thrust,
+                                             Scalar *__restrict ow,
+                                             Scalar *__restrict ox,
+                                             Scalar *__restrict oy,
+                                             Scalar *__restrict oz) {
+  for (int i = 0; i < n; ++i) {
+    // the PD law of GeometricControl::calculateControl(), gravity included
+    Scalar acc[3];
+    acc[0] = dax[i] + g.kv[0] * (dvx[i] - vx[i]) + g.kp[0] * (dpx[i] - px[i]);
+    acc[1] = day[i] + g.kv[1] * (dvy[i] - vy[i]) + g.kp[1] * (dpy[i] - py[i]);
+    acc[2] = daz[i] + g.kv[2] * (dvz[i] - vz[i]) + g.kp[2] * (dpz[i] - pz[i]);
+    acc[2] += g.gra;
+
+    Scalar sy, cy, thr_acc, q[4];
+    Scalar q_odom[4] = {qw[i], qx[i], qy[i], qz[i]};
+    Scalar q_imu[4]  = {iw[i], ix[i], iy[i], iz[i]};
+    control_math::sincos_branchless(yaw[i], sy, cy);
+    control_math::geometric_output(acc, sy, cy, q_odom, q_imu, thr_acc, q);
+
+    thrust[i] = thr_acc / thr2acc[i];
+    ow[i]     = q[0];
+    ox[i]     = q[1];
+    oy[i]     = q[2];
+    oz[i]     = q[3];
+  }
+}
+
+}  // namespace
+
+template <typename Scalar>
+void GeometricBatchT<Scalar>::compute(const Parameter_t &param) {
+  Gains<Scalar> g;
+  g.kp[0] = param.gain.Kp0;
+  g.kp[1] = param.gain.Kp1;
+  g.kp[2] = param.gain.Kp2;
+  g.kv[0] = param.gain.Kv0;
+  g.kv[1] = param.gain.Kv1;
+  g.kv[2] = param.gain.Kv2;
+  g.gra   = param.gra;
+
+  geometric_kernel<Scalar>(n_, g, p[0].data(), p[1].data(), p[2].data(), v[0].data(),
+                           v[1].data(), v[2].data(), qw.data(), qx.data(), qy.data(), qz.data(),
+                           imu_qw.data(), imu_qx.data(), imu_qy.data(), imu_qz.data(),
+                           des_p[0].data(), des_p[1].data(), des_p[2].data(), des_v[0].data(),
+                           des_v[1].data(), des_v[2].data(), des_a[0].data(), des_a[1].data(),
+                           des_a[2].data(), des_yaw.data(), thr2acc.data(), thrust.data(),
+                           out_qw.data(), out_qx.data(), out_qy.data(), out_qz.data());
+}
+
+template class GeometricBatchT<double>;
+template class GeometricBatchT<float>;
@@ -0,0 +1,57 @@
+#ifndef __GEOMETRIC_BATCH_H
+#define __GEOMETRIC_BATCH_H
+
+/*
+  GeometricControl for many vehicles at once, for swarm simulation and offline evaluation.
+
+  States, references and outputs are structure-of-arrays, one std::vector per component, so that
+  compute() runs one loop over all vehicles that the compiler vectorizes, with the control law of
+  control_math.h. On x86-64 the loop is also built for AVX2 and the best version is picked at load
+  time, on aarch64 it uses NEON. Instantiated for double (GeometricBatch) and float
+  (GeometricBatchF), which fits twice as many vehicles in a vector.
+
+  Per vehicle the double result is the one of GeometricControl::calculateControl() with the
+  thrust mapping thr2acc (thr_map/accurate_thrust_model off) and without INDI, up to rounding.
+  No debug message is filled and nothing is estimated, the caller owns thr2acc.
+*/
+
+#include <vector>
+
+#include "PX4CtrlParam.h"
+
+template <typename Scalar>
+class GeometricBatchT {
+ public:
+  // Odometry, odom.q is the attitude of the odometry frame
+  std::vector<Scalar> p[3], v[3];
+  std::vector<Scalar> qw, qx, qy, qz;
+
+  // imu.q, the attitude the FCU estimates, the output is expressed against it
+  std::vector<Scalar> imu_qw, imu_qx, imu_qy, imu_qz;
+
+  // References
+  std::vector<Scalar> des_p[3], des_v[3], des_a[3], des_yaw;
+
+  // Thrust acceleration at full throttle
+  std::vector<Scalar> thr2acc;
+
+  // Outputs, u.thrust and u.q
+  std::vector<Scalar> thrust;
+  std::vector<Scalar> out_qw, out_qx, out_qy, out_qz;
+
+  GeometricBatchT() : n_(0) {}
+
+  void resize(int n);
+  int  size() const { return n_; }
+
+  // Gains and gravity from param
+  void compute(const Parameter_t &param);
+
+ private:
+  int n_;
+};
+
+typedef GeometricBatchT<double> GeometricBatch;
+typedef GeometricBatchT<float>  GeometricBatchF;
+
+#endif
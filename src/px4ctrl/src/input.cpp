@@ -2,6 +2,7 @@
 
 RC_Data_t::RC_Data_t() {
   rcv_stamp = ros::Time(0);
+  clock     = std::make_shared<RosClock>();
 
   last_mode = -1.0;
   last_gear = -1.0;
@@ -18,11 +19,11 @@ RC_Data_t::RC_Data_t() {
 }
 
 void RC_Data_t::feed(mavros_msgs::RCInConstPtr pMsg) {
-  msg       = *pMsg;
-  rcv_stamp = ros::Time::now();
+  msg       = pMsg;
+  rcv_stamp = clock->now();
 
   for (int i = 0; i < 4; i++) {
-    ch[i] = ((double)msg.channels[i] - 1500.0) / 500.0;
+    ch[i] = ((double)msg->channels[i] - 1500.0) / 500.0;
     if (ch[i] > DEAD_ZONE)
       ch[i] = (ch[i] - DEAD_ZONE) / (1 - DEAD_ZONE);
     else if (ch[i] < -DEAD_ZONE)
@@ -31,9 +32,9 @@ void RC_Data_t::feed(mavros_msgs::RCInConstPtr pMsg) {
       ch[i] = 0.0;
   }
 
-  mode       = ((double)msg.channels[4] - 1000.0) / 1000.0;
-  gear       = ((double)msg.channels[5] - 1000.0) / 1000.0;
-  reboot_cmd = ((double)msg.channels[7] - 1000.0) / 1000.0;
+  mode       = ((double)msg->channels[4] - 1000.0) / 1000.0;
+  gear       = ((double)msg->channels[5] - 1000.0) / 1000.0;
+  reboot_cmd = ((double)msg->channels[7] - 1000.0) / 1000.0;
 
   check_validity();
 
@@ -105,14 +106,15 @@ bool RC_Data_t::check_centered() {
 
 Odom_Data_t::Odom_Data_t() {
   rcv_stamp = ros::Time(0);
+  clock     = std::make_shared<RosClock>();
   q.setIdentity();
   recv_new_msg = false;
 };
 
 void Odom_Data_t::feed(nav_msgs::OdometryConstPtr pMsg) {
-  ros::Time now = ros::Time::now();
+  ros::Time now = clock->now();
 
-  msg          = *pMsg;
+  msg          = pMsg;
   rcv_stamp    = now;
   recv_new_msg = true;
 
@@ -121,18 +123,15 @@ void Odom_Data_t::feed(nav_msgs::OdometryConstPtr pMsg) {
 // #define VEL_IN_BODY
 #ifdef VEL_IN_BODY /* Set to 1 if the velocity in odom topic is relative to current body frame, \
                       not to world frame.*/
-  Eigen::Quaternion<double> wRb_q(msg.pose.pose.orientation.w, msg.pose.pose.orientation.x,
-                                  msg.pose.pose.orientation.y, msg.pose.pose.orientation.z);
+  Eigen::Quaternion<double> wRb_q(msg->pose.pose.orientation.w, msg->pose.pose.orientation.x,
+                                  msg->pose.pose.orientation.y, msg->pose.pose.orientation.z);
   Eigen::Matrix3d           wRb = wRb_q.matrix();
   v                             = wRb * v;
 
-  static int count = 0;
-  if (count++ % 500 == 0) ROS_WARN("VEL_IN_BODY!!!");
+  if (vel_in_body_count++ % 500 == 0) ROS_WARN("VEL_IN_BODY!!!");
 #endif
 
   // check the frequency
-  static int       one_min_count         = 9999;
-  static ros::Time last_clear_count_time = ros::Time(0.0);
   if ((now - last_clear_count_time).toSec() > 1.0) {
     if (one_min_count < 50) {
       ROS_WARN("ODOM frequency seems lower than 100Hz, which is too low!");
@@ -143,30 +142,39 @@ void Odom_Data_t::feed(nav_msgs::OdometryConstPtr pMsg) {
   one_min_count++;
 }
 
-Imu_Data_t::Imu_Data_t() { rcv_stamp = ros::Time(0); }
+Imu_Data_t::Imu_Data_t() {
+  a_filt.setZero();
+  vibration_notches = false;
+  rcv_stamp         = ros::Time(0);
+  clock             = std::make_shared<RosClock>();
+}
 
 void Imu_Data_t::feed(sensor_msgs::ImuConstPtr pMsg) {
-  ros::Time now = ros::Time::now();
+  ros::Time now = clock->now();
 
-  msg       = *pMsg;
+  msg       = pMsg;
   rcv_stamp = now;
 
-  w(0) = msg.angular_velocity.x;
-  w(1) = msg.angular_velocity.y;
-  w(2) = msg.angular_velocity.z;
+  w(0) = msg->angular_velocity.x;
+  w(1) = msg->angular_velocity.y;
+  w(2) = msg->angular_velocity.z;
+
+  a(0) = msg->linear_acceleration.x;
+  a(1) = msg->linear_acceleration.y;
+  a(2) = msg->linear_acceleration.z;
 
-  a(0) = msg.linear_acceleration.x;
-  a(1) = msg.linear_acceleration.y;
-  a(2) = msg.linear_acceleration.z;
+  if (vibration) {
+    vibration->push(a);
+    if (vibration_notches) vibration->update_notches(a_filter);
+  }
+  a_filt = a_filter.apply(a);
 
-  q.x() = msg.orientation.x;
-  q.y() = msg.orientation.y;
-  q.z() = msg.orientation.z;
-  q.w() = msg.orientation.w;
+  q.x() = msg->orientation.x;
+  q.y() = msg->orientation.y;
+  q.z() = msg->orientation.z;
+  q.w() = msg->orientation.w;
 
   // check the frequency
-  static int       one_min_count         = 9999;
-  static ros::Time last_clear_count_time = ros::Time(0.0);
   if ((now - last_clear_count_time).toSec() > 1.0) {
     if (one_min_count < 50) {
       ROS_WARN("IMU frequency seems lower than 100Hz, which is too low!");
@@ -179,7 +187,29 @@ void Imu_Data_t::feed(sensor_msgs::ImuConstPtr pMsg) {
 
 State_Data_t::State_Data_t() {}
 
-void State_Data_t::feed(mavros_msgs::StateConstPtr pMsg) { current_state = *pMsg; }
+// Indexed by State_Data_t::Mode_t
+static const char *const MODE_NAMES[State_Data_t::MODE_NUM] = {
+    "MANUAL", "ACRO", "ALTCTL", "POSCTL", "OFFBOARD", "STABILIZED", "RATTITUDE", "AUTO.MISSION",
+    "AUTO.LOITER", "AUTO.RTL", "AUTO.LAND", "AUTO.RTGS", "AUTO.READY", "AUTO.TAKEOFF",
+    "AUTO.PRECLAND", "AUTO.FOLLOW_TARGET", "UNKNOWN"};
+
+void State_Data_t::feed(mavros_msgs::StateConstPtr pMsg) {
+  connected = pMsg->connected;
+  armed     = pMsg->armed;
+  guided    = pMsg->guided;
+  mode      = parse_mode(pMsg->mode);
+}
+
+State_Data_t::Mode_t State_Data_t::parse_mode(const std::string &name) {
+  for (int i = 0; i < MODE_UNKNOWN; ++i) {
+    if (name == MODE_NAMES[i]) return (Mode_t)i;
+  }
+  return MODE_UNKNOWN;
+}
+
+const char *State_Data_t::mode_name(Mode_t mode) {
+  return mode >= 0 && mode < MODE_NUM ? MODE_NAMES[mode] : MODE_NAMES[MODE_UNKNOWN];
+}
 
 ExtendedState_Data_t::ExtendedState_Data_t() {}
 
@@ -187,50 +217,56 @@ void ExtendedState_Data_t::feed(mavros_msgs::ExtendedStateConstPtr pMsg) {
   current_extended_state = *pMsg;
 }
 
-Command_Data_t::Command_Data_t() { rcv_stamp = ros::Time(0); }
+Command_Data_t::Command_Data_t() {
+  rcv_stamp = ros::Time(0);
+  clock     = std::make_shared<RosClock>();
+}
 
 void Command_Data_t::feed(quadrotor_msgs::PositionCommandConstPtr pMsg) {
-  msg       = *pMsg;
-  rcv_stamp = ros::Time::now();
+  msg       = pMsg;
+  rcv_stamp = clock->now();
 
-  p(0) = msg.position.x;
-  p(1) = msg.position.y;
-  p(2) = msg.position.z;
+  p(0) = msg->position.x;
+  p(1) = msg->position.y;
+  p(2) = msg->position.z;
 
-  v(0) = msg.velocity.x;
-  v(1) = msg.velocity.y;
-  v(2) = msg.velocity.z;
+  v(0) = msg->velocity.x;
+  v(1) = msg->velocity.y;
+  v(2) = msg->velocity.z;
 
-  a(0) = msg.acceleration.x;
-  a(1) = msg.acceleration.y;
-  a(2) = msg.acceleration.z;
+  a(0) = msg->acceleration.x;
+  a(1) = msg->acceleration.y;
+  a(2) = msg->acceleration.z;
 
-  j(0) = msg.jerk.x;
-  j(1) = msg.jerk.y;
-  j(2) = msg.jerk.z;
+  j(0) = msg->jerk.x;
+  j(1) = msg->jerk.y;
+  j(2) = msg->jerk.z;
 
   // std::cout << "j1=" << j.transpose() << std::endl;
 
-  yaw      = uav_utils::normalize_angle(msg.yaw);
-  yaw_rate = msg.yaw_dot;
+  yaw      = uav_utils::normalize_angle(msg->yaw);
+  yaw_rate = msg->yaw_dot;
 }
 
-Battery_Data_t::Battery_Data_t() { rcv_stamp = ros::Time(0); }
+Battery_Data_t::Battery_Data_t() {
+  rcv_stamp = ros::Time(0);
+  clock     = std::make_shared<RosClock>();
+}
 
 void Battery_Data_t::feed(sensor_msgs::BatteryStateConstPtr pMsg) {
-  msg       = *pMsg;
-  rcv_stamp = ros::Time::now();
+  msg       = pMsg;
+  rcv_stamp = clock->now();
 
   double voltage = 0;
   for (size_t i = 0; i < pMsg->cell_voltage.size(); ++i) {
     voltage += pMsg->cell_voltage[i];
   }
-  volt = 0.8 * volt + 0.2 * voltage;  // Naive LPF, cell_voltage has a higher frequency
+  // Naive LPF, cell_voltage has a higher frequency. Start from the first reading, not from 0
+  volt = volt > 0 ? 0.8 * volt + 0.2 * voltage : voltage;
 
   // volt = 0.8 * volt + 0.2 * pMsg->voltage; // Naive LPF
   percentage = pMsg->percentage;
 
-  static ros::Time last_print_t = ros::Time(0);
   if (percentage > 0.05) {
     if ((rcv_stamp - last_print_t).toSec() > 10) {
       ROS_INFO("[px4ctrl] Voltage=%.3f, percentage=%.3f", volt, percentage);
@@ -244,11 +280,14 @@ void Battery_Data_t::feed(sensor_msgs::BatteryStateConstPtr pMsg) {
   }
 }
 
-Takeoff_Land_Data_t::Takeoff_Land_Data_t() { rcv_stamp = ros::Time(0); }
+Takeoff_Land_Data_t::Takeoff_Land_Data_t() {
+  rcv_stamp = ros::Time(0);
+  clock     = std::make_shared<RosClock>();
+}
 
 void Takeoff_Land_Data_t::feed(quadrotor_msgs::TakeoffLandConstPtr pMsg) {
-  msg       = *pMsg;
-  rcv_stamp = ros::Time::now();
+  msg       = pMsg;
+  rcv_stamp = clock->now();
 
   triggered        = true;
   takeoff_land_cmd = pMsg->takeoff_land_cmd;
@@ -13,6 +13,9 @@
 #include <sensor_msgs/BatteryState.h>
 #include <uav_utils/utils.h>
 #include "PX4CtrlParam.h"
+#include "accel_filter.h"
+#include "vibration_analyzer.h"
+#include "clock.h"
 
 class RC_Data_t
 {
@@ -28,8 +31,9 @@ public:
   bool have_init_last_reboot_cmd{false};
   double ch[4];
 
-  mavros_msgs::RCIn msg;
+  mavros_msgs::RCInConstPtr msg;
   ros::Time rcv_stamp;
+  std::shared_ptr<Clock> clock;
 
   bool is_command_mode;
   bool enter_command_mode;
@@ -58,9 +62,15 @@ public:
   Eigen::Quaterniond q;
   Eigen::Vector3d w;
 
-  nav_msgs::Odometry msg;
+  nav_msgs::OdometryConstPtr msg;
   ros::Time rcv_stamp;
+  std::shared_ptr<Clock> clock;
   bool recv_new_msg;
+  int vel_in_body_count{0};  // throttles the VEL_IN_BODY warning
+
+  // rate check, messages since last_clear_count_time
+  int one_min_count{9999};
+  ros::Time last_clear_count_time;
 
   Odom_Data_t();
   void feed(nav_msgs::OdometryConstPtr pMsg);
@@ -72,9 +82,20 @@ public:
   Eigen::Quaterniond q;
   Eigen::Vector3d w;
   Eigen::Vector3d a;
+  Eigen::Vector3d a_filt;  // a through a_filter, passes a unchanged until it is configured
+
+  AccelFilter a_filter;
+
+  std::shared_ptr<VibrationAnalyzer> vibration;          // gets every raw sample if set
+  bool                               vibration_notches;  // let it move the notches of a_filter
 
-  sensor_msgs::Imu msg;
+  sensor_msgs::ImuConstPtr msg;
   ros::Time rcv_stamp;
+  std::shared_ptr<Clock> clock;
+
+  // rate check, messages since last_clear_count_time
+  int one_min_count{9999};
+  ros::Time last_clear_count_time;
 
   Imu_Data_t();
   void feed(sensor_msgs::ImuConstPtr pMsg);
@@ -83,11 +104,40 @@ public:
 class State_Data_t
 {
 public:
-  mavros_msgs::State current_state;
-  mavros_msgs::State state_before_offboard;
+  // PX4 custom modes as mavros names them, parsed once in feed()
+  enum Mode_t
+  {
+    MANUAL = 0,
+    ACRO,
+    ALTCTL,
+    POSCTL,
+    OFFBOARD,
+    STABILIZED,
+    RATTITUDE,
+    AUTO_MISSION,
+    AUTO_LOITER,
+    AUTO_RTL,
+    AUTO_LAND,
+    AUTO_RTGS,
+    AUTO_READY,
+    AUTO_TAKEOFF,
+    AUTO_PRECLAND,
+    AUTO_FOLLOW_TARGET,
+    MODE_UNKNOWN,
+    MODE_NUM
+  };
+
+  bool connected{false};
+  bool armed{false};
+  bool guided{false};
+  Mode_t mode{MODE_UNKNOWN};
+  Mode_t mode_before_offboard{MANUAL};
 
   State_Data_t();
   void feed(mavros_msgs::StateConstPtr pMsg);
+
+  static Mode_t parse_mode(const std::string &name);
+  static const char *mode_name(Mode_t mode); // the custom_mode of mavros/set_mode
 };
 
 class ExtendedState_Data_t
@@ -110,8 +160,9 @@ public:
   double yaw;
   double yaw_rate;
 
-  quadrotor_msgs::PositionCommand msg;
+  quadrotor_msgs::PositionCommandConstPtr msg;
   ros::Time rcv_stamp;
+  std::shared_ptr<Clock> clock;
 
   Command_Data_t();
   void feed(quadrotor_msgs::PositionCommandConstPtr pMsg);
@@ -124,8 +175,10 @@ public:
   double volt{0.0};
   double percentage{0.0};
 
-  sensor_msgs::BatteryState msg;
+  sensor_msgs::BatteryStateConstPtr msg;
   ros::Time rcv_stamp;
+  std::shared_ptr<Clock> clock;
+  ros::Time last_print_t;
 
   Battery_Data_t();
   void feed(sensor_msgs::BatteryStateConstPtr pMsg);
@@ -138,8 +191,9 @@ public:
   bool triggered{false};
   uint8_t takeoff_land_cmd; // see TakeoffLand.msg for its defination
 
-  quadrotor_msgs::TakeoffLand msg;
+  quadrotor_msgs::TakeoffLandConstPtr msg;
   ros::Time rcv_stamp;
+  std::shared_ptr<Clock> clock;
 
   Takeoff_Land_Data_t();
   void feed(quadrotor_msgs::TakeoffLandConstPtr pMsg);
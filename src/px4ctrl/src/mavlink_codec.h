@@ -0,0 +1,231 @@
+#ifndef __MAVLINK_CODEC_H
+#define __MAVLINK_CODEC_H
+
+/*
+  Minimal MAVLink v2 framing for the few messages px4ctrl talks directly to the FCU.
+  Only SET_ATTITUDE_TARGET (sent by px4ctrl) and HEARTBEAT (sent by the stand-in FCU) are
+  encoded here, so we do not need to pull the generated mavlink headers into the controller.
+  Field layout follows https://mavlink.io/en/messages/common.html. Little-endian host assumed
+  (x86 and ARM companion computers).
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace mavlink_codec {
+
+static constexpr uint8_t  MAVLINK_STX_V1        = 0xFE;
+static constexpr uint8_t  MAVLINK_STX_V2        = 0xFD;
+static constexpr size_t   MAVLINK_HEADER_LEN_V2 = 10;  // STX, len, flags x2, seq, sys, comp, id x3
+static constexpr size_t   MAVLINK_MAX_FRAME_LEN = MAVLINK_HEADER_LEN_V2 + 255 + 2;
+
+static constexpr uint32_t MSG_ID_HEARTBEAT            = 0;
+static constexpr uint8_t  MSG_LEN_HEARTBEAT           = 9;
+static constexpr uint8_t  MSG_CRC_EXTRA_HEARTBEAT     = 50;
+static constexpr uint32_t MSG_ID_SET_ATTITUDE_TARGET  = 82;
+static constexpr uint8_t  MSG_LEN_SET_ATTITUDE_TARGET = 39;  // without the thrust_body extension
+static constexpr uint8_t  MSG_CRC_EXTRA_SET_ATTITUDE_TARGET = 49;
+
+struct SetAttitudeTarget {
+  uint32_t time_boot_ms;
+  float    q[4];  // w, x, y, z. FRD body frame w.r.t. NED
+  float    body_roll_rate;
+  float    body_pitch_rate;
+  float    body_yaw_rate;
+  float    thrust;
+  uint8_t  target_system;
+  uint8_t  target_component;
+  uint8_t  type_mask;  // same bits as mavros_msgs::AttitudeTarget::type_mask
+};
+
+/* CRC-16/MCRF4XX (X.25) as used by MAVLink */
+inline void crc_accumulate(uint8_t data, uint16_t &crc) {
+  uint8_t tmp = data ^ (uint8_t)(crc & 0xff);
+  tmp ^= (tmp << 4);
+  crc = (crc >> 8) ^ (tmp << 8) ^ (tmp << 3) ^ (tmp >> 4);
+}
+
+inline uint16_t crc_calculate(const uint8_t *buf, size_t len) {
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < len; ++i) crc_accumulate(buf[i], crc);
+  return crc;
+}
+
+/*
+  Wrap a payload into a v2 frame. Trailing zero bytes are truncated as required by the spec.
+  @return number of bytes written to frame (frame must hold MAVLINK_MAX_FRAME_LEN bytes)
+*/
+inline size_t finalize_frame_v2(uint8_t       *frame,
+                                const uint8_t *payload,
+                                uint8_t        payload_len,
+                                uint8_t        seq,
+                                uint8_t        sysid,
+                                uint8_t        compid,
+                                uint32_t       msgid,
+                                uint8_t        crc_extra) {
+  uint8_t len = payload_len;
+  while (len > 1 && payload[len - 1] == 0) --len;
+
+  frame[0] = MAVLINK_STX_V2;
+  frame[1] = len;
+  frame[2] = 0;  // incompat_flags, no signing
+  frame[3] = 0;  // compat_flags
+  frame[4] = seq;
+  frame[5] = sysid;
+  frame[6] = compid;
+  frame[7] = (uint8_t)(msgid & 0xff);
+  frame[8] = (uint8_t)((msgid >> 8) & 0xff);
+  frame[9] = (uint8_t)((msgid >> 16) & 0xff);
+  memcpy(frame + MAVLINK_HEADER_LEN_V2, payload, len);
+
+  uint16_t crc = crc_calculate(frame + 1, MAVLINK_HEADER_LEN_V2 - 1 + len);
+  crc_accumulate(crc_extra, crc);
+  frame[MAVLINK_HEADER_LEN_V2 + len]     = (uint8_t)(crc & 0xff);
+  frame[MAVLINK_HEADER_LEN_V2 + len + 1] = (uint8_t)(crc >> 8);
+
+  return MAVLINK_HEADER_LEN_V2 + len + 2;
+}
+
+inline size_t pack_set_attitude_target(uint8_t                 *frame,
+                                       const SetAttitudeTarget &m,
+                                       uint8_t                  seq,
+                                       uint8_t                  sysid,
+                                       uint8_t                  compid) {
+  uint8_t payload[MSG_LEN_SET_ATTITUDE_TARGET];
+  memcpy(payload + 0, &m.time_boot_ms, 4);
+  memcpy(payload + 4, m.q, 16);
+  memcpy(payload + 20, &m.body_roll_rate, 4);
+  memcpy(payload + 24, &m.body_pitch_rate, 4);
+  memcpy(payload + 28, &m.body_yaw_rate, 4);
+  memcpy(payload + 32, &m.thrust, 4);
+  payload[36] = m.target_system;
+  payload[37] = m.target_component;
+  payload[38] = m.type_mask;
+
+  return finalize_frame_v2(frame, payload, MSG_LEN_SET_ATTITUDE_TARGET, seq, sysid, compid,
+                           MSG_ID_SET_ATTITUDE_TARGET, MSG_CRC_EXTRA_SET_ATTITUDE_TARGET);
+}
+
+/* payload may be truncated (v2), missing bytes are zero */
+inline void unpack_set_attitude_target(const uint8_t *payload, uint8_t len, SetAttitudeTarget &m) {
+  uint8_t buf[MSG_LEN_SET_ATTITUDE_TARGET] = {0};
+  memcpy(buf, payload, len < sizeof(buf) ? len : sizeof(buf));
+  memcpy(&m.time_boot_ms, buf + 0, 4);
+  memcpy(m.q, buf + 4, 16);
+  memcpy(&m.body_roll_rate, buf + 20, 4);
+  memcpy(&m.body_pitch_rate, buf + 24, 4);
+  memcpy(&m.body_yaw_rate, buf + 28, 4);
+  memcpy(&m.thrust, buf + 32, 4);
+  m.target_system    = buf[36];
+  m.target_component = buf[37];
+  m.type_mask        = buf[38];
+}
+
+inline size_t pack_heartbeat(uint8_t *frame,
+                             uint8_t  seq,
+                             uint8_t  sysid,
+                             uint8_t  compid,
+                             uint32_t custom_mode,
+                             uint8_t  type,
+                             uint8_t  autopilot,
+                             uint8_t  base_mode,
+                             uint8_t  system_status) {
+  uint8_t payload[MSG_LEN_HEARTBEAT];
+  memcpy(payload + 0, &custom_mode, 4);
+  payload[4] = type;
+  payload[5] = autopilot;
+  payload[6] = base_mode;
+  payload[7] = system_status;
+  payload[8] = 3;  // mavlink_version
+
+  return finalize_frame_v2(frame, payload, MSG_LEN_HEARTBEAT, seq, sysid, compid,
+                           MSG_ID_HEARTBEAT, MSG_CRC_EXTRA_HEARTBEAT);
+}
+
+/*
+  Incremental v1/v2 frame parser. Feed bytes one by one; returns true when a complete frame
+  with a valid checksum has been received. CRC can only be checked for messages whose crc_extra
+  we know, other frames are reported with crc_ok = false.
+*/
+class FrameParser {
+ public:
+  uint8_t  sysid{0};
+  uint8_t  compid{0};
+  uint8_t  seq{0};
+  uint32_t msgid{0};
+  uint8_t  payload_len{0};
+  uint8_t  payload[255];
+  bool     crc_ok{false};
+
+  bool parse_char(uint8_t c) {
+    switch (state_) {
+      case IDLE:
+        if (c == MAVLINK_STX_V1 || c == MAVLINK_STX_V2) {
+          v2_     = (c == MAVLINK_STX_V2);
+          idx_    = 0;
+          buf_[0] = c;
+          state_  = HEADER;
+        }
+        return false;
+      case HEADER:
+        buf_[++idx_] = c;
+        if (idx_ == (v2_ ? MAVLINK_HEADER_LEN_V2 - 1 : 5)) {
+          payload_len = buf_[1];
+          if (v2_ && (buf_[2] & 0x01)) {  // signed frames are not supported
+            state_ = IDLE;
+            return false;
+          }
+          state_ = (payload_len > 0) ? PAYLOAD : CRC;
+          got_   = 0;
+        }
+        return false;
+      case PAYLOAD:
+        buf_[++idx_] = c;
+        if (++got_ == payload_len) {
+          state_ = CRC;
+          got_   = 0;
+        }
+        return false;
+      case CRC:
+        buf_[++idx_] = c;
+        if (++got_ < 2) return false;
+        state_ = IDLE;
+        decode();
+        return true;
+    }
+    return false;
+  }
+
+ private:
+  enum ParseState { IDLE, HEADER, PAYLOAD, CRC };
+  ParseState state_{IDLE};
+  bool       v2_{false};
+  size_t     idx_{0};
+  size_t     got_{0};
+  uint8_t    buf_[MAVLINK_MAX_FRAME_LEN];
+
+  void decode() {
+    const size_t hdr = v2_ ? MAVLINK_HEADER_LEN_V2 : 6;
+    seq              = buf_[v2_ ? 4 : 2];
+    sysid            = buf_[v2_ ? 5 : 3];
+    compid           = buf_[v2_ ? 6 : 4];
+    msgid            = v2_ ? (buf_[7] | (buf_[8] << 8) | ((uint32_t)buf_[9] << 16)) : buf_[5];
+    memcpy(payload, buf_ + hdr, payload_len);
+
+    int crc_extra = -1;
+    if (msgid == MSG_ID_SET_ATTITUDE_TARGET) crc_extra = MSG_CRC_EXTRA_SET_ATTITUDE_TARGET;
+    if (msgid == MSG_ID_HEARTBEAT) crc_extra = MSG_CRC_EXTRA_HEARTBEAT;
+    if (crc_extra < 0) {
+      crc_ok = false;
+      return;
+    }
+    uint16_t crc = crc_calculate(buf_ + 1, hdr - 1 + payload_len);
+    crc_accumulate((uint8_t)crc_extra, crc);
+    crc_ok = buf_[hdr + payload_len] == (crc & 0xff) && buf_[hdr + payload_len + 1] == (crc >> 8);
+  }
+};
+
+}  // namespace mavlink_codec
+
+#endif
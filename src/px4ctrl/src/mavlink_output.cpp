@@ -0,0 +1,183 @@
+#include "mavlink_output.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace {
+
+/* mavros ftf: NED_ENU_Q = rpy(pi, 0, pi/2), AIRCRAFT_BASELINK_Q = rpy(pi, 0, 0) */
+const Eigen::Quaterniond NED_ENU_Q(Eigen::AngleAxisd(M_PI_2, Eigen::Vector3d::UnitZ()) *
+                                   Eigen::AngleAxisd(M_PI, Eigen::Vector3d::UnitX()));
+const Eigen::Quaterniond AIRCRAFT_BASELINK_Q(Eigen::AngleAxisd(M_PI, Eigen::Vector3d::UnitX()));
+
+speed_t to_termios_baud(int baudrate) {
+  switch (baudrate) {
+    case 57600:
+      return B57600;
+    case 115200:
+      return B115200;
+    case 230400:
+      return B230400;
+    case 460800:
+      return B460800;
+    case 500000:
+      return B500000;
+    case 921600:
+      return B921600;
+    case 1000000:
+      return B1000000;
+    case 1500000:
+      return B1500000;
+    case 2000000:
+      return B2000000;
+    case 3000000:
+      return B3000000;
+    default:
+      return B0;
+  }
+}
+
+}  // namespace
+
+MavlinkSetpointOutput::MavlinkSetpointOutput(const Parameter_t::MavlinkOutput &param)
+    : param_(param) {}
+
+MavlinkSetpointOutput::~MavlinkSetpointOutput() { close(); }
+
+bool MavlinkSetpointOutput::open() {
+  const std::string &url = param_.url;
+
+  std::string::size_type sep = url.find("://");
+  std::string::size_type col = url.rfind(':');
+  if (sep == std::string::npos || col == std::string::npos || col <= sep + 3) {
+    ROS_ERROR("[px4ctrl] Invalid mavlink_output/url \"%s\".", url.c_str());
+    return false;
+  }
+
+  std::string scheme = url.substr(0, sep);
+  std::string target = url.substr(sep + 3, col - sep - 3);
+  int         number = atoi(url.substr(col + 1).c_str());
+
+  bool ok = false;
+  if (scheme == "udp")
+    ok = open_udp(target, number);
+  else if (scheme == "serial")
+    ok = open_serial(target, number);
+  else
+    ROS_ERROR("[px4ctrl] Unknown mavlink_output scheme \"%s\".", scheme.c_str());
+
+  if (ok) ROS_INFO("[px4ctrl] MAVLink setpoint output opened on %s", url.c_str());
+  return ok;
+}
+
+void MavlinkSetpointOutput::close() {
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+}
+
+bool MavlinkSetpointOutput::open_udp(const std::string &host, int port) {
+  fd_ = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd_ < 0) {
+    ROS_ERROR("[px4ctrl] socket() failed: %s", strerror(errno));
+    return false;
+  }
+
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port   = htons(port);
+  if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+    ROS_ERROR("[px4ctrl] Invalid UDP address %s", host.c_str());
+    close();
+    return false;
+  }
+
+  // connect() fixes the peer so every send is a plain write() without address lookup
+  if (connect(fd_, (sockaddr *)&addr, sizeof(addr)) < 0) {
+    ROS_ERROR("[px4ctrl] connect(%s:%d) failed: %s", host.c_str(), port, strerror(errno));
+    close();
+    return false;
+  }
+  fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) | O_NONBLOCK);
+
+  return true;
+}
+
+bool MavlinkSetpointOutput::open_serial(const std::string &device, int baudrate) {
+  speed_t speed = to_termios_baud(baudrate);
+  if (speed == B0) {
+    ROS_ERROR("[px4ctrl] Unsupported baudrate %d", baudrate);
+    return false;
+  }
+
+  fd_ = ::open(device.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (fd_ < 0) {
+    ROS_ERROR("[px4ctrl] open(%s) failed: %s", device.c_str(), strerror(errno));
+    return false;
+  }
+
+  termios tio;
+  if (tcgetattr(fd_, &tio) < 0) {
+    ROS_ERROR("[px4ctrl] tcgetattr(%s) failed: %s", device.c_str(), strerror(errno));
+    close();
+    return false;
+  }
+  cfmakeraw(&tio);
+  cfsetispeed(&tio, speed);
+  cfsetospeed(&tio, speed);
+  tio.c_cflag |= (CLOCAL | CREAD);
+  tio.c_cflag &= ~CRTSCTS;
+  if (tcsetattr(fd_, TCSANOW, &tio) < 0) {
+    ROS_ERROR("[px4ctrl] tcsetattr(%s) failed: %s", device.c_str(), strerror(errno));
+    close();
+    return false;
+  }
+
+  return true;
+}
+
+bool MavlinkSetpointOutput::send_attitude_target(const ros::Time          &stamp,
+                                                 uint8_t                   type_mask,
+                                                 const Eigen::Quaterniond &q,
+                                                 const Eigen::Vector3d    &bodyrates,
+                                                 double                    thrust) {
+  if (fd_ < 0) return false;
+
+  Eigen::Quaterniond q_ned = NED_ENU_Q * q * AIRCRAFT_BASELINK_Q;
+
+  std::lock_guard<std::mutex> lock(mutex_);  // uncontended unless the watchdog sends
+
+  mavlink_codec::SetAttitudeTarget m;
+  m.time_boot_ms     = (uint32_t)(stamp.toNSec() / 1000000);  // same as mavros setpoint_raw
+  m.q[0]             = q_ned.w();
+  m.q[1]             = q_ned.x();
+  m.q[2]             = q_ned.y();
+  m.q[3]             = q_ned.z();
+  m.body_roll_rate   = bodyrates.x();
+  m.body_pitch_rate  = -bodyrates.y();
+  m.body_yaw_rate    = -bodyrates.z();
+  m.thrust           = thrust;
+  m.target_system    = param_.target_system;
+  m.target_component = param_.target_component;
+  m.type_mask        = type_mask;
+
+  size_t len = mavlink_codec::pack_set_attitude_target(frame_, m, seq_++, param_.system_id,
+                                                       param_.component_id);
+
+  // Never block the control loop. A full socket/UART buffer means the link cannot keep up anyway.
+  ssize_t n = ::write(fd_, frame_, len);
+  if (n != (ssize_t)len) {
+    dropped_count_++;
+    return false;
+  }
+
+  sent_count_++;
+  return true;
+}
@@ -0,0 +1,58 @@
+#ifndef __MAVLINK_OUTPUT_H
+#define __MAVLINK_OUTPUT_H
+
+#include <ros/ros.h>
+#include <Eigen/Dense>
+
+#include <mutex>
+
+#include "PX4CtrlParam.h"
+#include "mavlink_codec.h"
+
+/*
+  Sends SET_ATTITUDE_TARGET straight to the FCU, skipping the mavros hop for setpoints. mavros
+  stays connected on its own link for telemetry, mode switching and arming.
+
+  Supported endpoints (parameter "mavlink_output/url"):
+    udp://<ip>:<port>            e.g. a mavlink-router endpoint or the PX4 SITL onboard port
+    serial://<device>:<baudrate> e.g. a second FCU UART (TELEM2) dedicated to setpoints
+
+  Frame conversion is the same as mavros' setpoint_raw/attitude plugin (ENU/baselink -> NED/FRD).
+  send_attitude_target() may be called from process() and the ControlWatchdog thread.
+*/
+class MavlinkSetpointOutput {
+ public:
+  MavlinkSetpointOutput(const Parameter_t::MavlinkOutput &param);
+  ~MavlinkSetpointOutput();
+
+  bool open();
+  bool is_open() const { return fd_ >= 0; }
+  void close();
+
+  // q and bodyrates are in ENU/baselink, as published on mavros/setpoint_raw/attitude
+  bool send_attitude_target(const ros::Time         &stamp,
+                            uint8_t                  type_mask,
+                            const Eigen::Quaterniond &q,
+                            const Eigen::Vector3d    &bodyrates,
+                            double                   thrust);
+
+  uint64_t sent_count() const { return sent_count_; }
+  uint64_t dropped_count() const { return dropped_count_; }
+
+ private:
+  Parameter_t::MavlinkOutput param_;
+
+  std::mutex mutex_;  // of seq_, frame_ and the counters
+
+  int     fd_{-1};
+  uint8_t seq_{0};
+  uint8_t frame_[mavlink_codec::MAVLINK_MAX_FRAME_LEN];
+
+  uint64_t sent_count_{0};
+  uint64_t dropped_count_{0};
+
+  bool open_udp(const std::string &host, int port);
+  bool open_serial(const std::string &device, int baudrate);
+};
+
+#endif
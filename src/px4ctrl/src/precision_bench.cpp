@@ -0,0 +1,237 @@
+/*
+  Float against double for the geometric control law (control_math.h): numerical equivalence on
+  recorded flights and on a sweep of attitudes, and the throughput of both.
+
+  usage: px4ctrl_precision_bench <param.yaml> <ring file> [--steps <n>]
+
+  The ring file is a flight recorder file, from px4ctrl (flight_recorder/enable) or from
+  px4ctrl_sim --record. Every AUTO_HOVER and CMD_CTRL tick is one vehicle of a GeometricBatch and
+  of a GeometricBatchF, with the odometry, the FCU attitude, the references and the thr2acc of the
+  record. The sweep adds every combination of heading, current tilt and desired tilt, which
+  covers the four cases of the rotation to quaternion conversion. For each set the largest
+  differences of the float outputs are reported:
+    - thrust, the normalized thrust command
+    - attitude, the angle between the two attitude setpoints
+  and both must stay within the tolerances below. Then the recorded ticks are run --steps times
+  in each precision and the throughput is printed in vehicles per second.
+
+  The exit code is non-zero if a tolerance is exceeded or the file has no usable ticks.
+*/
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#include "PX4CtrlFSM.h"
+#include "geometric_batch.h"
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s <param.yaml> <ring file> [--steps <n>]\n", name);
+}
+
+static const double TOLERANCE_THRUST    = 1e-5;  // of the 0~1 thrust command
+static const double TOLERANCE_ATTITUDE  = 1e-3;  // deg
+static const int    SWEEP_HEADINGS      = 72;
+static const int    SWEEP_TILTS         = 4;   // 0, 20, 40, 60 deg
+static const int    SWEEP_TILT_HEADINGS = 8;
+
+struct Vehicle {
+  double p[3], v[3], q[4], imu_q[4], des_p[3], des_v[3], des_a[3], des_yaw, thr2acc;
+};
+
+// Valid AUTO_HOVER and CMD_CTRL records, oldest first
+static bool read_ring(const char *path, std::vector<Vehicle> &out) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror("open");
+    return false;
+  }
+  struct stat st;
+  fstat(fd, &st);
+  if ((size_t)st.st_size < sizeof(FlightRecorderHeader)) {
+    fprintf(stderr, "%s is not a flight recorder file\n", path);
+    return false;
+  }
+  const char *base =
+      static_cast<const char *>(mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0));
+  close(fd);
+  if (base == MAP_FAILED) {
+    perror("mmap");
+    return false;
+  }
+
+  const FlightRecorderHeader *hdr = reinterpret_cast<const FlightRecorderHeader *>(base);
+  if (memcmp(hdr->magic, FLIGHT_RECORDER_MAGIC, sizeof(hdr->magic)) != 0 ||
+      hdr->version != FLIGHT_RECORDER_VERSION || hdr->record_size != sizeof(FlightRecord) ||
+      sizeof(FlightRecorderHeader) + hdr->capacity * sizeof(FlightRecord) > (size_t)st.st_size) {
+    fprintf(stderr, "%s: unsupported or corrupted flight recorder file\n", path);
+    return false;
+  }
+  const FlightRecord *records =
+      reinterpret_cast<const FlightRecord *>(base + sizeof(FlightRecorderHeader));
+
+  uint64_t count = __atomic_load_n(&hdr->write_count, __ATOMIC_ACQUIRE);
+  uint64_t first = count >= hdr->capacity ? count - hdr->capacity + 1 : 0;
+  for (uint64_t n = first; n < count; ++n) {
+    const FlightRecord &r = records[n % hdr->capacity];
+    if (r.seq != n || r.thr2acc <= 0) continue;
+    if (r.state != PX4CtrlFSM::AUTO_HOVER && r.state != PX4CtrlFSM::CMD_CTRL) continue;
+
+    Vehicle v;
+    memcpy(v.p, r.odom_p, sizeof(v.p));
+    memcpy(v.v, r.odom_v, sizeof(v.v));
+    memcpy(v.q, r.odom_q, sizeof(v.q));
+    memcpy(v.imu_q, r.imu_q, sizeof(v.imu_q));
+    memcpy(v.des_p, r.des_p, sizeof(v.des_p));
+    memcpy(v.des_v, r.des_v, sizeof(v.des_v));
+    memcpy(v.des_a, r.des_a, sizeof(v.des_a));
+    v.des_yaw = r.des_yaw;
+    v.thr2acc = r.thr2acc;
+    out.push_back(v);
+  }
+  munmap(const_cast<char *>(base), st.st_size);
+  return true;
+}
+
+// Hovering at the origin, so that des_a sets the desired acceleration alone
+static void make_sweep(const Parameter_t &param, std::vector<Vehicle> &out) {
+  const double hover_thr2acc = param.gra / param.thr_map.hover_percentage;
+  for (int h = 0; h < SWEEP_HEADINGS; ++h) {
+    double yaw = -M_PI + 2 * M_PI * h / SWEEP_HEADINGS;
+    for (int t = 0; t < SWEEP_TILTS * SWEEP_TILT_HEADINGS; ++t) {
+      for (int d = 0; d < SWEEP_TILTS * SWEEP_TILT_HEADINGS; ++d) {
+        double tilt     = M_PI / 9 * (t / SWEEP_TILT_HEADINGS);
+        double tilt_dir = 2 * M_PI * (t % SWEEP_TILT_HEADINGS) / SWEEP_TILT_HEADINGS;
+        double des_tilt = M_PI / 9 * (d / SWEEP_TILT_HEADINGS);
+        double des_dir  = 2 * M_PI * (d % SWEEP_TILT_HEADINGS) / SWEEP_TILT_HEADINGS;
+
+        Eigen::Quaterniond q =
+            Eigen::AngleAxisd(yaw + 0.3, Eigen::Vector3d::UnitZ()) *
+            Eigen::AngleAxisd(tilt, Eigen::Vector3d(std::cos(tilt_dir), std::sin(tilt_dir), 0));
+        Eigen::Vector3d acc = param.gra * Eigen::Vector3d(std::tan(des_tilt) * std::cos(des_dir),
+                                                          std::tan(des_tilt) * std::sin(des_dir),
+                                                          1.0);
+        Vehicle v;
+        for (int k = 0; k < 3; ++k) v.p[k] = v.v[k] = v.des_p[k] = v.des_v[k] = 0;
+        v.q[0] = v.imu_q[0] = q.w();
+        v.q[1] = v.imu_q[1] = q.x();
+        v.q[2] = v.imu_q[2] = q.y();
+        v.q[3] = v.imu_q[3] = q.z();
+        v.des_a[0]          = acc(0);
+        v.des_a[1]          = acc(1);
+        v.des_a[2]          = acc(2) - param.gra;
+        v.des_yaw           = yaw;
+        v.thr2acc           = hover_thr2acc;
+        out.push_back(v);
+      }
+    }
+  }
+}
+
+template <typename Scalar>
+static void fill(const std::vector<Vehicle> &vs, GeometricBatchT<Scalar> &b) {
+  b.resize(vs.size());
+  for (size_t i = 0; i < vs.size(); ++i) {
+    const Vehicle &v = vs[i];
+    for (int k = 0; k < 3; ++k) {
+      b.p[k][i]     = v.p[k];
+      b.v[k][i]     = v.v[k];
+      b.des_p[k][i] = v.des_p[k];
+      b.des_v[k][i] = v.des_v[k];
+      b.des_a[k][i] = v.des_a[k];
+    }
+    b.qw[i]      = v.q[0];
+    b.qx[i]      = v.q[1];
+    b.qy[i]      = v.q[2];
+    b.qz[i]      = v.q[3];
+    b.imu_qw[i]  = v.imu_q[0];
+    b.imu_qx[i]  = v.imu_q[1];
+    b.imu_qy[i]  = v.imu_q[2];
+    b.imu_qz[i]  = v.imu_q[3];
+    b.des_yaw[i] = v.des_yaw;
+    b.thr2acc[i] = v.thr2acc;
+  }
+}
+
+// Largest differences of the float outputs, true if within the tolerances
+static bool compare(const char *name, const std::vector<Vehicle> &vs, const Parameter_t &param) {
+  GeometricBatch  d;
+  GeometricBatchF f;
+  fill(vs, d);
+  fill(vs, f);
+  d.compute(param);
+  f.compute(param);
+
+  double max_thr = 0, max_att = 0;
+  for (size_t i = 0; i < vs.size(); ++i) {
+    max_thr = std::max(max_thr, std::abs(d.thrust[i] - (double)f.thrust[i]));
+
+    // angle of qd^-1 * qf, from its vector part, which is accurate for small angles
+    Eigen::Quaterniond qd(d.out_qw[i], d.out_qx[i], d.out_qy[i], d.out_qz[i]);
+    Eigen::Quaterniond qf(f.out_qw[i], f.out_qx[i], f.out_qy[i], f.out_qz[i]);
+    Eigen::Quaterniond e = qd.normalized().conjugate() * qf.normalized();
+    double angle = 2 * std::asin(std::min(e.vec().norm(), 1.0));
+    // q and -q are the same attitude
+    max_att = std::max(max_att, std::min(angle, 2 * M_PI - angle) * 180 / M_PI);
+  }
+
+  bool ok = max_thr <= TOLERANCE_THRUST && max_att <= TOLERANCE_ATTITUDE;
+  printf("%-8s %7zu vehicles, float - double: thrust %.2e, attitude %.2e deg  %s\n", name,
+         vs.size(), max_thr, max_att, ok ? "ok" : "FAIL");
+  return ok;
+}
+
+template <typename Scalar>
+static double throughput(const std::vector<Vehicle> &vs, const Parameter_t &param, int steps) {
+  GeometricBatchT<Scalar> b;
+  fill(vs, b);
+  b.compute(param);  // warm up
+
+  typedef std::chrono::steady_clock clk;
+  clk::time_point                   t0 = clk::now();
+  for (int s = 0; s < steps; ++s) b.compute(param);
+  return (double)vs.size() * steps / std::chrono::duration<double>(clk::now() - t0).count();
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  int steps = 200;
+  for (int i = 3; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--steps" && i + 1 < argc)
+      steps = atoi(argv[++i]);
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  Parameter_t param;
+  if (!param.config_from_yaml_file(argv[1])) return 1;
+
+  std::vector<Vehicle> recorded, sweep;
+  if (!read_ring(argv[2], recorded)) return 1;
+  if (recorded.empty()) {
+    fprintf(stderr, "%s has no AUTO_HOVER or CMD_CTRL ticks\n", argv[2]);
+    return 1;
+  }
+  make_sweep(param, sweep);
+
+  bool ok = compare("recorded", recorded, param);
+  ok      = compare("sweep", sweep, param) && ok;
+
+  double rate_d = throughput<double>(recorded, param, steps);
+  double rate_f = throughput<float>(recorded, param, steps);
+  printf("double: %.3g vehicles/s\n", rate_d);
+  printf("float:  %.3g vehicles/s, %.2fx\n", rate_f, rate_f / rate_d);
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,102 @@
+#include <ros/callback_queue.h>
+#include <ros/ros.h>
+#include <signal.h>
+#include "px4ctrl_ros.h"
+#include "work_stealing_pool.h"
+
+/*
+  Many px4ctrl instances in one process, for simulation rigs with more vehicles than processes
+  scale to.
+
+  ~vehicles is a list of namespaces. Vehicle <ns> subscribes and publishes under <ns>
+  (<ns>/mavros/state, <ns>/odom, <ns>/px4ctrl/takeoff_land, ...) and reads its parameters from
+  <ns>/px4ctrl, so every vehicle can have its own param file, flight recorder and thrust model.
+
+  Each vehicle has its own callback queue. Every control period one task per vehicle runs on a
+  WorkStealingPool of ~threads workers (0: one per hardware thread): it handles the messages
+  queued for that vehicle, then runs process(). The callbacks and process() of one vehicle never
+  run concurrently, as in px4ctrl_node, while different vehicles run in parallel. The period is
+  that of the highest ctrl_freq_max of all vehicles.
+
+  Per vehicle, px4ctrl_node would add up to three threads: the vibration analyzer, debugPx4ctrl
+  and the control watchdog. Here the first two run on the pool instead, as a second task that
+  each vehicle submits after its process(). The watchdog is off: it exists to bridge a control
+  thread that stalls, and on a shared pool a stall holds up every vehicle alike, so it cannot be
+  a pool task and a thread per vehicle does not scale. The flight recorder has no thread, but
+  each vehicle locks its own ring of flight_recorder/capacity * 512 bytes in memory, so keep the
+  capacity small or the recorder off when RLIMIT_MEMLOCK is tight.
+*/
+
+struct Vehicle {
+  std::string                 ns;
+  ros::CallbackQueue          queue;
+  std::unique_ptr<PX4CtrlRos> px4ctrl;
+  bool                        ready{false};
+
+  void tick(WorkStealingPool &pool) {
+    queue.callAvailable();
+
+    PX4CtrlFSM &fsm = *px4ctrl->fsm;
+    if (!ready) {
+      ready = px4ctrl->fcu_ready(fsm.clock->now());
+      if (ready) ROS_INFO("[PX4CTRL] %s: RC/FCU connected.", ns.c_str());
+    }
+    if (ready) fsm.process();
+    pool.submit([this]() { px4ctrl->poll(); });
+  }
+};
+
+void mySigintHandler(int sig) {
+  ROS_INFO("[PX4Ctrl] exit...");
+  ros::shutdown();
+}
+
+int main(int argc, char *argv[]) {
+  ros::init(argc, argv, "px4ctrl_multi");
+  ros::NodeHandle nh_private("~");
+
+  signal(SIGINT, mySigintHandler);
+
+  std::vector<std::string> namespaces;
+  int                      threads = 0;
+  nh_private.getParam("vehicles", namespaces);
+  nh_private.getParam("threads", threads);
+  if (namespaces.empty()) {
+    ROS_ERROR("[PX4CTRL] ~vehicles is empty, nothing to control.");
+    return 1;
+  }
+
+  ros::Duration(1.0).sleep();
+
+  std::vector<std::unique_ptr<Vehicle>> vehicles;
+  double                                ctrl_freq = 0;
+  for (const std::string &ns : namespaces) {
+    std::unique_ptr<Vehicle> v(new Vehicle);
+    v->ns = ns;
+
+    ros::NodeHandle nh(ns);
+    ros::NodeHandle nh_vehicle(nh, "px4ctrl");
+    nh.setCallbackQueue(&v->queue);
+    nh_vehicle.setCallbackQueue(&v->queue);
+    v->px4ctrl.reset(new PX4CtrlRos(nh, nh_vehicle, false));
+
+    ctrl_freq = std::max(ctrl_freq, v->px4ctrl->param.ctrl_freq_max);
+    vehicles.push_back(std::move(v));
+  }
+
+  WorkStealingPool pool(threads < 0 ? 0 : (unsigned)threads);
+  ROS_INFO("[PX4CTRL] %zu vehicles at %.0f Hz on %u threads.", vehicles.size(), ctrl_freq,
+           pool.size());
+
+  ros::Rate r(ctrl_freq);
+  while (ros::ok()) {
+    r.sleep();
+    for (std::unique_ptr<Vehicle> &v : vehicles) {
+      Vehicle *vp = v.get();
+      pool.submit([vp, &pool]() { vp->tick(pool); });
+    }
+    pool.wait_idle();
+  }
+
+  return 0;
+}
@@ -1,6 +1,6 @@
 #include <ros/ros.h>
 #include <signal.h>
-#include "PX4CtrlFSM.h"
+#include "px4ctrl_ros.h"
 
 void mySigintHandler(int sig) {
   ROS_INFO("[PX4Ctrl] exit...");
@@ -15,70 +15,16 @@ int main(int argc, char *argv[]) {
   signal(SIGINT, mySigintHandler);
   ros::Duration(1.0).sleep();
 
-  Parameter_t param;
-  param.config_from_ros_handle(nh_private);
-
-  // Controller controller(param);
-  // std::shared_ptr<LinearControl>    controller = std::make_shared<LinearControl>(param);
-  std::shared_ptr<GeometricControl> controller = std::make_shared<GeometricControl>(param);
-
-  PX4CtrlFSM fsm(param, std::static_pointer_cast<ControlBase>(controller));
-
-  ros::Subscriber state_sub = nh.subscribe<mavros_msgs::State>(
-      "mavros/state", 10, boost::bind(&State_Data_t::feed, &fsm.state_data, _1));
-
-  ros::Subscriber extended_state_sub = nh.subscribe<mavros_msgs::ExtendedState>(
-      "mavros/extended_state", 10,
-      boost::bind(&ExtendedState_Data_t::feed, &fsm.extended_state_data, _1));
-
-  ros::Subscriber odom_sub = nh.subscribe<nav_msgs::Odometry>(
-      "odom", 100, boost::bind(&Odom_Data_t::feed, &fsm.odom_data, _1), ros::VoidConstPtr(),
-      ros::TransportHints().tcpNoDelay());
-
-  ros::Subscriber cmd_sub = nh.subscribe<quadrotor_msgs::PositionCommand>(
-      "cmd", 100, boost::bind(&Command_Data_t::feed, &fsm.cmd_data, _1), ros::VoidConstPtr(),
-      ros::TransportHints().tcpNoDelay());
-
-  ros::Subscriber imu_sub = nh.subscribe<sensor_msgs::Imu>(
-      "mavros/imu/data",  // Note: do NOT change it to mavros/imu/data_raw !!!
-      100, boost::bind(&Imu_Data_t::feed, &fsm.imu_data, _1), ros::VoidConstPtr(),
-      ros::TransportHints().tcpNoDelay());
-
-  ros::Subscriber rc_sub;
-  if (!param.takeoff_land
-           .no_RC)  // mavros will still publish wrong rc messages although no RC is connected
-  {
-    rc_sub = nh.subscribe<mavros_msgs::RCIn>("mavros/rc/in", 10,
-                                             boost::bind(&RC_Data_t::feed, &fsm.rc_data, _1));
-  }
-
-  ros::Subscriber bat_sub = nh.subscribe<sensor_msgs::BatteryState>(
-      "mavros/battery", 100, boost::bind(&Battery_Data_t::feed, &fsm.bat_data, _1),
-      ros::VoidConstPtr(), ros::TransportHints().tcpNoDelay());
-
-  ros::Subscriber takeoff_land_sub = nh.subscribe<quadrotor_msgs::TakeoffLand>(
-      "/px4ctrl/takeoff_land", 100,
-      boost::bind(&Takeoff_Land_Data_t::feed, &fsm.takeoff_land_data, _1), ros::VoidConstPtr(),
-      ros::TransportHints().tcpNoDelay());
-
-  fsm.ctrl_FCU_pub = nh.advertise<mavros_msgs::AttitudeTarget>("mavros/setpoint_raw/attitude", 10);
-  fsm.traj_start_trigger_pub = nh.advertise<geometry_msgs::PoseStamped>("/traj_start_trigger", 10);
-
-  fsm.debug_pub = nh.advertise<quadrotor_msgs::Px4ctrlDebug>("debugPx4ctrl", 10);  // debug
-
-  fsm.set_FCU_mode_srv  = nh.serviceClient<mavros_msgs::SetMode>("mavros/set_mode");
-  fsm.arming_client_srv = nh.serviceClient<mavros_msgs::CommandBool>("mavros/cmd/arming");
-  fsm.reboot_FCU_srv    = nh.serviceClient<mavros_msgs::CommandLong>("mavros/cmd/command");
+  PX4CtrlRos  px4ctrl(nh, nh_private);
+  PX4CtrlFSM &fsm = *px4ctrl.fsm;
 
   ros::Duration(0.5).sleep();
 
-  if (param.takeoff_land.no_RC) {
-    ROS_WARN("PX4CTRL] Remote controller disabled, be careful!");
-  } else {
+  if (!px4ctrl.param.takeoff_land.no_RC) {
     ROS_INFO("PX4CTRL] Waiting for RC");
     while (ros::ok()) {
       ros::spinOnce();
-      if (fsm.rc_is_received(ros::Time::now())) {
+      if (fsm.rc_is_received(fsm.clock->now())) {
         ROS_INFO("[PX4CTRL] RC received.");
         break;
       }
@@ -87,13 +33,13 @@ int main(int argc, char *argv[]) {
   }
 
   int trials = 0;
-  while (ros::ok() && !fsm.state_data.current_state.connected) {
+  while (ros::ok() && !fsm.state_data.connected) {
     ros::spinOnce();
     ros::Duration(1.0).sleep();
     if (trials++ > 5) ROS_ERROR("Unable to connnect to PX4!!!");
   }
 
-  ros::Rate r(param.ctrl_freq_max);
+  ros::Rate r(px4ctrl.param.ctrl_freq_max);
   while (ros::ok()) {
     r.sleep();
     ros::spinOnce();
@@ -0,0 +1,52 @@
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#include "px4ctrl_ros.h"
+
+namespace px4ctrl {
+
+/*
+  px4ctrl as a nodelet. Load it into the same manager as the estimator and planner nodelets so
+  odometry and position commands are handed over as shared pointers instead of going through TCP.
+  Unlike px4ctrl_node, onInit() must not block: the RC/FCU waits are done in the control timer,
+  which only polls them. process() itself never sleeps or spins, so a tick holds a manager thread
+  for no longer than its computation. That includes takeoff: the RC recenter check and the delay
+  between OFFBOARD and arming are polled on later ticks (takeoff_land.rc_recenter_pending and
+  arm_pending). A sleep there would block every nodelet on the same manager thread.
+*/
+class PX4CtrlNodelet : public nodelet::Nodelet {
+ public:
+  PX4CtrlNodelet() {}
+
+ private:
+  std::unique_ptr<PX4CtrlRos> px4ctrl_;
+  ros::Timer                  ctrl_timer_;
+  bool                        ready_{false};
+
+  void onInit() override {
+    // Single-threaded handles: sensor callbacks and process() never run concurrently
+    ros::NodeHandle &nh         = getNodeHandle();
+    ros::NodeHandle &nh_private = getPrivateNodeHandle();
+
+    px4ctrl_.reset(new PX4CtrlRos(nh, nh_private));
+
+    ctrl_timer_ = nh.createTimer(ros::Duration(1.0 / px4ctrl_->param.ctrl_freq_max),
+                                 &PX4CtrlNodelet::ctrl_timer_cb, this);
+
+    NODELET_INFO("[PX4CTRL] nodelet started, waiting for %s.",
+                 px4ctrl_->param.takeoff_land.no_RC ? "FCU" : "RC and FCU");
+  }
+
+  void ctrl_timer_cb(const ros::TimerEvent &e) {
+    if (!ready_) {
+      ready_ = px4ctrl_->fcu_ready(px4ctrl_->fsm->clock->now());
+      if (!ready_) return;
+      NODELET_INFO("[PX4CTRL] RC/FCU connected.");
+    }
+
+    px4ctrl_->fsm->process();
+  }
+};
+
+}  // namespace px4ctrl
+
+PLUGINLIB_EXPORT_CLASS(px4ctrl::PX4CtrlNodelet, nodelet::Nodelet)
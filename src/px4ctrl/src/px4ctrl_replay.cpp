@@ -0,0 +1,173 @@
+/*
+  Deterministic, faster than real time replay of a recorded flight through PX4CtrlFSM and the
+  controller.
+
+  usage: px4ctrl_replay <param.yaml> <input.bag> <output.csv> [--odom <topic>] [--cmd <topic>]
+                        [--rate <hz>] [--controller <linear|geometric|mpc>] [--linear]
+
+  Input messages are fed in bag order, each one at its record time, and process() is ticked on a
+  virtual clock at ctrl_freq_max. No ROS master is needed and nothing waits on the wall clock, so
+  a flight replays as fast as the CPU allows and two runs produce bit-identical CSV files (values
+  are printed with %.17g). FCU services are answered as accepted; the recorded mavros/state stream
+  still decides the actual FCU mode and arming state. The controller is the one of the param file,
+  --controller or --linear override it.
+*/
+
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <chrono>
+
+#include "PX4CtrlFSM.h"
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s <param.yaml> <input.bag> <output.csv> [--odom <topic>] [--cmd <topic>] "
+          "[--rate <hz>] [--controller <linear|geometric|mpc>] [--linear]\n",
+          name);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 4) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  std::string odom_topic = "/gt_iris_base_link_imu";  // same remaps as run_ctrl.launch
+  std::string cmd_topic  = "/position_cmd";
+  double      rate       = 0.0;
+  const char *ctrl_name  = nullptr;
+  bool        linear     = false;
+  for (int i = 4; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--odom" && i + 1 < argc)
+      odom_topic = argv[++i];
+    else if (arg == "--cmd" && i + 1 < argc)
+      cmd_topic = argv[++i];
+    else if (arg == "--rate" && i + 1 < argc)
+      rate = atof(argv[++i]);
+    else if (arg == "--controller" && i + 1 < argc)
+      ctrl_name = argv[++i];
+    else if (arg == "--linear")
+      linear = true;
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  Parameter_t param;
+  if (!param.config_from_yaml_file(argv[1])) return 1;
+  if (rate > 0) param.ctrl_freq_max = rate;
+  param.flight_rec.enable = false;
+  param.mav_out.enable    = false;
+
+  if (ctrl_name) param.controller = ctrl_name;
+  if (linear) param.controller = "linear";
+  std::shared_ptr<ControlBase> controller = createController(param);
+  PX4CtrlFSM                   fsm(param, controller);
+
+  // Virtual clock, nothing in the FSM or the controller reads the wall clock
+  std::shared_ptr<SimClock> sim_clock = std::make_shared<SimClock>();
+  fsm.set_clock(sim_clock);
+
+  fsm.set_FCU_mode_hook = [](mavros_msgs::SetMode &srv) {
+    srv.response.mode_sent = true;
+    return true;
+  };
+  fsm.arming_hook = [](mavros_msgs::CommandBool &srv) {
+    srv.response.success = true;
+    return true;
+  };
+  fsm.reboot_FCU_hook = [](mavros_msgs::CommandLong &srv) {
+    srv.response.success = true;
+    return true;
+  };
+
+  rosbag::Bag bag;
+  try {
+    bag.open(argv[2], rosbag::bagmode::Read);
+  } catch (const std::exception &e) {
+    fprintf(stderr, "open %s failed: %s\n", argv[2], e.what());
+    return 1;
+  }
+
+  std::vector<std::string> topics = {odom_topic,
+                                     cmd_topic,
+                                     "/mavros/state",
+                                     "/mavros/extended_state",
+                                     "/mavros/imu/data",
+                                     "/mavros/rc/in",
+                                     "/mavros/battery",
+                                     "/px4ctrl/takeoff_land"};
+  rosbag::View view(bag, rosbag::TopicQuery(topics));
+
+  FILE *out = fopen(argv[3], "w");
+  if (!out) {
+    perror("fopen");
+    return 1;
+  }
+  fprintf(out, "t,state,landed,thrust,q_w,q_x,q_y,q_z,rate_x,rate_y,rate_z,thr2acc\n");
+
+  const ros::Duration tick_period(1.0 / param.ctrl_freq_max);
+  ros::Time           next_tick;
+  bool                started = false;
+  uint64_t            ticks   = 0;
+
+  auto tick_until = [&](const ros::Time &t) {
+    while (next_tick <= t) {
+      sim_clock->set(next_tick);
+      fsm.process();
+
+      const Controller_Output_t &u = fsm.ctrl_output;
+      fprintf(out, "%.9f,%d,%d,%.17g,%.17g,%.17g,%.17g,%.17g,%.17g,%.17g,%.17g,%.17g\n",
+              next_tick.toSec(), (int)fsm.get_state(), (int)fsm.get_landed(), u.thrust, u.q.w(),
+              u.q.x(), u.q.y(), u.q.z(), u.bodyrates.x(), u.bodyrates.y(), u.bodyrates.z(),
+              controller->getThr2acc());
+
+      next_tick += tick_period;
+      ticks++;
+    }
+  };
+
+  std::chrono::steady_clock::time_point wall_start = std::chrono::steady_clock::now();
+
+  for (const rosbag::MessageInstance &m : view) {
+    const ros::Time &t = m.getTime();
+    if (!started) {
+      next_tick = t;
+      started   = true;
+    }
+    tick_until(t);
+    sim_clock->set(t);
+
+    const std::string &topic = m.getTopic();
+    if (topic == odom_topic) {
+      fsm.odom_data.feed(m.instantiate<nav_msgs::Odometry>());
+    } else if (topic == cmd_topic) {
+      fsm.cmd_data.feed(m.instantiate<quadrotor_msgs::PositionCommand>());
+    } else if (topic == "/mavros/state") {
+      fsm.state_data.feed(m.instantiate<mavros_msgs::State>());
+    } else if (topic == "/mavros/extended_state") {
+      fsm.extended_state_data.feed(m.instantiate<mavros_msgs::ExtendedState>());
+    } else if (topic == "/mavros/imu/data") {
+      fsm.imu_data.feed(m.instantiate<sensor_msgs::Imu>());
+    } else if (topic == "/mavros/rc/in") {
+      if (!param.takeoff_land.no_RC) fsm.rc_data.feed(m.instantiate<mavros_msgs::RCIn>());
+    } else if (topic == "/mavros/battery") {
+      fsm.bat_data.feed(m.instantiate<sensor_msgs::BatteryState>());
+    } else if (topic == "/px4ctrl/takeoff_land") {
+      fsm.takeoff_land_data.feed(m.instantiate<quadrotor_msgs::TakeoffLand>());
+    }
+  }
+
+  double wall =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+  double sim = ticks * tick_period.toSec();
+  fprintf(stderr, "replayed %.1f s of flight (%llu ticks) in %.3f s, %.0fx real time\n", sim,
+          (unsigned long long)ticks, wall, wall > 0 ? sim / wall : 0.0);
+
+  fclose(out);
+  bag.close();
+
+  return 0;
+}
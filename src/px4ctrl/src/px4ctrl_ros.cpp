@@ -0,0 +1,193 @@
+#include "px4ctrl_ros.h"
+
+#include <std_msgs/Float32MultiArray.h>
+#include <std_msgs/String.h>
+
+PX4CtrlRos::PX4CtrlRos(ros::NodeHandle &nh, ros::NodeHandle &nh_private,
+                       bool background_threads) {
+  param.config_from_ros_handle(nh_private);
+
+  controller = createController(param);
+
+  fsm.reset(new PX4CtrlFSM(param, controller));
+  if (param.steady_clock) fsm->set_clock(std::make_shared<SteadyClock>());
+
+  state_sub_ = nh.subscribe<mavros_msgs::State>(
+      "mavros/state", 10, boost::bind(&State_Data_t::feed, &fsm->state_data, _1));
+
+  extended_state_sub_ = nh.subscribe<mavros_msgs::ExtendedState>(
+      "mavros/extended_state", 10,
+      boost::bind(&ExtendedState_Data_t::feed, &fsm->extended_state_data, _1));
+
+  odom_sub_ = nh.subscribe<nav_msgs::Odometry>(
+      "odom", 100, boost::bind(&Odom_Data_t::feed, &fsm->odom_data, _1), ros::VoidConstPtr(),
+      ros::TransportHints().tcpNoDelay());
+
+  cmd_sub_ = nh.subscribe<quadrotor_msgs::PositionCommand>(
+      "cmd", 100, boost::bind(&Command_Data_t::feed, &fsm->cmd_data, _1), ros::VoidConstPtr(),
+      ros::TransportHints().tcpNoDelay());
+
+  imu_sub_ = nh.subscribe<sensor_msgs::Imu>(
+      "mavros/imu/data",  // Note: do NOT change it to mavros/imu/data_raw !!!
+      100, boost::bind(&Imu_Data_t::feed, &fsm->imu_data, _1), ros::VoidConstPtr(),
+      ros::TransportHints().tcpNoDelay());
+
+  if (!param.takeoff_land
+           .no_RC)  // mavros will still publish wrong rc messages although no RC is connected
+  {
+    rc_sub_ = nh.subscribe<mavros_msgs::RCIn>("mavros/rc/in", 10,
+                                              boost::bind(&RC_Data_t::feed, &fsm->rc_data, _1));
+  }
+
+  bat_sub_ = nh.subscribe<sensor_msgs::BatteryState>(
+      "mavros/battery", 100, boost::bind(&Battery_Data_t::feed, &fsm->bat_data, _1),
+      ros::VoidConstPtr(), ros::TransportHints().tcpNoDelay());
+
+  takeoff_land_sub_ = nh.subscribe<quadrotor_msgs::TakeoffLand>(
+      "px4ctrl/takeoff_land", 100,
+      boost::bind(&Takeoff_Land_Data_t::feed, &fsm->takeoff_land_data, _1), ros::VoidConstPtr(),
+      ros::TransportHints().tcpNoDelay());
+
+  fsm->ctrl_FCU_pub =
+      nh.advertise<mavros_msgs::AttitudeTarget>("mavros/setpoint_raw/attitude", 10);
+  fsm->traj_start_trigger_pub =
+      nh.advertise<geometry_msgs::PoseStamped>("traj_start_trigger", 10);
+
+  const Parameter_t::Debug &dbg = param.debug;
+  if (dbg.rate > 0 && (dbg.reference || dbg.output || dbg.thrust_model || dbg.indi)) {
+    fsm->debug_out_ptr = std::make_shared<DebugOutput>(
+        dbg, nh.advertise<quadrotor_msgs::Px4ctrlDebug>("debugPx4ctrl", 10));
+    if (background_threads) fsm->debug_out_ptr->start();
+  }
+
+  if (param.mav_out.enable) {
+    fsm->mavlink_out_ptr = std::make_shared<MavlinkSetpointOutput>(param.mav_out);
+    if (!fsm->mavlink_out_ptr->open()) {
+      ROS_ERROR("[PX4CTRL] MAVLink output unavailable, sending setpoints through mavros.");
+      fsm->mavlink_out_ptr.reset();
+    }
+  }
+
+  if (param.flight_rec.enable) {
+    fsm->recorder_ptr = std::make_shared<FlightRecorder>();
+    if (!fsm->recorder_ptr->open(param.flight_rec.path, param.flight_rec.capacity)) {
+      ROS_ERROR("[PX4CTRL] Flight recorder disabled.");
+      fsm->recorder_ptr.reset();
+    }
+  }
+
+  if (!param.thr_map.warm_start_file.empty()) {
+    fsm->thrust_store_ptr = std::make_shared<ThrustModelStore>(param.thr_map.warm_start_file);
+    if (fsm->thrust_store_ptr->load())
+      ROS_INFO("[px4ctrl] Thrust model warm start from %s", param.thr_map.warm_start_file.c_str());
+  }
+
+  if (fsm->imu_data.vibration) {
+    vibration_pub_ = nh_private.advertise<std_msgs::Float32MultiArray>("vibration", 10);
+    fsm->imu_data.vibration->on_summary =
+        boost::bind(&PX4CtrlRos::publish_vibration, this, _1);
+    if (background_threads) fsm->imu_data.vibration->start();
+  }
+
+  if (param.watchdog.enable && !background_threads) {
+    ROS_WARN("[PX4CTRL] Control watchdog disabled, it needs a thread of its own.");
+  } else if (param.watchdog.enable) {
+    stall_pub_                  = nh_private.advertise<std_msgs::String>("watchdog_stall", 10);
+    fsm->watchdog_ptr           = std::make_shared<ControlWatchdog>(
+        param, fsm->clock, fsm->ctrl_FCU_pub, fsm->mavlink_out_ptr);
+    fsm->watchdog_ptr->on_stall = boost::bind(&PX4CtrlRos::publish_stall, this, _1);
+    fsm->watchdog_ptr->start();
+  }
+
+  transition_pub_    = nh_private.advertise<std_msgs::String>("fsm_transition", 10);
+  latency_pub_       = nh_private.advertise<std_msgs::Float32MultiArray>("fsm_latency", 10, true);
+  fsm->on_transition = boost::bind(&PX4CtrlRos::publish_transition, this, _1);
+  fsm->on_latency    = boost::bind(&PX4CtrlRos::publish_latency, this);
+
+  fsm->set_FCU_mode_srv  = nh.serviceClient<mavros_msgs::SetMode>("mavros/set_mode");
+  fsm->arming_client_srv = nh.serviceClient<mavros_msgs::CommandBool>("mavros/cmd/arming");
+  fsm->reboot_FCU_srv    = nh.serviceClient<mavros_msgs::CommandLong>("mavros/cmd/command");
+
+  if (param.takeoff_land.no_RC) {
+    ROS_WARN("PX4CTRL] Remote controller disabled, be careful!");
+  }
+}
+
+PX4CtrlRos::~PX4CtrlRos() {
+  // the analyzer thread publishes through vibration_pub_, the watchdog through stall_pub_
+  if (fsm->imu_data.vibration) fsm->imu_data.vibration->stop();
+  if (fsm->watchdog_ptr) fsm->watchdog_ptr->stop();
+}
+
+/*
+  Layout of data, all float32:
+    [0, 3)    RMS of x, y, z above min_freq, m/s^2
+    [3, 4)    number of peaks n
+    [4, 8)    peak frequencies, Hz, strongest first, the first n are valid
+    [8, 12)   peak amplitudes, m/s^2
+    [12, 13)  band width, Hz
+    [13, 29)  RMS of the bands from 0 Hz up, m/s^2
+    [29, 30)  IMU samples dropped since the start, nonzero means the analyzer falls behind
+*/
+void PX4CtrlRos::publish_vibration(const VibrationSpectrum &s) {
+  std_msgs::Float32MultiArray msg;
+  msg.data.reserve(30);
+  for (int i = 0; i < 3; ++i) msg.data.push_back(s.rms[i]);
+  msg.data.push_back(s.peaks);
+  for (int i = 0; i < VibrationSpectrum::MAX_PEAKS; ++i)
+    msg.data.push_back(i < s.peaks ? s.peak_freq[i] : 0);
+  for (int i = 0; i < VibrationSpectrum::MAX_PEAKS; ++i)
+    msg.data.push_back(i < s.peaks ? s.peak_amp[i] : 0);
+  msg.data.push_back(s.band_width);
+  for (int i = 0; i < VibrationSpectrum::BANDS; ++i) msg.data.push_back(s.band_rms[i]);
+  msg.data.push_back(s.dropped);
+  vibration_pub_.publish(msg);
+}
+
+// "<stamp> <length> s, <setpoints> setpoints[, expired]"
+void PX4CtrlRos::publish_stall(const WatchdogStall &s) {
+  char buf[96];
+  snprintf(buf, sizeof(buf), "%.3f %.3f s, %d setpoints%s", s.start.toSec(), s.length,
+           s.setpoints, s.expired ? ", expired" : "");
+  std_msgs::String msg;
+  msg.data = buf;
+  stall_pub_.publish(msg);
+}
+
+// "<stamp> <from> --> <to> (<guard>) <action_us> us"
+void PX4CtrlRos::publish_transition(const FsmTransition &t) {
+  char buf[128];
+  snprintf(buf, sizeof(buf), "%.3f %s --> %s (%s) %.0f us", t.stamp.toSec(),
+           PX4CtrlFSM::state_name(t.from), PX4CtrlFSM::state_name(t.to), t.guard, t.action_us);
+  std_msgs::String msg;
+  msg.data = buf;
+  transition_pub_.publish(msg);
+}
+
+/*
+  Latched, all float32, 5 values per PX4CtrlFSM::Latency_t in the order of the enum:
+    count, last, mean, min, max, s
+*/
+void PX4CtrlRos::publish_latency() {
+  std_msgs::Float32MultiArray msg;
+  msg.data.reserve(5 * PX4CtrlFSM::LATENCY_NUM);
+  for (int k = 0; k < PX4CtrlFSM::LATENCY_NUM; ++k) {
+    const LatencyStat &l = fsm->get_latency((PX4CtrlFSM::Latency_t)k);
+    msg.data.push_back(l.count);
+    msg.data.push_back(l.last);
+    msg.data.push_back(l.mean());
+    msg.data.push_back(l.min);
+    msg.data.push_back(l.max);
+  }
+  latency_pub_.publish(msg);
+}
+
+void PX4CtrlRos::poll() {
+  if (fsm->imu_data.vibration) fsm->imu_data.vibration->analyze();
+  if (fsm->debug_out_ptr) fsm->debug_out_ptr->drain();
+}
+
+bool PX4CtrlRos::fcu_ready(const ros::Time &now_time) {
+  if (!param.takeoff_land.no_RC && !fsm->rc_is_received(now_time)) return false;
+  return fsm->state_data.connected;
+}
@@ -0,0 +1,53 @@
+#ifndef __PX4CTRL_ROS_H
+#define __PX4CTRL_ROS_H
+
+#include <ros/ros.h>
+#include "PX4CtrlFSM.h"
+
+/*
+  ROS wiring of one px4ctrl instance: parameters, controller, FSM, subscribers, publishers and
+  service clients. Shared by the standalone px4ctrl_node and the px4ctrl/PX4CtrlNodelet.
+  All callbacks take the message ConstPtr, so inside a nodelet manager odometry and commands from
+  the estimator/planner nodelets are passed without serialization or copy.
+
+  With background_threads false the vibration analyzer and debugPx4ctrl get no threads of their
+  own, the owner calls poll() instead, and the control watchdog is off (see px4ctrl_multi_node).
+*/
+class PX4CtrlRos {
+ public:
+  Parameter_t                  param;
+  std::shared_ptr<ControlBase> controller;
+  std::unique_ptr<PX4CtrlFSM>  fsm;
+
+  PX4CtrlRos(ros::NodeHandle &nh, ros::NodeHandle &nh_private, bool background_threads = true);
+  ~PX4CtrlRos();
+
+  // Non-blocking check that RC (if required) and the FCU connection are available
+  bool fcu_ready(const ros::Time &now_time);
+
+  // Without background threads: runs the vibration analyzer and drains debugPx4ctrl. Not
+  // concurrently with itself, but it may run alongside process().
+  void poll();
+
+ private:
+  ros::Subscriber state_sub_;
+  ros::Subscriber extended_state_sub_;
+  ros::Subscriber odom_sub_;
+  ros::Subscriber cmd_sub_;
+  ros::Subscriber imu_sub_;
+  ros::Subscriber rc_sub_;
+  ros::Subscriber bat_sub_;
+  ros::Subscriber takeoff_land_sub_;
+
+  ros::Publisher vibration_pub_;
+  ros::Publisher transition_pub_;
+  ros::Publisher latency_pub_;
+  ros::Publisher stall_pub_;
+
+  void publish_vibration(const VibrationSpectrum &s);
+  void publish_transition(const FsmTransition &t);
+  void publish_latency();
+  void publish_stall(const WatchdogStall &s);
+};
+
+#endif
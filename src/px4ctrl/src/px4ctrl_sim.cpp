@@ -0,0 +1,683 @@
+/*
+  Closed-loop simulation of px4ctrl against QuadrotorSim. Needs neither Gazebo, PX4 SITL nor a
+  ROS master.
+
+  usage: px4ctrl_sim <param.yaml> [--duration <s>] [--radius <m>] [--period <s>]
+                     [--latency <s>] [--noise <scale>] [--seed <n>] [--linear]
+                     [--csv <output.csv>] [--max-rmse <m>] [--warm-start <file>]
+                     [--vibration <m/s^2>] [--controller <linear|geometric|mpc>]
+                     [--wind <m/s^2>] [--record <ring file>] [--alloc-check]
+
+  The flight is: auto takeoff, a horizontal circle tracked in CMD_CTRL for --duration seconds,
+  back to AUTO_HOVER once the commands stop, auto land and disarm. SimMavros below stands in for
+  mavros: it publishes state, extended_state, odom, imu and battery from the model at their usual
+  rates, answers set_mode/arming and forwards the attitude setpoints to the emulated FCU while it
+  is in OFFBOARD. Everything runs on a SimClock, so a flight takes a fraction of a second and
+  the same seed gives the same result.
+
+  --warm-start loads and saves the thrust model like px4ctrl does with thrust_model/warm_start_file,
+  so consecutive runs behave like consecutive flights.
+
+  The controller is the one of the param file, --controller or --linear override it.
+
+  --vibration adds rotor imbalance to the accelerometer, the amplitude of one rotor at full
+  thrust, to exercise the imu_filter params.
+
+  --wind pushes the vehicle along x with a constant acceleration, a disturbance that neither the
+  controllers nor the thrust model know about, to exercise the indi params.
+
+  --record writes the flight recorder ring of the flight (flight_recorder/capacity records), for
+  px4ctrl_blackbox_export and the offline tools.
+
+  --alloc-check counts the heap allocations (malloc and everything built on it) made by the
+  callbacks and by process() in steady AUTO_HOVER and CMD_CTRL ticks, from ALLOC_WARM_UP after the
+  last transition on and leaving out the ticks that change the state. A steady tick must not
+  allocate, the flight fails otherwise and the count is printed per call site. The messages are
+  built outside the counted calls, as roscpp would deliver them. process() runs with all of its
+  outputs: the setpoints go through ctrl_FCU_hook, the way roscpp hands them to a subscriber in the
+  same process, debugPx4ctrl with every field group, the watchdog heartbeat and a flight recorder
+  ring (the --record one, or a temporary file). At least ALLOC_MIN_TICKS steady ticks must publish a
+  setpoint. Every ALLOC_HOLD_EVERY-th setpoint is held over the next tick, which must publish a copy
+  and leave the held message unchanged; those ticks are not counted. Not covered: the threads that
+  drain them, and roscpp's serialization for subscribers in other processes such as mavros, which
+  allocates inside publish(). It needs a build with -DPX4CTRL_ALLOC_CHECK=ON, see alloc_hook.h.
+
+  The exit code is 0 only if the whole flight completed, the tracking RMSE stayed below
+  --max-rmse and, with --alloc-check, no steady tick allocated, so the tool can gate CI.
+*/
+
+#include <unistd.h>
+#include <chrono>
+
+#include "PX4CtrlFSM.h"
+#include "quadrotor_sim.h"
+#ifdef PX4CTRL_ALLOC_CHECK
+#include "alloc_hook.h"
+#endif
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s <param.yaml> [--duration <s>] [--radius <m>] [--period <s>] "
+          "[--latency <s>] [--noise <scale>] [--seed <n>] [--linear] [--csv <output.csv>] "
+          "[--max-rmse <m>] [--warm-start <file>] [--vibration <m/s^2>] "
+          "[--controller <linear|geometric|mpc>] [--wind <m/s^2>] [--record <ring file>] "
+          "[--alloc-check]\n"
+          "--alloc-check needs a build with -DPX4CTRL_ALLOC_CHECK=ON. It does not cover roscpp's "
+          "serialization for subscribers in other processes (mavros), which still allocates.\n",
+          name);
+}
+
+/*
+  --alloc-check. The sites are the calls into px4ctrl, an allocation is charged to the one running,
+  and kept only if the tick turns out steady.
+*/
+enum AllocSite {
+  SITE_STATE,
+  SITE_EXTENDED_STATE,
+  SITE_ODOM,
+  SITE_IMU,
+  SITE_BATTERY,
+  SITE_CMD,
+  SITE_PROCESS,
+  SITE_NUM,
+  SITE_NONE = SITE_NUM
+};
+static const char *const ALLOC_SITE_NAMES[SITE_NUM] = {
+    "state feed", "extended_state feed", "odom feed", "imu feed", "battery feed", "cmd feed",
+    "process"};
+static const double ALLOC_WARM_UP    = 1.0;   // s after a transition before ticks count as steady
+static const int    ALLOC_HOLD_EVERY = 50;    // setpoints, see SimMavros::forward_setpoint()
+static const int    ALLOC_MIN_TICKS  = 1000;  // steady ticks that published a setpoint
+
+struct AllocCount {
+  bool     steady{false};  // set by main() for the current tick
+  uint64_t pending[SITE_NUM]{};
+  uint64_t total[SITE_NUM]{};
+  uint64_t steady_ticks{0};
+  uint64_t published_ticks{0};  // steady ticks that published a setpoint
+
+  void end_tick(bool keep, bool published) {
+    for (int i = 0; i < SITE_NUM; ++i) {
+      if (keep) total[i] += pending[i];
+      pending[i] = 0;
+    }
+    if (keep) steady_ticks++;
+    if (keep && published) published_ticks++;
+  }
+  uint64_t sum() const {
+    uint64_t n = 0;
+    for (int i = 0; i < SITE_NUM; ++i) n += total[i];
+    return n;
+  }
+};
+static AllocCount alloc_count;  // the simulation is single threaded
+
+template <typename F>
+static void counted(AllocSite site, F f) {
+#ifdef PX4CTRL_ALLOC_CHECK
+  alloc_hook_counter = alloc_count.steady ? &alloc_count.pending[site] : nullptr;
+  f();
+  alloc_hook_counter = nullptr;
+#else
+  f();
+#endif
+}
+
+/*
+  Stand-in for mavros and the FCU side of it. Call step() once per physics step.
+*/
+class SimMavros {
+ public:
+  static constexpr uint64_t PHYSICS_STEP_NS = 1000000;  // 1 kHz
+
+  SimMavros(PX4CtrlFSM &fsm, QuadrotorSim &sim, std::shared_ptr<SimClock> clock)
+      : fsm_(fsm)
+      , sim_(sim)
+      , clock_(clock)
+      , mode_("MANUAL")
+      , steps_(0) {
+    fsm_.set_FCU_mode_hook = [this](mavros_msgs::SetMode &srv) {
+      mode_                  = srv.request.custom_mode;
+      srv.response.mode_sent = true;
+      publish_state();
+      return true;
+    };
+    fsm_.arming_hook = [this](mavros_msgs::CommandBool &srv) {
+      // Like PX4, refuse to disarm in the air
+      srv.response.success = srv.request.value || sim_.on_ground();
+      if (srv.response.success) sim_.set_armed(srv.request.value);
+      publish_state();
+      return true;
+    };
+    fsm_.reboot_FCU_hook = [](mavros_msgs::CommandLong &srv) {
+      srv.response.success = false;
+      return true;
+    };
+    fsm_.ctrl_FCU_hook = [this](const mavros_msgs::AttitudeTargetConstPtr &msg) {
+      setpoint_ = msg;
+    };
+  }
+
+  void step() {
+    sim_.step(PHYSICS_STEP_NS * 1e-9);
+    steps_++;
+    clock_->set(now());
+
+    if (steps_ % 5 == 0) publish_imu();       // 200 Hz
+    if (steps_ % 10 == 0) publish_odom();     // 100 Hz
+    if (steps_ % 100 == 0) {                  // 10 Hz
+      publish_extended_state();
+      publish_battery();
+    }
+    if (steps_ % 1000 == 0) publish_state();  // 1 Hz, and on every change
+  }
+
+  /*
+    Forward what the FSM sent in its last process(), as mavros/setpoint_raw/attitude would, and
+    release the message like a subscriber callback that has returned. With hold_every, every
+    hold_every-th message is kept over the next process() instead, like a subscriber in this
+    process that lags behind. That process() must publish a copy and leave the held one alone.
+  */
+  void forward_setpoint() {
+    if (held_) {
+      if (!same_setpoint(*held_, held_copy_)) held_changed_++;
+      held_.reset();
+    }
+
+    mavros_msgs::AttitudeTargetConstPtr msg;
+    msg.swap(setpoint_);
+    if (msg && hold_every_ && ++forwarded_ % hold_every_ == 0) {
+      held_      = msg;
+      held_copy_ = *msg;
+      held_n_++;
+    }
+    if (!msg || mode_ != "OFFBOARD") return;
+    if (msg->type_mask & mavros_msgs::AttitudeTarget::IGNORE_ATTITUDE)
+      sim_.set_bodyrate_target(
+          Eigen::Vector3d(msg->body_rate.x, msg->body_rate.y, msg->body_rate.z), msg->thrust);
+    else
+      sim_.set_attitude_target(Eigen::Quaterniond(msg->orientation.w, msg->orientation.x,
+                                                  msg->orientation.y, msg->orientation.z),
+                               msg->thrust);
+  }
+
+  ros::Time now() const {
+    ros::Time t;
+    t.fromNSec(START_NS + steps_ * PHYSICS_STEP_NS);
+    return t;
+  }
+
+  uint64_t           steps() const { return steps_; }
+  const std::string &mode() const { return mode_; }
+
+  bool     published() const { return (bool)setpoint_; }  // by the last process()
+  bool     holding() const { return (bool)held_; }         // over the last process()
+  void     set_hold_every(int n) { hold_every_ = n; }
+  uint64_t held() const { return held_n_; }
+  uint64_t held_changed() const { return held_changed_; }
+
+ private:
+  // Start well away from zero, a zero rcv_stamp means "never received"
+  static constexpr uint64_t START_NS = 1000000000000ULL;
+
+  PX4CtrlFSM               &fsm_;
+  QuadrotorSim             &sim_;
+  std::shared_ptr<SimClock> clock_;
+  std::string               mode_;
+  uint64_t                  steps_;
+
+  mavros_msgs::AttitudeTargetConstPtr setpoint_;  // of the last process()
+
+  int                                 hold_every_{0};
+  uint64_t                            forwarded_{0};
+  mavros_msgs::AttitudeTargetConstPtr held_;
+  mavros_msgs::AttitudeTarget         held_copy_;
+  uint64_t                            held_n_{0}, held_changed_{0};
+
+  static bool same_setpoint(const mavros_msgs::AttitudeTarget &a,
+                            const mavros_msgs::AttitudeTarget &b) {
+    return a.header.stamp == b.header.stamp && a.type_mask == b.type_mask &&
+           a.orientation.w == b.orientation.w && a.orientation.x == b.orientation.x &&
+           a.orientation.y == b.orientation.y && a.orientation.z == b.orientation.z &&
+           a.body_rate.x == b.body_rate.x && a.body_rate.y == b.body_rate.y &&
+           a.body_rate.z == b.body_rate.z && a.thrust == b.thrust;
+  }
+
+  void publish_state() {
+    mavros_msgs::StatePtr msg = boost::make_shared<mavros_msgs::State>();
+    msg->header.stamp         = now();
+    msg->connected            = true;
+    msg->armed                = sim_.armed();
+    msg->mode                 = mode_;
+    counted(SITE_STATE, [&]() { fsm_.state_data.feed(msg); });
+  }
+
+  void publish_extended_state() {
+    mavros_msgs::ExtendedStatePtr msg = boost::make_shared<mavros_msgs::ExtendedState>();
+    msg->header.stamp                 = now();
+    msg->landed_state = sim_.on_ground() ? mavros_msgs::ExtendedState::LANDED_STATE_ON_GROUND
+                                         : mavros_msgs::ExtendedState::LANDED_STATE_IN_AIR;
+    counted(SITE_EXTENDED_STATE, [&]() { fsm_.extended_state_data.feed(msg); });
+  }
+
+  void publish_odom() {
+    Eigen::Vector3d    p, v, w;
+    Eigen::Quaterniond q;
+    sim_.sample_odom(p, v, q, w);
+
+    nav_msgs::OdometryPtr msg    = boost::make_shared<nav_msgs::Odometry>();
+    msg->header.stamp            = now();
+    msg->header.frame_id         = "world";
+    msg->pose.pose.position.x    = p.x();
+    msg->pose.pose.position.y    = p.y();
+    msg->pose.pose.position.z    = p.z();
+    msg->pose.pose.orientation.w = q.w();
+    msg->pose.pose.orientation.x = q.x();
+    msg->pose.pose.orientation.y = q.y();
+    msg->pose.pose.orientation.z = q.z();
+    msg->twist.twist.linear.x    = v.x();
+    msg->twist.twist.linear.y    = v.y();
+    msg->twist.twist.linear.z    = v.z();
+    msg->twist.twist.angular.x   = w.x();
+    msg->twist.twist.angular.y   = w.y();
+    msg->twist.twist.angular.z   = w.z();
+    counted(SITE_ODOM, [&]() { fsm_.odom_data.feed(msg); });
+  }
+
+  void publish_imu() {
+    Eigen::Vector3d    w, a;
+    Eigen::Quaterniond q;
+    sim_.sample_imu(q, w, a);
+
+    sensor_msgs::ImuPtr msg    = boost::make_shared<sensor_msgs::Imu>();
+    msg->header.stamp          = now();
+    msg->orientation.w         = q.w();
+    msg->orientation.x         = q.x();
+    msg->orientation.y         = q.y();
+    msg->orientation.z         = q.z();
+    msg->angular_velocity.x    = w.x();
+    msg->angular_velocity.y    = w.y();
+    msg->angular_velocity.z    = w.z();
+    msg->linear_acceleration.x = a.x();
+    msg->linear_acceleration.y = a.y();
+    msg->linear_acceleration.z = a.z();
+    counted(SITE_IMU, [&]() { fsm_.imu_data.feed(msg); });
+    // px4ctrl runs it on a background thread, here it follows the simulated time
+    if (fsm_.imu_data.vibration) fsm_.imu_data.vibration->analyze();
+  }
+
+  void publish_battery() {
+    const QuadrotorSim::Params &prm = sim_.params();
+
+    sensor_msgs::BatteryStatePtr msg = boost::make_shared<sensor_msgs::BatteryState>();
+    msg->header.stamp                = now();
+    msg->voltage                     = sim_.battery_voltage();
+    msg->current                     = sim_.battery_current();
+    msg->percentage                  = sim_.battery_charge();
+    msg->cell_voltage.assign(prm.battery_cells, sim_.battery_voltage() / prm.battery_cells);
+    counted(SITE_BATTERY, [&]() { fsm_.bat_data.feed(msg); });
+  }
+};
+
+static quadrotor_msgs::PositionCommandPtr make_command(const CircleReference &ref,
+                                                       const ros::Time       &stamp) {
+  Eigen::Vector3d p, v, a;
+  ref.sample(p, v, a);
+
+  quadrotor_msgs::PositionCommandPtr msg = boost::make_shared<quadrotor_msgs::PositionCommand>();
+  msg->header.stamp                      = stamp;
+  msg->position.x                        = p.x();
+  msg->position.y                        = p.y();
+  msg->position.z                        = p.z();
+  msg->velocity.x                        = v.x();
+  msg->velocity.y                        = v.y();
+  msg->velocity.z                        = v.z();
+  msg->acceleration.x                    = a.x();
+  msg->acceleration.y                    = a.y();
+  msg->acceleration.z                    = a.z();
+  msg->jerk.x                            = 0;
+  msg->jerk.y                            = 0;
+  msg->jerk.z                            = 0;
+  msg->yaw                               = 0;
+  msg->yaw_dot                           = 0;
+  return msg;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  double      duration  = 20.0;
+  double      radius    = 1.5;
+  double      period    = 6.0;
+  double      latency   = -1;
+  double      noise     = 1.0;
+  uint32_t    seed      = 0;
+  bool        linear    = false;
+  double      max_rmse  = 0.2;
+  const char *csv_path  = nullptr;
+  const char *warm_path = nullptr;
+  double      vibration = 0;
+  const char *ctrl_name = nullptr;
+  double      wind      = 0;
+  const char *rec_path  = nullptr;
+  bool        alloc     = false;
+  for (int i = 2; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--duration" && i + 1 < argc)
+      duration = atof(argv[++i]);
+    else if (arg == "--radius" && i + 1 < argc)
+      radius = atof(argv[++i]);
+    else if (arg == "--period" && i + 1 < argc)
+      period = atof(argv[++i]);
+    else if (arg == "--latency" && i + 1 < argc)
+      latency = atof(argv[++i]);
+    else if (arg == "--noise" && i + 1 < argc)
+      noise = atof(argv[++i]);
+    else if (arg == "--seed" && i + 1 < argc)
+      seed = strtoul(argv[++i], nullptr, 10);
+    else if (arg == "--linear")
+      linear = true;
+    else if (arg == "--csv" && i + 1 < argc)
+      csv_path = argv[++i];
+    else if (arg == "--max-rmse" && i + 1 < argc)
+      max_rmse = atof(argv[++i]);
+    else if (arg == "--warm-start" && i + 1 < argc)
+      warm_path = argv[++i];
+    else if (arg == "--vibration" && i + 1 < argc)
+      vibration = atof(argv[++i]);
+    else if (arg == "--controller" && i + 1 < argc)
+      ctrl_name = argv[++i];
+    else if (arg == "--wind" && i + 1 < argc)
+      wind = atof(argv[++i]);
+    else if (arg == "--record" && i + 1 < argc)
+      rec_path = argv[++i];
+    else if (arg == "--alloc-check")
+      alloc = true;
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+#ifndef PX4CTRL_ALLOC_CHECK
+  if (alloc) {
+    fprintf(stderr, "--alloc-check needs a build with -DPX4CTRL_ALLOC_CHECK=ON\n");
+    return 1;
+  }
+#endif
+
+  Parameter_t param;
+  if (!param.config_from_yaml_file(argv[1])) return 1;
+  param.flight_rec.enable            = false;
+  param.mav_out.enable               = false;
+  param.takeoff_land.enable          = true;
+  param.takeoff_land.enable_auto_arm = true;
+  param.takeoff_land.no_RC           = true;
+
+  // The vehicle matches the param file, except for what px4ctrl has to estimate itself
+  QuadrotorSim::Params sim_prm;
+  sim_prm.mass            = param.mass;
+  sim_prm.gra             = param.gra;
+  sim_prm.K1              = param.thr_map.K1;
+  sim_prm.K2              = param.thr_map.K2;
+  sim_prm.K3              = param.thr_map.K3;
+  sim_prm.odom_pos_noise  = 0.005 * noise;
+  sim_prm.odom_vel_noise  = 0.02 * noise;
+  sim_prm.gyro_noise      = 0.01 * noise;
+  sim_prm.accel_noise     = 0.2 * noise;
+  sim_prm.vibration_accel = vibration;
+  sim_prm.wind            = Eigen::Vector3d(wind, 0, 0);
+  if (latency >= 0) sim_prm.setpoint_latency = latency;
+  QuadrotorSim sim(sim_prm, seed);
+
+  if (alloc) {  // every debugPx4ctrl field group, at most at the control rate
+    if (param.debug.rate <= 0) param.debug.rate = param.ctrl_freq_max;
+    param.debug.reference    = true;
+    param.debug.output       = true;
+    param.debug.thrust_model = true;
+    param.debug.indi         = true;
+  }
+
+  if (ctrl_name) param.controller = ctrl_name;
+  if (linear) param.controller = "linear";
+  std::shared_ptr<ControlBase> controller = createController(param);
+  PX4CtrlFSM                   fsm(param, controller);
+  if (warm_path) {
+    fsm.thrust_store_ptr = std::make_shared<ThrustModelStore>(warm_path);
+    fsm.thrust_store_ptr->load();
+  }
+  if (rec_path) {
+    fsm.recorder_ptr = std::make_shared<FlightRecorder>();
+    if (!fsm.recorder_ptr->open(rec_path, param.flight_rec.capacity)) return 1;
+  }
+
+  std::shared_ptr<SimClock> sim_clock = std::make_shared<SimClock>();
+  fsm.set_clock(sim_clock);
+  SimMavros mavros(fsm, sim, sim_clock);
+
+  if (alloc) {
+    mavros.set_hold_every(ALLOC_HOLD_EVERY);
+    // Drained below instead of on a thread, without a publisher
+    fsm.debug_out_ptr = std::make_shared<DebugOutput>(param.debug, ros::Publisher());
+    // Beaten but not started, its thread would read the SimClock
+    fsm.watchdog_ptr = std::make_shared<ControlWatchdog>(param, sim_clock, ros::Publisher(),
+                                                         std::shared_ptr<MavlinkSetpointOutput>());
+    if (!fsm.recorder_ptr) {  // a ring nobody keeps
+      char tmp[] = "/tmp/px4ctrl_sim_XXXXXX";
+      int  fd    = mkstemp(tmp);
+      if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+      }
+      close(fd);
+      unlink(tmp);
+      fsm.recorder_ptr = std::make_shared<FlightRecorder>();
+      bool ok          = fsm.recorder_ptr->open(tmp, param.flight_rec.capacity);
+      unlink(tmp);
+      if (!ok) return 1;
+    }
+  }
+
+  FILE *csv = nullptr;
+  if (csv_path) {
+    csv = fopen(csv_path, "w");
+    if (!csv) {
+      perror("fopen");
+      return 1;
+    }
+    fprintf(csv, "t,state,x,y,z,vx,vy,vz,cmd_x,cmd_y,cmd_z,thrust,thr2acc,volt\n");
+  }
+
+  enum Phase { WAIT, TAKEOFF, TRACK, RETURN_HOVER, LAND, DONE };
+  Phase  phase      = WAIT;
+  double phase_time = 0;  // sim time of the last phase change
+
+  std::unique_ptr<CircleReference>   circle;
+  quadrotor_msgs::PositionCommandPtr cmd;
+  double                             err2_sum = 0, err_max = 0;
+  uint64_t                           err_n    = 0;
+  VibrationSpectrum                  vib;  // at the end of the circle
+  bool                               have_vib = false;
+
+  const uint64_t tick_ns    = (uint64_t)(1e9 / param.ctrl_freq_max);
+  const double   time_limit = duration + 60.0;
+  uint64_t       next_tick  = mavros.now().toNSec();
+  uint64_t       ticks      = 0;
+
+  std::chrono::steady_clock::time_point wall_start = std::chrono::steady_clock::now();
+
+  while (phase != DONE && sim.time() < time_limit) {
+    PX4CtrlFSM::State_t state = fsm.get_state();
+    if (alloc) {
+      const FsmTrace &trace = fsm.get_trace();
+      alloc_count.steady =
+          (state == PX4CtrlFSM::AUTO_HOVER || state == PX4CtrlFSM::CMD_CTRL) && trace.size() &&
+          (mavros.now() - trace[trace.size() - 1].stamp).toSec() > ALLOC_WARM_UP;
+    }
+
+    mavros.step();
+    const double t = sim.time();
+
+    // Mission script, the role of the planner and the operator
+    switch (phase) {
+      case WAIT:
+        if (t > 1.0) {
+          quadrotor_msgs::TakeoffLandPtr msg = boost::make_shared<quadrotor_msgs::TakeoffLand>();
+          msg->takeoff_land_cmd              = quadrotor_msgs::TakeoffLand::TAKEOFF;
+          fsm.takeoff_land_data.feed(msg);
+          phase      = TAKEOFF;
+          phase_time = t;
+        }
+        break;
+      case TAKEOFF:
+        if (state != PX4CtrlFSM::AUTO_HOVER) {
+          phase_time = t;
+        } else if (t - phase_time > AutoTakeoffLand_t::DELAY_TRIGGER_TIME + 1.0) {
+          // px4ctrl has sent the trajectory start trigger, the planner starts now
+          circle.reset(new CircleReference(sim.position(), radius, period, duration));
+          phase      = TRACK;
+          phase_time = t;
+        }
+        break;
+      case TRACK:
+        circle->step(SimMavros::PHYSICS_STEP_NS * 1e-9);
+        if (mavros.steps() % 10 == 0) {  // 100 Hz
+          cmd = make_command(*circle, mavros.now());
+          counted(SITE_CMD, [&]() { fsm.cmd_data.feed(cmd); });
+        }
+        if (state == PX4CtrlFSM::CMD_CTRL && cmd) {
+          double err = (sim.position() - Eigen::Vector3d(cmd->position.x, cmd->position.y,
+                                                         cmd->position.z))
+                           .norm();
+          err2_sum += err * err;
+          err_max = std::max(err_max, err);
+          err_n++;
+        }
+        if (circle->finished()) {
+          have_vib   = fsm.imu_data.vibration && fsm.imu_data.vibration->latest(vib);
+          phase      = RETURN_HOVER;
+          phase_time = t;
+        }
+        break;
+      case RETURN_HOVER:
+        if (state == PX4CtrlFSM::AUTO_HOVER && t - phase_time > 3.0) {
+          quadrotor_msgs::TakeoffLandPtr msg = boost::make_shared<quadrotor_msgs::TakeoffLand>();
+          msg->takeoff_land_cmd              = quadrotor_msgs::TakeoffLand::LAND;
+          fsm.takeoff_land_data.feed(msg);
+          phase      = LAND;
+          phase_time = t;
+        }
+        break;
+      case LAND:
+        if (state == PX4CtrlFSM::MANUAL_CTRL && !sim.armed()) phase = DONE;
+        break;
+      case DONE:
+        break;
+    }
+
+    // px4ctrl_node's loop
+    if (mavros.now().toNSec() >= next_tick) {
+      counted(SITE_PROCESS, [&]() { fsm.process(); });
+      // A tick with a held message copies it on purpose, see SimMavros::forward_setpoint()
+      if (alloc)
+        alloc_count.end_tick(alloc_count.steady && fsm.get_state() == state && !mavros.holding(),
+                             mavros.published());
+      mavros.forward_setpoint();
+      if (fsm.debug_out_ptr) fsm.debug_out_ptr->drain();
+      next_tick += tick_ns;
+      ticks++;
+
+      if (csv) {
+        const Eigen::Vector3d &p = sim.position();
+        const Eigen::Vector3d &v = sim.velocity();
+        fprintf(csv, "%.6f,%d,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g\n", t,
+                (int)fsm.get_state(), p.x(), p.y(), p.z(), v.x(), v.y(), v.z(),
+                cmd ? cmd->position.x : 0.0, cmd ? cmd->position.y : 0.0,
+                cmd ? cmd->position.z : 0.0, fsm.ctrl_output.thrust, controller->getThr2acc(),
+                sim.battery_voltage());
+      }
+    }
+  }
+
+  double wall =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+  double rmse = err_n ? std::sqrt(err2_sum / err_n) : 0.0;
+
+  if (csv) fclose(csv);
+
+  printf("\nsimulated %.1f s (%llu control ticks) in %.3f s, %.0fx real time\n", sim.time(),
+         (unsigned long long)ticks, wall, wall > 0 ? sim.time() / wall : 0.0);
+  printf("tracking: rmse %.3f m, max %.3f m over %.1f s in CMD_CTRL\n", rmse, err_max,
+         err_n * SimMavros::PHYSICS_STEP_NS * 1e-9);
+  printf("battery: %.2f V, %.0f%% left\n", sim.battery_voltage(), sim.battery_charge() * 100);
+  if (MpcControl *mpc = dynamic_cast<MpcControl *>(controller.get()))
+    printf("mpc: solve %.1f us mean, %.1f us worst, %d ticks stopped on max_iter\n",
+           mpc->meanSolveTime() * 1e6, mpc->worstSolveTime() * 1e6, mpc->cappedSolves());
+  if (have_vib) {
+    printf("vibration: rms %.2f %.2f %.2f m/s^2", vib.rms[0], vib.rms[1], vib.rms[2]);
+    for (int i = 0; i < vib.peaks; ++i)
+      printf(", %.3g m/s^2 at %.1f Hz", vib.peak_amp[i], vib.peak_freq[i]);
+    printf("\n");
+  }
+
+  // FSM transitions and the latencies between requests and their outcomes, in sim time
+  const double   t0    = mavros.now().toSec() - sim.time();
+  const FsmTrace &trace = fsm.get_trace();
+  for (int i = 0; i < trace.size(); ++i)
+    printf("fsm: %7.3f s %s --> %s (%s)\n", trace[i].stamp.toSec() - t0,
+           PX4CtrlFSM::state_name(trace[i].from), PX4CtrlFSM::state_name(trace[i].to),
+           trace[i].guard);
+  printf("process: setpoint %.1f us mean, %.1f us worst after the tick start, supervisor %.1f us "
+         "mean, %.1f us worst\n",
+         fsm.get_fast_time().mean() * 1e6, fsm.get_fast_time().max * 1e6,
+         fsm.get_supervisor_time().mean() * 1e6, fsm.get_supervisor_time().max * 1e6);
+  for (int k = 0; k < PX4CtrlFSM::LATENCY_NUM; ++k) {
+    const LatencyStat &l = fsm.get_latency((PX4CtrlFSM::Latency_t)k);
+    if (l.count) printf("latency: %s %.3f s\n", PX4CtrlFSM::latency_name(k), l.mean());
+  }
+
+  if (alloc) {
+    printf("alloc-check: %llu heap allocations in %llu steady ticks (%llu published), %llu "
+           "setpoints held over a tick, %llu of them modified",
+           (unsigned long long)alloc_count.sum(), (unsigned long long)alloc_count.steady_ticks,
+           (unsigned long long)alloc_count.published_ticks, (unsigned long long)mavros.held(),
+           (unsigned long long)mavros.held_changed());
+    for (int i = 0; i < SITE_NUM; ++i)
+      if (alloc_count.total[i])
+        printf(", %s %llu", ALLOC_SITE_NAMES[i], (unsigned long long)alloc_count.total[i]);
+    printf("\n");
+  }
+
+  bool ok = true;
+  if (phase != DONE) {
+    printf("FAIL: flight did not complete (stuck in phase %d, FSM state %d)\n", (int)phase,
+           (int)fsm.get_state());
+    ok = false;
+  }
+  if (err_n == 0) {
+    printf("FAIL: never reached CMD_CTRL\n");
+    ok = false;
+  } else if (rmse > max_rmse) {
+    printf("FAIL: rmse %.3f m > %.3f m\n", rmse, max_rmse);
+    ok = false;
+  }
+  if (alloc && alloc_count.published_ticks < (uint64_t)ALLOC_MIN_TICKS) {
+    printf("FAIL: alloc-check saw %llu steady ticks that published, fewer than %d\n",
+           (unsigned long long)alloc_count.published_ticks, ALLOC_MIN_TICKS);
+    ok = false;
+  } else if (alloc && alloc_count.sum()) {
+    printf("FAIL: steady ticks allocate\n");
+    ok = false;
+  }
+  if (alloc && mavros.held_changed()) {
+    printf("FAIL: %llu held setpoints were modified by the next process()\n",
+           (unsigned long long)mavros.held_changed());
+    ok = false;
+  }
+  if (ok) printf("PASS\n");
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,382 @@
+/*
+  Monte Carlo tuning of the position/velocity gains (gain/Kp0~2, gain/Kv0~2) in simulation.
+
+  usage: px4ctrl_tune <param.yaml> <output.yaml> [--generations <n>] [--population <n>]
+                      [--flights <n>] [--threads <n>] [--seed <n>] [--linear]
+
+  Every candidate gain set flies the same --flights randomized circle-tracking flights on
+  QuadrotorSim (mass, drag, motor lag, setpoint latency, sensor noise, battery charge and the
+  circle itself are drawn per flight), with the controller called directly at ctrl_freq_max, no
+  FSM in the loop. The cost of a candidate is
+      mean(RMSE) + 0.5 * max(RMSE) + 10 * (fraction of flights that diverged)
+  and CMA-ES searches the gains in log space, starting from the gains of the param file. Flights
+  run in parallel on a work-stealing pool, and the result does not depend on the thread count.
+
+  The output is the input param file with the gains replaced, ready for roslaunch. The baseline
+  and the tuned gains are finally compared on a separate set of flights. If the tuned gains do not
+  beat the baseline there, the output keeps the gains of the input and the exit status is 2.
+*/
+
+#include <chrono>
+#include <fstream>
+#include <regex>
+#include <sstream>
+
+#include "controller.h"
+#include "quadrotor_sim.h"
+#include "work_stealing_pool.h"
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s <param.yaml> <output.yaml> [--generations <n>] [--population <n>] "
+          "[--flights <n>] [--threads <n>] [--seed <n>] [--linear]\n",
+          name);
+}
+
+static const int   NUM_GAINS             = 6;
+static const char *GAIN_NAMES[NUM_GAINS] = {"Kp0", "Kp1", "Kp2", "Kv0", "Kv1", "Kv2"};
+
+typedef Eigen::Matrix<double, NUM_GAINS, 1>         GainVector;
+typedef Eigen::Matrix<double, NUM_GAINS, NUM_GAINS> GainMatrix;
+
+static GainVector get_gains(const Parameter_t::Gain &g) {
+  GainVector k;
+  k << g.Kp0, g.Kp1, g.Kp2, g.Kv0, g.Kv1, g.Kv2;
+  return k;
+}
+
+static void set_gains(Parameter_t::Gain &g, const GainVector &k) {
+  g.Kp0 = k(0);
+  g.Kp1 = k(1);
+  g.Kp2 = k(2);
+  g.Kv0 = k(3);
+  g.Kv1 = k(4);
+  g.Kv2 = k(5);
+}
+
+// One randomized flight, drawn from its own seed so that it is the same for every candidate
+struct Scenario {
+  uint32_t             seed;
+  QuadrotorSim::Params sim;
+  double               radius, period;
+
+  Scenario(const Parameter_t &param, uint32_t seed_)
+      : seed(seed_) {
+    std::mt19937                           rng(seed);
+    std::uniform_real_distribution<double> U(0.0, 1.0);
+
+    sim.mass                = param.mass * (0.8 + 0.4 * U(rng));
+    sim.gra                 = param.gra;
+    sim.K1                  = param.thr_map.K1;
+    sim.K2                  = param.thr_map.K2;
+    sim.K3                  = param.thr_map.K3;
+    sim.drag                = Eigen::Vector3d(1, 1, 0.5) * (0.5 * U(rng));
+    sim.motor_time_constant = 0.02 + 0.04 * U(rng);
+    sim.setpoint_latency    = 0.005 + 0.035 * U(rng);
+    sim.initial_charge      = 0.4 + 0.6 * U(rng);
+    double noise            = 0.5 + U(rng);
+    sim.odom_pos_noise      = 0.005 * noise;
+    sim.odom_vel_noise      = 0.02 * noise;
+    sim.gyro_noise          = 0.01 * noise;
+    sim.accel_noise         = 0.2 * noise;
+    radius                  = 0.5 + 1.5 * U(rng);
+    period                  = 3.0 + 5.0 * U(rng);
+  }
+};
+
+struct FlightResult {
+  double rmse;
+  bool   diverged;
+};
+
+/*
+  Hover for 1 s, track the circle for 10 s, hover for 1 s. Sensors and the controller run at
+  their usual rates on top of the 1 kHz physics.
+*/
+static FlightResult fly(const Parameter_t &base, const GainVector &k, const Scenario &sc,
+                        bool linear) {
+  const double DIVERGED_ERR = 3.0;
+
+  Parameter_t param = base;
+  set_gains(param.gain, k);
+
+  std::shared_ptr<ControlBase> controller;
+  if (linear)
+    controller = std::make_shared<LinearControl>(param);
+  else
+    controller = std::make_shared<GeometricControl>(param);
+
+  QuadrotorSim sim(sc.sim, sc.seed);
+  sim.reset(Eigen::Vector3d(0, 0, 1.5), 0.0, true);
+  CircleReference circle(sim.position(), sc.radius, sc.period, 10.0);
+
+  Odom_Data_t     odom;
+  Imu_Data_t      imu;
+  Desired_State_t des;
+  if (param.imu_filter.enable)
+    imu.a_filter.configure(param.imu_filter.sample_rate, param.imu_filter.lpf_cutoff,
+                           param.imu_filter.notch_num, param.imu_filter.notch_freq,
+                           param.imu_filter.notch_q);
+  des.j.setZero();
+  des.yaw      = 0;
+  des.yaw_rate = 0;
+
+  const uint64_t step_ns   = 1000000;
+  const uint64_t tick_ns   = (uint64_t)(1e9 / param.ctrl_freq_max);
+  const uint64_t t0_ns     = 1000000000000ULL;
+  uint64_t       next_tick = 0;
+  double         err2_sum  = 0;
+  uint64_t       err_n     = 0;
+
+  for (uint64_t n = 1; n <= 12000; ++n) {
+    sim.step(step_ns * 1e-9);
+    if (n > 1000 && !circle.finished()) circle.step(step_ns * 1e-9);
+    uint64_t t_ns = n * step_ns;
+
+    if (n % 10 == 0) sim.sample_odom(odom.p, odom.v, odom.q, odom.w);
+    if (n % 5 == 0) {
+      sim.sample_imu(imu.q, imu.w, imu.a);
+      imu.a_filt = imu.a_filter.apply(imu.a);
+    }
+    if (n < 10) continue;  // no odom yet
+
+    circle.sample(des.p, des.v, des.a);
+    double err = (sim.position() - des.p).norm();
+    if (!(err < DIVERGED_ERR) || sim.position().z() < 0.05) return {DIVERGED_ERR, true};
+    err2_sum += err * err;
+    err_n++;
+
+    if (t_ns >= next_tick) {
+      ros::Time now;
+      now.fromNSec(t0_ns + t_ns);
+      Controller_Output_t u;
+      controller->estimateThrustModel(imu.a_filt, sim.battery_voltage(), now, param);
+      controller->calculateControl(des, odom, imu, now, u);
+      sim.set_attitude_target(u.q, u.thrust);
+      next_tick = t_ns + tick_ns;
+    }
+  }
+
+  return {std::sqrt(err2_sum / err_n), false};
+}
+
+static double cost(const std::vector<FlightResult> &r) {
+  double sum = 0, worst = 0, diverged = 0;
+  for (const FlightResult &f : r) {
+    sum += f.rmse;
+    worst = std::max(worst, f.rmse);
+    diverged += f.diverged;
+  }
+  return sum / r.size() + 0.5 * worst + 10.0 * diverged / r.size();
+}
+
+// Costs of all candidates, every (candidate, flight) pair is one task
+typedef std::vector<GainVector, Eigen::aligned_allocator<GainVector>> GainVectors;
+
+static std::vector<double> evaluate(WorkStealingPool            &pool,
+                                    const Parameter_t           &param,
+                                    const GainVectors           &k,
+                                    const std::vector<Scenario> &scenarios,
+                                    bool                         linear) {
+  std::vector<std::vector<FlightResult>> results(k.size(),
+                                                 std::vector<FlightResult>(scenarios.size()));
+  for (size_t c = 0; c < k.size(); ++c) {
+    for (size_t s = 0; s < scenarios.size(); ++s) {
+      pool.submit([&, c, s] { results[c][s] = fly(param, k[c], scenarios[s], linear); });
+    }
+  }
+  pool.wait_idle();
+
+  std::vector<double> costs(k.size());
+  for (size_t c = 0; c < k.size(); ++c) costs[c] = cost(results[c]);
+  return costs;
+}
+
+// Replace the gain values in the text of the param file, keeping its layout and comments
+static bool write_param_file(const std::string &in_path, const std::string &out_path,
+                             const GainVector &k, const std::string &note) {
+  std::ifstream in(in_path);
+  if (!in) return false;
+
+  std::ostringstream out;
+  out << "# " << note << "\n";
+
+  std::regex  gain_line("^(\\s+)(K[pv][012])(\\s*:\\s*)([-+0-9.eE]+)(.*)$");
+  std::string line;
+  bool        in_gain = false;
+  while (std::getline(in, line)) {
+    if (!line.empty() && !isspace(line[0]) && line[0] != '#')  // a top level key
+      in_gain = line.compare(0, 5, "gain:") == 0;
+
+    std::smatch m;
+    if (in_gain && std::regex_match(line, m, gain_line)) {
+      for (int i = 0; i < NUM_GAINS; ++i) {
+        if (m[2] == GAIN_NAMES[i]) {
+          char value[32];
+          snprintf(value, sizeof(value), "%.3f", k(i));
+          line = m[1].str() + m[2].str() + m[3].str() + value + m[5].str();
+        }
+      }
+    }
+    out << line << "\n";
+  }
+
+  std::ofstream f(out_path);
+  f << out.str();
+  return (bool)f;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  int      generations = 30;
+  int      population  = 12;
+  int      flights     = 24;
+  unsigned threads     = 0;
+  uint32_t seed        = 1;
+  bool     linear      = false;
+  for (int i = 3; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--generations" && i + 1 < argc)
+      generations = atoi(argv[++i]);
+    else if (arg == "--population" && i + 1 < argc)
+      population = std::max(4, atoi(argv[++i]));
+    else if (arg == "--flights" && i + 1 < argc)
+      flights = std::max(1, atoi(argv[++i]));
+    else if (arg == "--threads" && i + 1 < argc)
+      threads = atoi(argv[++i]);
+    else if (arg == "--seed" && i + 1 < argc)
+      seed = strtoul(argv[++i], nullptr, 10);
+    else if (arg == "--linear")
+      linear = true;
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  Parameter_t param;
+  if (!param.config_from_yaml_file(argv[1])) return 1;
+
+  std::vector<Scenario> train, validate;
+  for (int i = 0; i < flights; ++i) train.emplace_back(param, seed * 100003u + i);
+  for (int i = 0; i < flights; ++i) validate.emplace_back(param, seed * 100003u + 50000u + i);
+
+  WorkStealingPool pool(threads);
+  printf("%s control, %d flights per candidate, %u threads\n", linear ? "linear" : "geometric",
+         flights, pool.size());
+
+  /*
+    CMA-ES (Hansen, "The CMA Evolution Strategy: A Tutorial") on x = log(gains)
+  */
+  const int n      = NUM_GAINS;
+  const int lambda = population;
+  const int mu     = lambda / 2;
+
+  Eigen::VectorXd w(mu);
+  for (int i = 0; i < mu; ++i) w(i) = std::log(mu + 0.5) - std::log(i + 1.0);
+  w /= w.sum();
+  const double mueff = 1.0 / w.squaredNorm();
+
+  const double cc    = (4.0 + mueff / n) / (n + 4.0 + 2.0 * mueff / n);
+  const double cs    = (mueff + 2.0) / (n + mueff + 5.0);
+  const double c1    = 2.0 / ((n + 1.3) * (n + 1.3) + mueff);
+  const double cmu   = std::min(1.0 - c1, 2.0 * (mueff - 2.0 + 1.0 / mueff) /
+                                              ((n + 2.0) * (n + 2.0) + mueff));
+  const double damps = 1.0 + 2.0 * std::max(0.0, std::sqrt((mueff - 1.0) / (n + 1.0)) - 1.0) + cs;
+  const double chiN  = std::sqrt((double)n) * (1.0 - 1.0 / (4.0 * n) + 1.0 / (21.0 * n * n));
+
+  GainVector mean  = get_gains(param.gain).array().log();
+  double     sigma = 0.3;
+  GainVector pc    = GainVector::Zero();
+  GainVector ps    = GainVector::Zero();
+  GainMatrix C     = GainMatrix::Identity();
+  GainMatrix B     = GainMatrix::Identity();
+  GainVector D     = GainVector::Ones();
+
+  std::mt19937                     rng(seed);
+  std::normal_distribution<double> N01(0.0, 1.0);
+
+  GainVector best_k    = get_gains(param.gain);
+  double     best_cost = std::numeric_limits<double>::infinity();
+  uint64_t   n_flights = 0;
+
+  std::chrono::steady_clock::time_point wall_start = std::chrono::steady_clock::now();
+
+  for (int gen = 0; gen < generations; ++gen) {
+    GainVectors y(lambda), k(lambda);
+    for (int i = 0; i < lambda; ++i) {
+      GainVector z;
+      for (int j = 0; j < n; ++j) z(j) = N01(rng);
+      y[i] = B * D.asDiagonal() * z;
+      k[i] = (mean + sigma * y[i]).array().exp();
+    }
+
+    std::vector<double> costs = evaluate(pool, param, k, train, linear);
+    n_flights += (uint64_t)lambda * train.size();
+
+    std::vector<int> order(lambda);
+    for (int i = 0; i < lambda; ++i) order[i] = i;
+    std::sort(order.begin(), order.end(), [&](int a, int b) { return costs[a] < costs[b]; });
+    if (costs[order[0]] < best_cost) {
+      best_cost = costs[order[0]];
+      best_k    = k[order[0]];
+    }
+
+    GainVector y_w = GainVector::Zero();
+    for (int i = 0; i < mu; ++i) y_w += w(i) * y[order[i]];
+    mean += sigma * y_w;
+
+    GainMatrix C_inv_sqrt = B * D.cwiseInverse().asDiagonal() * B.transpose();
+    ps = (1 - cs) * ps + std::sqrt(cs * (2 - cs) * mueff) * C_inv_sqrt * y_w;
+    bool hsig = ps.norm() / std::sqrt(1 - std::pow(1 - cs, 2.0 * (gen + 1))) / chiN <
+                1.4 + 2.0 / (n + 1);
+    pc = (1 - cc) * pc + (hsig ? std::sqrt(cc * (2 - cc) * mueff) : 0.0) * y_w;
+
+    GainMatrix rank_mu = GainMatrix::Zero();
+    for (int i = 0; i < mu; ++i) rank_mu += w(i) * y[order[i]] * y[order[i]].transpose();
+    C = (1 - c1 - cmu) * C +
+        c1 * (pc * pc.transpose() + (hsig ? 0.0 : cc * (2 - cc)) * C) + cmu * rank_mu;
+    sigma *= std::exp((cs / damps) * (ps.norm() / chiN - 1));
+
+    C = 0.5 * (C + C.transpose());
+    Eigen::SelfAdjointEigenSolver<GainMatrix> eig(C);
+    B = eig.eigenvectors();
+    D = eig.eigenvalues().cwiseMax(1e-20).cwiseSqrt();
+
+    printf("gen %3d  best %.4f  median %.4f  sigma %.3f  |", gen, costs[order[0]],
+           costs[order[lambda / 2]], sigma);
+    for (int i = 0; i < n; ++i) printf(" %s %.2f", GAIN_NAMES[i], k[order[0]](i));
+    printf("\n");
+    fflush(stdout);
+  }
+
+  double wall =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+  printf("%llu flights (%.0f s simulated) in %.1f s, %.0f flights/s\n",
+         (unsigned long long)n_flights, n_flights * 12.0, wall, n_flights / wall);
+
+  GainVectors         compare = {get_gains(param.gain), best_k};
+  std::vector<double> val     = evaluate(pool, param, compare, validate, linear);
+  printf("validation cost: %.4f with the gains of %s, %.4f tuned\n", val[0], argv[1], val[1]);
+
+  // Overfitted to the training flights, or no better gains found
+  bool improved = val[1] < val[0];
+  if (!improved) printf("the tuned gains are not better, keeping the gains of %s\n", argv[1]);
+
+  char note[256];
+  snprintf(note, sizeof(note),
+           "gain/Kp*, gain/Kv* %s by px4ctrl_tune (%s control, seed %u), validation cost "
+           "%.4f -> %.4f",
+           improved ? "tuned" : "kept", linear ? "linear" : "geometric", seed, val[0], val[1]);
+  if (!write_param_file(argv[1], argv[2], improved ? best_k : compare[0], note)) {
+    fprintf(stderr, "failed to write %s\n", argv[2]);
+    return 1;
+  }
+  printf("written to %s\n", argv[2]);
+
+  return improved ? 0 : 2;
+}
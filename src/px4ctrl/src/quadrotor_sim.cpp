@@ -0,0 +1,275 @@
+#include "quadrotor_sim.h"
+
+#include <algorithm>
+#include <cmath>
+
+QuadrotorSim::QuadrotorSim(const Params &params, uint32_t seed)
+    : prm_(params)
+    , rng_(seed)
+    , gauss_(0.0, 1.0) {
+  // PX4 quad X numbering: 1 front right, 2 back left (both CCW), 3 front left, 4 back right (CW).
+  // A CCW rotor pushes the body clockwise, i.e. a negative yaw torque in FLU.
+  const double d     = prm_.arm_length / std::sqrt(2.0);
+  const double x[4]  = {d, -d, d, -d};
+  const double y[4]  = {-d, d, d, -d};
+  const double sp[4] = {-1, -1, 1, 1};
+  for (int i = 0; i < 4; ++i) {
+    alloc_(0, i) = 1.0;
+    alloc_(1, i) = y[i];
+    alloc_(2, i) = -x[i];
+    alloc_(3, i) = sp[i] * prm_.yaw_moment_coeff;
+  }
+  alloc_inv_ = alloc_.inverse();
+
+  reset(Eigen::Vector3d::Zero(), 0.0);
+}
+
+void QuadrotorSim::reset(const Eigen::Vector3d &p, double yaw, bool hovering) {
+  t_ = 0.0;
+  p_ = p;
+  v_.setZero();
+  w_.setZero();
+  q_              = Eigen::Quaterniond(Eigen::AngleAxisd(yaw, Eigen::Vector3d::UnitZ()));
+  specific_force_ = Eigen::Vector3d(0, 0, prm_.gra);
+  on_ground_      = p_.z() <= 0.0;
+
+  vibration_.setZero();
+  for (int i = 0; i < 4; ++i) {
+    motor_u_[i]     = 0.0;
+    rotor_phase_[i] = 0.5 * i;
+  }
+  charge_  = prm_.initial_charge;
+  current_ = 0.0;
+  volt_    = prm_.battery_cells *
+          (prm_.cell_empty_volt + (prm_.cell_full_volt - prm_.cell_empty_volt) * charge_);
+
+  armed_             = false;
+  active_.apply_time = 0.0;
+  active_.bodyrate   = false;
+  active_.q          = q_;
+  active_.rate.setZero();
+  active_.thrust = 0.0;
+  pending_.clear();
+
+  if (hovering) {
+    armed_         = true;
+    on_ground_     = false;
+    active_.thrust = rotor_command(prm_.mass * prm_.gra / 4);
+    for (int i = 0; i < 4; ++i) motor_u_[i] = active_.thrust;
+  }
+}
+
+void QuadrotorSim::set_attitude_target(const Eigen::Quaterniond &q, double thrust) {
+  Setpoint sp;
+  sp.apply_time = t_ + prm_.setpoint_latency;
+  sp.bodyrate   = false;
+  sp.q          = q.normalized();
+  sp.rate.setZero();
+  sp.thrust = thrust;
+  pending_.push_back(sp);
+}
+
+void QuadrotorSim::set_bodyrate_target(const Eigen::Vector3d &rate, double thrust) {
+  Setpoint sp;
+  sp.apply_time = t_ + prm_.setpoint_latency;
+  sp.bodyrate   = true;
+  sp.q          = q_;
+  sp.rate       = rate;
+  sp.thrust     = thrust;
+  pending_.push_back(sp);
+}
+
+double QuadrotorSim::rotor_thrust(double u) const {
+  return prm_.K1 * std::pow(volt_, prm_.K2) * (prm_.K3 * u * u + (1 - prm_.K3) * u) / 4.0;
+}
+
+// Inverse of rotor_thrust() at the present battery voltage
+double QuadrotorSim::rotor_command(double thrust) const {
+  double s = thrust / (prm_.K1 * std::pow(volt_, prm_.K2) / 4.0);
+  double u;
+  if (prm_.K3 > 1e-6) {
+    double b = 1 - prm_.K3;
+    u        = (-b + std::sqrt(b * b + 4 * prm_.K3 * std::max(s, 0.0))) / (2 * prm_.K3);
+  } else {
+    u = s;
+  }
+  return std::min(std::max(u, 0.0), 1.0);
+}
+
+/*
+  What the FCU does with a setpoint: attitude error -> body rate setpoint -> angular acceleration
+  -> torque, then the mixer turns collective thrust and torque into motor commands. When a motor
+  saturates, the collective thrust gives way so that roll and pitch keep their authority.
+*/
+void QuadrotorSim::fcu_control(double cmd[4]) const {
+  Eigen::Vector3d rate_sp;
+  if (active_.bodyrate) {
+    rate_sp = active_.rate;
+  } else {
+    Eigen::Quaterniond qe = q_.inverse() * active_.q;
+    Eigen::Vector3d    e  = 2.0 * (qe.w() >= 0 ? 1.0 : -1.0) * qe.vec();
+    e.z() *= prm_.yaw_att_weight;
+    rate_sp = prm_.att_p * e;
+  }
+  rate_sp = rate_sp.cwiseMax(-prm_.max_rate).cwiseMin(prm_.max_rate);
+
+  Eigen::Vector3d J = prm_.inertia;
+  Eigen::Vector3d torque =
+      J.asDiagonal() * (prm_.rate_p * (rate_sp - w_)) + w_.cross(J.asDiagonal() * w_);
+
+  double          thrust = std::min(std::max(active_.thrust, 0.0), 1.0);
+  Eigen::Vector4d wrench(4 * rotor_thrust(thrust), torque(0), torque(1), torque(2));
+  Eigen::Vector4d F = alloc_inv_ * wrench;
+
+  double F_max = rotor_thrust(1.0);
+  double hi    = F.maxCoeff();
+  double lo    = F.minCoeff();
+  if (hi > F_max)
+    F.array() -= std::min(hi - F_max, std::max(lo, 0.0));
+  else if (lo < 0)
+    F.array() += std::min(-lo, F_max - hi);
+
+  for (int i = 0; i < 4; ++i) cmd[i] = rotor_command(std::min(std::max(F(i), 0.0), F_max));
+}
+
+void QuadrotorSim::step(double dt) {
+  t_ += dt;
+  while (!pending_.empty() && pending_.front().apply_time <= t_) {
+    active_ = pending_.front();
+    pending_.pop_front();
+  }
+
+  double cmd[4] = {0, 0, 0, 0};
+  if (armed_) fcu_control(cmd);
+
+  double          alpha = 1.0 - std::exp(-dt / prm_.motor_time_constant);
+  Eigen::Vector4d F;
+  double          power = 0;
+  for (int i = 0; i < 4; ++i) {
+    motor_u_[i] += (cmd[i] - motor_u_[i]) * alpha;
+    F(i) = rotor_thrust(motor_u_[i]);
+    power += std::pow(std::max(F(i), 0.0), 1.5);
+  }
+  Eigen::Vector4d wrench = alloc_ * F;
+
+  // Rotor imbalance, the amplitude grows with the rotor speed squared, i.e. with the thrust
+  vibration_.setZero();
+  if (prm_.vibration_accel > 0) {
+    double F_max = rotor_thrust(1.0);
+    for (int i = 0; i < 4; ++i) {
+      double load = std::min(std::max(F(i) / F_max, 0.0), 1.0);
+      double freq = prm_.rotor_max_freq * std::sqrt(load);
+      double amp  = prm_.vibration_accel * load;
+      rotor_phase_[i] = std::fmod(rotor_phase_[i] + 2 * M_PI * freq * dt, 2 * M_PI);
+      vibration_ += amp * Eigen::Vector3d(0.5 * std::cos(rotor_phase_[i]),
+                                          0.5 * std::sin(rotor_phase_[i]),
+                                          std::sin(rotor_phase_[i]));
+    }
+  }
+
+  // Battery
+  current_ = prm_.idle_current * (armed_ ? 1.0 : 0.0) + prm_.current_coeff * power;
+  charge_  = std::max(charge_ - current_ * dt / 3600.0 / prm_.battery_capacity, 0.0);
+  volt_    = prm_.battery_cells *
+              (prm_.cell_empty_volt + (prm_.cell_full_volt - prm_.cell_empty_volt) * charge_) -
+          prm_.battery_resistance * current_;
+
+  // Translation
+  Eigen::Matrix3d R   = q_.toRotationMatrix();
+  Eigen::Vector3d fb  = Eigen::Vector3d(0, 0, wrench(0) / prm_.mass);  // thrust per mass, body
+  Eigen::Vector3d ext = prm_.wind - prm_.drag.cwiseProduct(v_);
+  Eigen::Vector3d a   = R * fb - Eigen::Vector3d(0, 0, prm_.gra) + ext;
+  v_ += a * dt;
+  p_ += v_ * dt;
+
+  // Rotation
+  Eigen::Vector3d J = prm_.inertia;
+  Eigen::Vector3d w_dot = (wrench.tail<3>() - w_.cross(J.asDiagonal() * w_)).cwiseQuotient(J);
+  w_ += w_dot * dt;
+  Eigen::Vector3d dtheta = w_ * dt;
+  double          angle  = dtheta.norm();
+  if (angle > 1e-12) {
+    q_ = (q_ * Eigen::Quaterniond(Eigen::AngleAxisd(angle, dtheta / angle))).normalized();
+  }
+
+  // Ground contact, the vehicle stays level on the ground until the thrust lifts it
+  if (p_.z() <= 0.0) {
+    p_.z() = 0.0;
+    if ((R * fb).z() < prm_.gra) {
+      on_ground_ = true;
+      v_.setZero();
+      w_.setZero();
+      double yaw = std::atan2(R(1, 0), R(0, 0));
+      q_         = Eigen::Quaterniond(Eigen::AngleAxisd(yaw, Eigen::Vector3d::UnitZ()));
+    } else if (v_.z() < 0) {
+      v_.z() = 0;
+    }
+  } else {
+    on_ground_ = false;
+  }
+
+  if (on_ground_)
+    specific_force_ = q_.inverse() * Eigen::Vector3d(0, 0, prm_.gra);
+  else
+    specific_force_ = fb + R.transpose() * ext;
+}
+
+Eigen::Vector3d QuadrotorSim::noise(double sigma) {
+  if (sigma <= 0) return Eigen::Vector3d::Zero();
+  Eigen::Vector3d n;
+  for (int i = 0; i < 3; ++i) n(i) = sigma * gauss_(rng_);
+  return n;
+}
+
+void QuadrotorSim::sample_odom(Eigen::Vector3d    &p,
+                               Eigen::Vector3d    &v,
+                               Eigen::Quaterniond &q,
+                               Eigen::Vector3d    &w) {
+  p = p_ + noise(prm_.odom_pos_noise);
+  v = v_ + noise(prm_.odom_vel_noise);
+  q = q_;
+  w = w_ + noise(prm_.gyro_noise);
+}
+
+void QuadrotorSim::sample_imu(Eigen::Quaterniond &q, Eigen::Vector3d &w, Eigen::Vector3d &a) {
+  q = q_;
+  w = w_ + noise(prm_.gyro_noise);
+  a = specific_force_ + vibration_ + noise(prm_.accel_noise);
+}
+
+CircleReference::CircleReference(const Eigen::Vector3d &start,
+                                 double                 radius,
+                                 double                 period,
+                                 double                 duration)
+    : start_(start)
+    , radius_(radius)
+    , omega_(2 * M_PI / period)
+    , duration_(duration)
+    , ramp_(std::min(period, duration / 2))
+    , theta_(0)
+    , tau_(0) {}
+
+double CircleReference::rate() const {
+  double s = std::min(std::min(tau_ / ramp_, (duration_ - tau_) / ramp_), 1.0);
+  return omega_ * std::max(s, 0.0);
+}
+
+double CircleReference::rate_dot() const {
+  if (tau_ < ramp_) return omega_ / ramp_;
+  if (tau_ > duration_ - ramp_ && tau_ < duration_) return -omega_ / ramp_;
+  return 0;
+}
+
+void CircleReference::step(double dt) {
+  theta_ += rate() * dt;
+  tau_ += dt;
+}
+
+void CircleReference::sample(Eigen::Vector3d &p, Eigen::Vector3d &v, Eigen::Vector3d &a) const {
+  double th = theta_, th_d = rate(), th_dd = rate_dot();
+  double s = std::sin(th), c = std::cos(th);
+
+  p = start_ + radius_ * Eigen::Vector3d(c - 1, s, 0);
+  v = radius_ * th_d * Eigen::Vector3d(-s, c, 0);
+  a = radius_ * (th_dd * Eigen::Vector3d(-s, c, 0) - th_d * th_d * Eigen::Vector3d(c, s, 0));
+}
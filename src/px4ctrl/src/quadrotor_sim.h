@@ -0,0 +1,162 @@
+#ifndef __QUADROTOR_SIM_H
+#define __QUADROTOR_SIM_H
+
+#include <Eigen/Dense>
+#include <deque>
+#include <random>
+
+/*
+  Headless quadrotor model for closed-loop runs of px4ctrl without Gazebo and PX4 SITL. No ROS
+  dependency. World frame is ENU and body frame is FLU, the same frames px4ctrl sees from mavros
+  and odom.
+
+  - Rigid body of an X-frame quadrotor with linear drag and ground contact at z = 0.
+  - Four motors with a first order lag. Thrust of one rotor follows the thrust_model of
+    ctrl_param_fpv.yaml: F = K1 * V^K2 * (K3 * u^2 + (1 - K3) * u) / 4.
+  - Battery with internal resistance, the voltage sags with the current and the discharge.
+  - Optional rotor imbalance: every rotor shakes the accelerometer at its rotation frequency,
+    which follows the square root of its thrust.
+  - Emulated FCU: attitude P loop, body rate P loop and mixer, fed by the same setpoints as
+    mavros/setpoint_raw/attitude. Setpoints take effect after a configurable transport latency.
+
+  The model is deterministic for a given seed.
+*/
+class QuadrotorSim {
+ public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  struct Params {
+    double          mass{1.5};                     // kg
+    double          gra{9.81};                     // m/s^2
+    Eigen::Vector3d inertia{0.015, 0.015, 0.025};  // kg*m^2, diagonal
+    double          arm_length{0.17};              // m, motor to center
+    double          yaw_moment_coeff{0.016};       // rotor drag torque / rotor thrust, m
+    Eigen::Vector3d drag{0.3, 0.3, 0.15};          // linear drag, (m/s^2) / (m/s), world frame
+    Eigen::Vector3d wind{0.0, 0.0, 0.0};           // constant external acceleration, world frame
+
+    double motor_time_constant{0.03};  // s
+    double K1{0.7583};                 // thrust model, see thrust_model in the param file
+    double K2{1.6942};
+    double K3{0.6786};
+
+    int    battery_cells{4};
+    double cell_full_volt{4.2};
+    double cell_empty_volt{3.5};
+    double battery_capacity{3.0};     // Ah
+    double battery_resistance{0.03};  // Ohm, whole pack
+    double current_coeff{0.55};       // A per N^1.5 of rotor thrust, from momentum theory
+    double idle_current{0.5};         // A
+    double initial_charge{1.0};       // 0~1
+
+    double att_p{6.5};               // FCU attitude loop, (rad/s) / rad
+    double yaw_att_weight{0.4};      // PX4 MC_YAW_WEIGHT
+    double max_rate{3.5};            // rad/s, roll/pitch/yaw rate limit of the FCU
+    double rate_p{25.0};             // FCU rate loop, (rad/s^2) / (rad/s)
+    double setpoint_latency{0.015};  // s, px4ctrl -> mavros -> FCU
+
+    double odom_pos_noise{0.0};  // m, standard deviation
+    double odom_vel_noise{0.0};  // m/s
+    double gyro_noise{0.0};      // rad/s
+    double accel_noise{0.0};     // m/s^2
+
+    double vibration_accel{0.0};   // m/s^2, amplitude of one rotor at full thrust
+    double rotor_max_freq{250.0};  // Hz, rotation frequency at full thrust
+  };
+
+  explicit QuadrotorSim(const Params &params, uint32_t seed = 0);
+
+  // hovering: start in the air with the motors at hover thrust instead of on the ground, idle
+  void reset(const Eigen::Vector3d &p, double yaw, bool hovering = false);
+
+  // FCU interface. thrust is the normalized collective thrust (0~1) of AttitudeTarget.
+  void set_armed(bool armed) { armed_ = armed; }
+  bool armed() const { return armed_; }
+  void set_attitude_target(const Eigen::Quaterniond &q, double thrust);
+  void set_bodyrate_target(const Eigen::Vector3d &rate, double thrust);
+
+  void step(double dt);
+
+  // Truth
+  double                    time() const { return t_; }
+  const Eigen::Vector3d    &position() const { return p_; }
+  const Eigen::Vector3d    &velocity() const { return v_; }
+  const Eigen::Quaterniond &attitude() const { return q_; }
+  const Eigen::Vector3d    &bodyrate() const { return w_; }
+  bool                      on_ground() const { return on_ground_; }
+  double                    battery_voltage() const { return volt_; }
+  double                    battery_current() const { return current_; }
+  double                    battery_charge() const { return charge_; }
+
+  // Sensors, with the configured noise
+  void sample_odom(Eigen::Vector3d    &p,
+                   Eigen::Vector3d    &v,
+                   Eigen::Quaterniond &q,
+                   Eigen::Vector3d    &w);
+  void sample_imu(Eigen::Quaterniond &q, Eigen::Vector3d &w, Eigen::Vector3d &a);
+
+  const Params &params() const { return prm_; }
+
+ private:
+  struct Setpoint {
+    double             apply_time;
+    bool               bodyrate;
+    Eigen::Quaterniond q;
+    Eigen::Vector3d    rate;
+    double             thrust;
+  };
+
+  Params          prm_;
+  Eigen::Matrix4d alloc_;  // rotor thrusts -> collective thrust and body torques
+  Eigen::Matrix4d alloc_inv_;
+
+  double             t_;
+  Eigen::Vector3d    p_, v_, w_;
+  Eigen::Quaterniond q_;
+  Eigen::Vector3d    specific_force_;  // body frame, what the accelerometer measures
+  Eigen::Vector3d    vibration_;       // body frame, added to the accelerometer
+  bool               on_ground_;
+
+  double motor_u_[4];  // lagged ESC command of each motor, 0~1
+  double rotor_phase_[4];
+  double charge_;      // 0~1
+  double volt_;
+  double current_;
+
+  bool     armed_;
+  Setpoint active_;
+  std::deque<Setpoint, Eigen::aligned_allocator<Setpoint>> pending_;
+
+  std::mt19937                     rng_;
+  std::normal_distribution<double> gauss_;
+
+  double          rotor_thrust(double u) const;
+  double          rotor_command(double thrust) const;
+  void            fcu_control(double cmd[4]) const;
+  Eigen::Vector3d noise(double sigma);
+};
+
+/*
+  Horizontal circle through the start point. The angular rate is ramped up and down over one
+  period (at most half the duration) so that the reference starts and ends at rest. Call step()
+  at the physics rate.
+*/
+class CircleReference {
+ public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  CircleReference(const Eigen::Vector3d &start, double radius, double period, double duration);
+
+  bool finished() const { return tau_ >= duration_; }
+  void step(double dt);
+  void sample(Eigen::Vector3d &p, Eigen::Vector3d &v, Eigen::Vector3d &a) const;
+
+ private:
+  Eigen::Vector3d start_;
+  double          radius_, omega_, duration_, ramp_;
+  double          theta_, tau_;
+
+  double rate() const;
+  double rate_dot() const;
+};
+
+#endif
@@ -0,0 +1,232 @@
+/*
+  Offline thrust model calibration from recorded flights, see thrust_calibrator.h.
+
+  usage: thrust_calibrate_batch [--interval <s>] [--stats <file>] [--no-imu]
+                                --mass <kg> <log> [<log> ...] [--mass <kg> <log> ...]
+
+  --mass applies to the logs after it, so flights with different payloads can be fitted together.
+  A log is one of
+    - a bag from thrust_calibrate_scrips/record.sh. Data between the first and the second
+      /traj_start_trigger is used, or everything if the bag has no trigger.
+    - a CSV from px4ctrl_blackbox_export. Ticks in AUTO_HOVER and CMD_CTRL are used.
+    - a data.csv written by the former thrust_calibrate.py. Its own mass rows override --mass.
+  With --stats, statistics saved by earlier runs (or by the thrust_calibrate node) are added in
+  and the sum is saved back.
+*/
+
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+
+#include <fstream>
+#include <sstream>
+
+#include <geometry_msgs/PoseStamped.h>
+#include <mavros_msgs/AttitudeTarget.h>
+#include <sensor_msgs/BatteryState.h>
+#include <sensor_msgs/Imu.h>
+
+#include "thrust_calibrator.h"
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [--interval <s>] [--stats <file>] [--no-imu] --mass <kg> <log> [<log> ...] "
+          "[--mass <kg> <log> ...]\n",
+          name);
+}
+
+static std::vector<std::string> split(const std::string &line) {
+  std::vector<std::string> fields;
+  std::stringstream        ss(line);
+  std::string              field;
+  while (std::getline(ss, field, ',')) fields.push_back(field);
+  return fields;
+}
+
+static bool read_bag(const std::string &path, ThrustCalibrator &cal, bool use_imu) {
+  rosbag::Bag bag;
+  try {
+    bag.open(path, rosbag::bagmode::Read);
+  } catch (const std::exception &e) {
+    fprintf(stderr, "open %s failed: %s\n", path.c_str(), e.what());
+    return false;
+  }
+
+  bool has_trigger = rosbag::View(bag, rosbag::TopicQuery("/traj_start_trigger")).size() > 0;
+  int  triggers    = 0;
+
+  std::vector<std::string> topics = {"/mavros/setpoint_raw/attitude", "/mavros/battery",
+                                     "/mavros/imu/data", "/traj_start_trigger"};
+  for (const rosbag::MessageInstance &m : rosbag::View(bag, rosbag::TopicQuery(topics))) {
+    const std::string &topic = m.getTopic();
+    if (topic == "/traj_start_trigger") {
+      triggers++;
+      continue;
+    }
+    if (has_trigger && triggers != 1) continue;
+
+    double t = m.getTime().toSec();
+    if (topic == "/mavros/setpoint_raw/attitude") {
+      cal.add_setpoint(t, m.instantiate<mavros_msgs::AttitudeTarget>()->thrust);
+    } else if (topic == "/mavros/battery") {
+      sensor_msgs::BatteryStateConstPtr msg  = m.instantiate<sensor_msgs::BatteryState>();
+      double                            volt = msg->voltage;
+      if (volt <= 0) {
+        volt = 0;
+        for (size_t i = 0; i < msg->cell_voltage.size(); ++i) volt += msg->cell_voltage[i];
+      }
+      cal.add_voltage(t, volt);
+    } else if (topic == "/mavros/imu/data" && use_imu) {
+      cal.add_accel(t, m.instantiate<sensor_msgs::Imu>()->linear_acceleration.z);
+    }
+  }
+  cal.flush();
+  bag.close();
+  return true;
+}
+
+static bool read_blackbox_csv(std::ifstream      &in,
+                              const std::string  &header,
+                              ThrustCalibrator   &cal,
+                              bool                use_imu) {
+  std::vector<std::string> names = split(header);
+  int                      col_t = -1, col_state = -1, col_u = -1, col_volt = -1, col_acc = -1;
+  for (int i = 0; i < (int)names.size(); ++i) {
+    if (names[i] == "t") col_t = i;
+    if (names[i] == "state") col_state = i;
+    if (names[i] == "u_thrust") col_u = i;
+    if (names[i] == "bat_volt") col_volt = i;
+    if (names[i] == "imu_a_z") col_acc = i;
+  }
+  if (col_t < 0 || col_state < 0 || col_u < 0 || col_volt < 0 || col_acc < 0) return false;
+
+  std::string line;
+  while (std::getline(in, line)) {
+    std::vector<std::string> f = split(line);
+    if ((int)f.size() < (int)names.size()) continue;
+    int state = atoi(f[col_state].c_str());
+    if (state != 2 && state != 3) {  // AUTO_HOVER, CMD_CTRL
+      cal.flush();
+      continue;
+    }
+    double t = atof(f[col_t].c_str());
+    cal.add_setpoint(t, atof(f[col_u].c_str()));
+    cal.add_voltage(t, atof(f[col_volt].c_str()));
+    if (use_imu) cal.add_accel(t, atof(f[col_acc].c_str()));
+  }
+  cal.flush();
+  return true;
+}
+
+// "2021-01-01 00:00:00,mass(kg):,1.5,commands,voltage" followed by "thrust,voltage" rows
+static bool read_legacy_csv(std::ifstream     &in,
+                            const std::string &header,
+                            ThrustCalibrator  &cal,
+                            double             gra) {
+  double      mass = 0;
+  std::string line = header;
+  do {
+    std::vector<std::string> f = split(line);
+    if (f.size() >= 3 && f[1] == "mass(kg):") {
+      mass = atof(f[2].c_str());
+    } else if (f.size() >= 2 && mass > 0) {
+      cal.add_sample(atof(f[0].c_str()), atof(f[1].c_str()), mass * gra);
+    }
+  } while (std::getline(in, line));
+  return mass > 0;
+}
+
+int main(int argc, char *argv[]) {
+  const double gra = 9.81;
+
+  double      interval = 1.0;
+  double      mass     = 0;
+  bool        use_imu  = true;
+  std::string stats_file;
+
+  // options first, so that --interval is known before the first log
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--interval" && i + 1 < argc)
+      interval = atof(argv[++i]);
+    else if (arg == "--stats" && i + 1 < argc)
+      stats_file = argv[++i];
+    else if (arg == "--no-imu")
+      use_imu = false;
+  }
+
+  ThrustCalibrator cal(1.0, gra, interval);
+  if (!stats_file.empty() && cal.load(stats_file))
+    printf("%.0f samples loaded from %s\n", cal.samples(), stats_file.c_str());
+
+  int logs = 0;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--interval" || arg == "--stats") {
+      ++i;
+      continue;
+    }
+    if (arg == "--no-imu") continue;
+    if (arg == "--mass" && i + 1 < argc) {
+      mass = atof(argv[++i]);
+      cal.set_mass(mass);
+      continue;
+    }
+
+    double before = cal.samples();
+    bool   ok     = false;
+    if (arg.size() > 4 && arg.compare(arg.size() - 4, 4, ".bag") == 0) {
+      if (mass <= 0) {
+        usage(argv[0]);
+        return 1;
+      }
+      ok = read_bag(arg, cal, use_imu);
+    } else {
+      std::ifstream in(arg);
+      std::string   header;
+      if (!in || !std::getline(in, header)) {
+        fprintf(stderr, "cannot read %s\n", arg.c_str());
+        return 1;
+      }
+      if (header.compare(0, 6, "seq,t,") == 0) {
+        if (mass <= 0) {
+          usage(argv[0]);
+          return 1;
+        }
+        ok = read_blackbox_csv(in, header, cal, use_imu);
+      } else {
+        ok = read_legacy_csv(in, header, cal, gra);
+      }
+    }
+    if (!ok) {
+      fprintf(stderr, "%s: unrecognized log\n", arg.c_str());
+      return 1;
+    }
+    printf("%s: %.0f samples\n", arg.c_str(), cal.samples() - before);
+    logs++;
+  }
+  if (logs == 0 && cal.samples() == 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (!stats_file.empty()) {
+    if (!cal.save(stats_file)) {
+      fprintf(stderr, "failed to save %s\n", stats_file.c_str());
+      return 1;
+    }
+    printf("statistics saved to %s\n", stats_file.c_str());
+  }
+
+  ThrustCalibrator::Result r = cal.fit();
+  printf("%.0f samples, throttle %.3f~%.3f, battery %.2f~%.2f V\n", r.samples, r.u_min, r.u_max,
+         r.volt_min, r.volt_max);
+  if (!r.ok) {
+    fprintf(stderr, "no fit: %s\n", r.message.c_str());
+    return 1;
+  }
+  if (!r.message.empty()) printf("warning: %s\n", r.message.c_str());
+  printf("rms thrust error %.1f%%\n\n", r.rms * 100);
+  printf("thrust_model:\n    K1: %.4f\n    K2: %.4f\n    K3: %.4f\n", r.K1, r.K2, r.K3);
+
+  return 0;
+}
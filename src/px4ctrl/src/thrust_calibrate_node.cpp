@@ -0,0 +1,140 @@
+/*
+  Online thrust model calibration, see thrust_calibrator.h.
+
+  Recording starts at the first /traj_start_trigger (sent by px4ctrl after auto takeoff) and stops
+  at the second one, or when the battery drops below ~min_battery_voltage. The fitted K1, K2, K3
+  are then printed for the thrust_model section of the param file. With ~stats_file set, the
+  statistics of earlier flights (e.g. with other payloads) are loaded first and the sum is saved
+  again, so that every flight refines the same fit.
+*/
+
+#include <ros/ros.h>
+
+#include <geometry_msgs/PoseStamped.h>
+#include <mavros_msgs/AttitudeTarget.h>
+#include <sensor_msgs/BatteryState.h>
+#include <sensor_msgs/Imu.h>
+
+#include "thrust_calibrator.h"
+
+class ThrustCalibrationNode {
+ public:
+  ThrustCalibrationNode(ros::NodeHandle &nh, ros::NodeHandle &nh_private)
+      : triggers_(0)
+      , done_(false) {
+    double interval, mass;
+    nh_private.param("time_interval", interval, 1.0);
+    nh_private.param("mass_kg", mass, 1.0);
+    nh_private.param("min_battery_voltage", vbat_min_, 13.2);
+    nh_private.param("use_imu", use_imu_, true);
+    nh_private.param("stats_file", stats_file_, std::string(""));
+    calibrator_.reset(new ThrustCalibrator(mass, 9.81, interval));
+
+    if (!stats_file_.empty()) {
+      if (calibrator_->load(stats_file_))
+        ROS_INFO("[thrust_calibrate] %.0f samples of earlier flights loaded from %s",
+                 calibrator_->samples(), stats_file_.c_str());
+      else
+        ROS_INFO("[thrust_calibrate] No earlier statistics in %s", stats_file_.c_str());
+    }
+
+    bat_sub_ = nh.subscribe<sensor_msgs::BatteryState>(
+        "/mavros/battery", 100, &ThrustCalibrationNode::battery_cb, this);
+    cmd_sub_ = nh.subscribe<mavros_msgs::AttitudeTarget>(
+        "/mavros/setpoint_raw/attitude", 100, &ThrustCalibrationNode::setpoint_cb, this,
+        ros::TransportHints().tcpNoDelay());
+    trigger_sub_ = nh.subscribe<geometry_msgs::PoseStamped>(
+        "/traj_start_trigger", 10, &ThrustCalibrationNode::trigger_cb, this);
+    if (use_imu_) {
+      imu_sub_ = nh.subscribe<sensor_msgs::Imu>("/mavros/imu/data", 100,
+                                                &ThrustCalibrationNode::imu_cb, this,
+                                                ros::TransportHints().tcpNoDelay());
+    }
+  }
+
+ private:
+  std::unique_ptr<ThrustCalibrator> calibrator_;
+
+  ros::Subscriber bat_sub_, cmd_sub_, trigger_sub_, imu_sub_;
+
+  double      vbat_min_;
+  bool        use_imu_;
+  std::string stats_file_;
+  int         triggers_;
+  bool        done_;
+
+  bool recording() const { return triggers_ == 1 && !done_; }
+
+  void battery_cb(const sensor_msgs::BatteryStateConstPtr &msg) {
+    if (!recording()) return;
+
+    double volt = msg->voltage;
+    if (volt <= 0) {
+      volt = 0;
+      for (size_t i = 0; i < msg->cell_voltage.size(); ++i) volt += msg->cell_voltage[i];
+    }
+    calibrator_->add_voltage(ros::Time::now().toSec(), volt);
+
+    if (volt > 0 && volt < vbat_min_) {
+      ROS_WARN("[thrust_calibrate] Battery voltage %.2f V below %.2f V, stop recording.", volt,
+               vbat_min_);
+      finish();
+    }
+  }
+
+  void setpoint_cb(const mavros_msgs::AttitudeTargetConstPtr &msg) {
+    if (recording()) calibrator_->add_setpoint(ros::Time::now().toSec(), msg->thrust);
+  }
+
+  void imu_cb(const sensor_msgs::ImuConstPtr &msg) {
+    if (recording()) calibrator_->add_accel(ros::Time::now().toSec(), msg->linear_acceleration.z);
+  }
+
+  void trigger_cb(const geometry_msgs::PoseStampedConstPtr &msg) {
+    triggers_++;
+    if (triggers_ == 1) ROS_INFO("[thrust_calibrate] Start recording.");
+    if (triggers_ == 2) {
+      ROS_INFO("[thrust_calibrate] Stop recording.");
+      finish();
+    }
+  }
+
+  void finish() {
+    if (done_) return;
+    done_ = true;
+    calibrator_->flush();
+
+    if (!stats_file_.empty()) {
+      if (calibrator_->save(stats_file_))
+        ROS_INFO("[thrust_calibrate] Statistics saved to %s", stats_file_.c_str());
+      else
+        ROS_ERROR("[thrust_calibrate] Failed to save the statistics to %s", stats_file_.c_str());
+    }
+
+    ThrustCalibrator::Result r = calibrator_->fit();
+    ROS_INFO("[thrust_calibrate] %.0f samples, throttle %.3f~%.3f, battery %.2f~%.2f V", r.samples,
+             r.u_min, r.u_max, r.volt_min, r.volt_max);
+    if (!r.ok) {
+      ROS_ERROR("[thrust_calibrate] No fit: %s", r.message.c_str());
+      return;
+    }
+    if (!r.message.empty()) ROS_WARN("[thrust_calibrate] %s", r.message.c_str());
+    ROS_INFO(
+        "\033[32m[thrust_calibrate] thrust_model: K1: %.4f K2: %.4f K3: %.4f (rms thrust error "
+        "%.1f%%)\033[0m",
+        r.K1, r.K2, r.K3, r.rms * 100);
+  }
+};
+
+int main(int argc, char *argv[]) {
+  ros::init(argc, argv, "thrust_calibrate");
+  ros::NodeHandle nh;
+  ros::NodeHandle nh_private("~");
+
+  ThrustCalibrationNode node(nh, nh_private);
+  ROS_INFO("[thrust_calibrate] Waiting for trigger.");
+
+  ros::spin();
+
+  return 0;
+}
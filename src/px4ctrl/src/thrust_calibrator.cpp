@@ -0,0 +1,179 @@
+#include "thrust_calibrator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+
+static const char *STATS_MAGIC = "px4ctrl_thrust_stats";
+
+ThrustCalibrator::ThrustCalibrator(double mass, double gra, double interval)
+    : mass_(mass)
+    , gra_(gra)
+    , interval_(interval)
+    , interval_start_(-1)
+    , u_sum_(0)
+    , volt_sum_(0)
+    , acc_sum_(0)
+    , u_cnt_(0)
+    , volt_cnt_(0)
+    , acc_cnt_(0)
+    , n_(0)
+    , sx_(0)
+    , sxx_(0)
+    , u_min_(std::numeric_limits<double>::infinity())
+    , u_max_(-std::numeric_limits<double>::infinity())
+    , volt_min_(std::numeric_limits<double>::infinity())
+    , volt_max_(-std::numeric_limits<double>::infinity()) {
+  for (int i = 0; i < K3_GRID; ++i) sy_[i] = syy_[i] = sxy_[i] = 0;
+}
+
+void ThrustCalibrator::tick(double t) {
+  if (interval_start_ < 0) interval_start_ = t;
+  if (t - interval_start_ >= interval_) {
+    flush();
+    interval_start_ = t;
+  }
+}
+
+void ThrustCalibrator::add_setpoint(double t, double thrust) {
+  tick(t);
+  u_sum_ += thrust;
+  u_cnt_++;
+}
+
+void ThrustCalibrator::add_voltage(double t, double volt) {
+  tick(t);
+  volt_sum_ += volt;
+  volt_cnt_++;
+}
+
+void ThrustCalibrator::add_accel(double t, double acc_z) {
+  tick(t);
+  acc_sum_ += acc_z;
+  acc_cnt_++;
+}
+
+void ThrustCalibrator::flush() {
+  if (u_cnt_ > 0 && volt_cnt_ > 0) {
+    double acc = acc_cnt_ > 0 ? acc_sum_ / acc_cnt_ : gra_;
+    add_sample(u_sum_ / u_cnt_, volt_sum_ / volt_cnt_, mass_ * acc);
+  }
+  u_sum_ = volt_sum_ = acc_sum_ = 0;
+  u_cnt_ = volt_cnt_ = acc_cnt_ = 0;
+}
+
+void ThrustCalibrator::add_sample(double u, double volt, double force) {
+  if (u <= 0.01 || volt <= 0 || force <= 0) return;  // not flying, or no battery reading
+
+  double x = std::log(volt);
+  double f = std::log(force);
+  n_ += 1;
+  sx_ += x;
+  sxx_ += x * x;
+  for (int i = 0; i < K3_GRID; ++i) {
+    double K3 = k3_at(i);
+    double y  = f - std::log(K3 * u * u + (1 - K3) * u);
+    sy_[i] += y;
+    syy_[i] += y * y;
+    sxy_[i] += x * y;
+  }
+
+  u_min_    = std::min(u_min_, u);
+  u_max_    = std::max(u_max_, u);
+  volt_min_ = std::min(volt_min_, volt);
+  volt_max_ = std::max(volt_max_, volt);
+}
+
+ThrustCalibrator::Result ThrustCalibrator::fit() const {
+  Result r;
+  r.ok       = false;
+  r.K1       = r.K2 = r.K3 = r.rms = 0;
+  r.samples  = n_;
+  r.u_min    = u_min_;
+  r.u_max    = u_max_;
+  r.volt_min = volt_min_;
+  r.volt_max = volt_max_;
+
+  if (n_ < 10) {
+    r.message = "not enough data, hover for longer";
+    return r;
+  }
+  double denom = n_ * sxx_ - sx_ * sx_;
+  if (volt_max_ / volt_min_ < 1.02 || denom <= 0) {
+    r.message = "battery voltage range too small, hover until the battery is nearly empty";
+    return r;
+  }
+
+  double best_sse = std::numeric_limits<double>::infinity();
+  int    best     = 0;
+  double best_a = 0, best_b = 0;
+  for (int i = 0; i < K3_GRID; ++i) {
+    double b   = (n_ * sxy_[i] - sx_ * sy_[i]) / denom;  // K2
+    double a   = (sy_[i] - b * sx_) / n_;                 // log(K1)
+    double sse = syy_[i] - 2 * a * sy_[i] - 2 * b * sxy_[i] + n_ * a * a + 2 * a * b * sx_ +
+                 b * b * sxx_;
+    if (sse < best_sse) {
+      best_sse = sse;
+      best     = i;
+      best_a   = a;
+      best_b   = b;
+    }
+  }
+
+  r.ok  = true;
+  r.K1  = std::exp(best_a);
+  r.K2  = best_b;
+  r.K3  = k3_at(best);
+  r.rms = std::sqrt(std::max(best_sse, 0.0) / n_);
+  if (u_max_ - u_min_ < 0.05)
+    r.message = "hover throttle range is small, K3 is poorly determined. Add flights with a "
+                "different payload.";
+  else if (best == 0 || best == K3_GRID - 1)
+    r.message = "K3 hit the end of [0, 1], check the data";
+  return r;
+}
+
+bool ThrustCalibrator::save(const std::string &path) const {
+  FILE *f = fopen(path.c_str(), "w");
+  if (!f) return false;
+
+  fprintf(f, "%s %d\n", STATS_MAGIC, K3_GRID);
+  fprintf(f, "%.17g %.17g %.17g %.17g %.17g %.17g %.17g\n", n_, sx_, sxx_, u_min_, u_max_,
+          volt_min_, volt_max_);
+  for (int i = 0; i < K3_GRID; ++i) fprintf(f, "%.17g %.17g %.17g\n", sy_[i], syy_[i], sxy_[i]);
+
+  return fclose(f) == 0;
+}
+
+bool ThrustCalibrator::load(const std::string &path) {
+  FILE *f = fopen(path.c_str(), "r");
+  if (!f) return false;
+
+  char   magic[32];
+  int    grid = 0;
+  double n, sx, sxx, u_min, u_max, volt_min, volt_max;
+  double sy[K3_GRID], syy[K3_GRID], sxy[K3_GRID];
+  bool   ok = fscanf(f, "%31s %d", magic, &grid) == 2 && std::string(magic) == STATS_MAGIC &&
+            grid == K3_GRID &&
+            fscanf(f, "%lf %lf %lf %lf %lf %lf %lf", &n, &sx, &sxx, &u_min, &u_max, &volt_min,
+                   &volt_max) == 7;
+  for (int i = 0; ok && i < K3_GRID; ++i)
+    ok = fscanf(f, "%lf %lf %lf", &sy[i], &syy[i], &sxy[i]) == 3;
+  fclose(f);
+  if (!ok) return false;
+
+  n_ += n;
+  sx_ += sx;
+  sxx_ += sxx;
+  for (int i = 0; i < K3_GRID; ++i) {
+    sy_[i] += sy[i];
+    syy_[i] += syy[i];
+    sxy_[i] += sxy[i];
+  }
+  u_min_    = std::min(u_min_, u_min);
+  u_max_    = std::max(u_max_, u_max);
+  volt_min_ = std::min(volt_min_, volt_min);
+  volt_max_ = std::max(volt_max_, volt_max);
+  return true;
+}
@@ -0,0 +1,70 @@
+#ifndef __THRUST_CALIBRATOR_H
+#define __THRUST_CALIBRATOR_H
+
+#include <string>
+
+/*
+  Fits the thrust model of ctrl_param_fpv.yaml
+
+      F = K1 * V^K2 * (K3 * u^2 + (1 - K3) * u)
+
+  from hover data, in constant memory. Setpoints u, battery voltages V and (optionally) the
+  body z specific force a_z are averaged over intervals of about a second. Each interval
+  gives one sample (u, V, F = mass * a_z, or mass * g without IMU).
+
+  Taking logs, log(F) - log(K3 * u^2 + (1 - K3) * u) = log(K1) + K2 * log(V) is linear in
+  (log(K1), K2) once K3 is fixed. So for every K3 on a grid the sums of a linear least squares fit
+  are accumulated, and fit() picks the K3 with the smallest residual. The statistics of several
+  flights add up, save() and load() carry them over between flights. K3 is only identifiable
+  with different hover throttles, i.e. flights with different payloads.
+*/
+class ThrustCalibrator {
+ public:
+  static constexpr int K3_GRID = 201;  // K3 = 0, 0.005, ..., 1
+
+  struct Result {
+    bool        ok;
+    std::string message;  // why the fit is not ok, or a warning
+    double      K1, K2, K3;
+    double      rms;      // of the log residual, i.e. the relative thrust error
+    double      samples;
+    double      u_min, u_max, volt_min, volt_max;
+  };
+
+  ThrustCalibrator(double mass, double gra, double interval);
+
+  void set_mass(double mass) { mass_ = mass; }
+
+  // Time stamped streams, in any order. Each call may close the current averaging interval.
+  void add_setpoint(double t, double thrust);
+  void add_voltage(double t, double volt);
+  void add_accel(double t, double acc_z);
+  void flush();  // close the current interval, e.g. at the end of a hover sequence
+
+  // One averaged sample, F in N
+  void add_sample(double u, double volt, double force);
+
+  Result fit() const;
+  double samples() const { return n_; }
+
+  bool save(const std::string &path) const;
+  bool load(const std::string &path);  // adds to the present statistics
+
+ private:
+  double mass_, gra_, interval_;
+
+  // current interval
+  double interval_start_;
+  double u_sum_, volt_sum_, acc_sum_;
+  int    u_cnt_, volt_cnt_, acc_cnt_;
+
+  // x = log(V), y = log(F) - log(h(u; K3))
+  double n_, sx_, sxx_;
+  double sy_[K3_GRID], syy_[K3_GRID], sxy_[K3_GRID];
+  double u_min_, u_max_, volt_min_, volt_max_;
+
+  void   tick(double t);
+  static double k3_at(int i) { return (double)i / (K3_GRID - 1); }
+};
+
+#endif
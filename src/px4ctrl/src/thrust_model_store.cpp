@@ -0,0 +1,112 @@
+#include "thrust_model_store.h"
+
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <cmath>
+
+#include <ros/ros.h>
+#include <yaml-cpp/yaml.h>
+
+// A hand-edited or corrupted entry must not reach the controller, log(K1) and the divisions by
+// thr2acc, mass and volt need positive values
+static bool is_valid(const ThrustModelState &s) {
+  if (!(std::isfinite(s.volt) && s.volt > 0 && std::isfinite(s.mass) && s.mass > 0 &&
+        std::isfinite(s.thr2acc) && s.thr2acc > 0 && std::isfinite(s.P) && s.P >= 0))
+    return false;
+  if (!s.has_K) return true;
+  return std::isfinite(s.K(0)) && s.K(0) > 0 && std::isfinite(s.K(1)) && std::isfinite(s.K(2)) &&
+         s.K_var.allFinite() && (s.K_var.array() >= 0).all();
+}
+
+bool ThrustModelStore::load() {
+  states_.clear();
+
+  YAML::Node root;
+  try {
+    root = YAML::LoadFile(path_);
+  } catch (const YAML::Exception &e) {
+    return false;
+  }
+  if (!root.IsMap()) return false;
+
+  try {
+    for (YAML::const_iterator it = root.begin(); it != root.end(); ++it) {
+      const YAML::Node &n = it->second;
+      ThrustModelState  s;
+      s.volt    = n["volt"].as<double>();
+      s.mass    = n["mass"].as<double>();
+      s.thr2acc = n["thr2acc"].as<double>();
+      s.P       = n["P"].as<double>();
+      s.has_K   = n["K1"].IsDefined();
+      s.K.setZero();
+      s.K_var.setZero();
+      if (s.has_K) {
+        s.K << n["K1"].as<double>(), n["K2"].as<double>(), n["K3"].as<double>();
+        for (int i = 0; i < 3; ++i) s.K_var(i) = n["K_var"][i].as<double>();
+      }
+      std::string key = it->first.as<std::string>();
+      if (!is_valid(s)) {
+        ROS_WARN("[px4ctrl] Invalid thrust model of %s in %s, ignored.", key.c_str(),
+                 path_.c_str());
+        continue;
+      }
+      states_[key] = s;
+    }
+  } catch (const YAML::Exception &e) {
+    states_.clear();
+    return false;
+  }
+  return true;
+}
+
+bool ThrustModelStore::save() const {
+  YAML::Emitter out;
+  out.SetDoublePrecision(9);
+  out << YAML::BeginMap;
+  for (const auto &kv : states_) {
+    const ThrustModelState &s = kv.second;
+    out << YAML::Key << kv.first << YAML::Value << YAML::BeginMap;
+    out << YAML::Key << "volt" << YAML::Value << s.volt;
+    out << YAML::Key << "mass" << YAML::Value << s.mass;
+    out << YAML::Key << "thr2acc" << YAML::Value << s.thr2acc;
+    out << YAML::Key << "P" << YAML::Value << s.P;
+    if (s.has_K) {
+      out << YAML::Key << "K1" << YAML::Value << s.K(0);
+      out << YAML::Key << "K2" << YAML::Value << s.K(1);
+      out << YAML::Key << "K3" << YAML::Value << s.K(2);
+      out << YAML::Key << "K_var" << YAML::Value << YAML::Flow << YAML::BeginSeq << s.K_var(0)
+          << s.K_var(1) << s.K_var(2) << YAML::EndSeq;
+    }
+    out << YAML::EndMap;
+  }
+  out << YAML::EndMap;
+
+  // Write a temporary file, sync it and rename it, so that neither a crash nor a power cut leaves
+  // half a file or an empty one behind
+  std::string tmp = path_ + ".tmp";
+  FILE       *f   = fopen(tmp.c_str(), "w");
+  if (!f) return false;
+  bool ok = fputs(out.c_str(), f) >= 0 && fputc('\n', f) != EOF && fflush(f) == 0 &&
+            fsync(fileno(f)) == 0;
+  ok      = fclose(f) == 0 && ok;
+  if (!ok || rename(tmp.c_str(), path_.c_str()) != 0) return false;
+
+  // and the directory entry of the rename
+  std::string dir_path = path_;
+  int         dir      = open(dirname(&dir_path[0]), O_RDONLY | O_DIRECTORY);
+  if (dir >= 0) {
+    fsync(dir);
+    close(dir);
+  }
+  return true;
+}
+
+bool ThrustModelStore::find(const std::string &key, ThrustModelState &s) const {
+  auto it = states_.find(key);
+  if (it == states_.end()) return false;
+  s = it->second;
+  return true;
+}
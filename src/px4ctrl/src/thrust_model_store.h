@@ -0,0 +1,44 @@
+#ifndef __THRUST_MODEL_STORE_H
+#define __THRUST_MODEL_STORE_H
+
+/*
+  Persists the estimated thrust model across flights, so that the next takeoff starts from the
+  model the last flight converged to instead of hover_percentage. PX4CtrlFSM saves it at disarm
+  and hands it to the controller at the next AUTO_TAKEOFF / AUTO_HOVER. The file is a small YAML
+  map with one entry per airframe and battery, e.g. "fpv/4S".
+*/
+
+#include <map>
+#include <string>
+
+#include <Eigen/Dense>
+
+struct ThrustModelState {
+  double          volt;     // battery voltage at the end of the estimate
+  double          mass;     // param mass, thr2acc scales with its inverse
+  double          thr2acc;  // the linear model
+  double          P;
+  bool            has_K;    // K1, K2, K3 were estimated (accurate_thrust_model)
+  Eigen::Vector3d K;
+  Eigen::Vector3d K_var;    // diagonal of the covariance, see ControlBase::thr_model_P_
+};
+
+class ThrustModelStore {
+ public:
+  explicit ThrustModelStore(const std::string &path) : path_(path) {}
+
+  bool load();  // false if the file is missing or broken, the store is empty then. Entries
+                // with non-finite or out of range values are skipped.
+  bool save() const;
+
+  bool find(const std::string &key, ThrustModelState &s) const;
+  void set(const std::string &key, const ThrustModelState &s) { states_[key] = s; }
+
+  const std::string &path() const { return path_; }
+
+ private:
+  std::string                             path_;
+  std::map<std::string, ThrustModelState> states_;
+};
+
+#endif
@@ -0,0 +1,249 @@
+#include "vibration_analyzer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+VibrationAnalyzer::VibrationAnalyzer(double sample_rate, double min_freq, double summary_rate)
+    : fs_(sample_rate)
+    , head_(0)
+    , tail_(0)
+    , dropped_(0)
+    , samples_(0)
+    , next_fft_(FFT_SIZE)
+    , next_summary_(FFT_SIZE)
+    , have_spectrum_(false)
+    , running_(false)
+    , have_summary_(false)
+    , peak_seq_(0)
+    , notch_seq_(0) {
+  k_min_ = std::min(std::max(2, (int)std::ceil(min_freq * FFT_SIZE / fs_)), BINS - 2);
+  summary_interval_ =
+      summary_rate > 0 ? std::max<uint64_t>(1, (uint64_t)std::lround(fs_ / summary_rate)) : HOP;
+
+  for (int n = 0; n < FFT_SIZE; ++n) {
+    window_[n] = 0.5 * (1 - std::cos(2 * M_PI * n / FFT_SIZE));
+
+    int r = 0;
+    for (int b = 1, m = FFT_SIZE >> 1; m > 0; b <<= 1, m >>= 1)
+      if (n & b) r |= m;
+    bitrev_[n] = r;
+  }
+  tw_re_[0] = 1;
+  tw_im_[0] = 0;
+  for (int h = 1; h < FFT_SIZE; h <<= 1) {
+    for (int j = 0; j < h; ++j) {
+      tw_re_[h + j] = std::cos(M_PI * j / h);
+      tw_im_[h + j] = -std::sin(M_PI * j / h);
+    }
+  }
+
+  for (int a = 0; a < 3; ++a)
+    for (int k = 0; k < BINS; ++k) pow_[a][k] = 0;
+  summary_ = VibrationSpectrum();
+}
+
+void VibrationAnalyzer::push(const Eigen::Vector3d &a) {
+  uint64_t h = head_.load(std::memory_order_relaxed);
+  if (h - tail_.load(std::memory_order_acquire) >= (uint64_t)RING) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  float *slot = ring_[h % RING];
+  slot[0]     = (float)a(0);
+  slot[1]     = (float)a(1);
+  slot[2]     = (float)a(2);
+  head_.store(h + 1, std::memory_order_release);
+}
+
+void VibrationAnalyzer::update_notches(AccelFilter &f) {
+  if (f.notches() == 0) return;
+  if (peak_seq_.load(std::memory_order_acquire) == notch_seq_) return;
+
+  // Retried at the next sample if the analyzer holds the lock
+  std::unique_lock<std::mutex> lock(mtx_, std::try_to_lock);
+  if (!lock.owns_lock()) return;
+  double freq[VibrationSpectrum::MAX_PEAKS];
+  int    n = std::min(summary_.peaks, f.notches());
+  for (int i = 0; i < n; ++i) freq[i] = summary_.peak_freq[i];
+  notch_seq_ = peak_seq_.load(std::memory_order_relaxed);
+  lock.unlock();
+
+  // Ascending, so that a notch keeps following the same peak when their strengths swap
+  for (int i = 1; i < n; ++i)
+    for (int j = i; j > 0 && freq[j] < freq[j - 1]; --j) std::swap(freq[j], freq[j - 1]);
+  for (int i = 0; i < n; ++i) f.set_notch(i, freq[i]);
+}
+
+void VibrationAnalyzer::start() {
+  if (thread_.joinable()) return;
+  running_ = true;
+  thread_  = std::thread(&VibrationAnalyzer::run, this);
+}
+
+void VibrationAnalyzer::stop() {
+  running_ = false;
+  if (thread_.joinable()) thread_.join();
+}
+
+void VibrationAnalyzer::run() {
+  // Wake up about twice per hop, the ring holds many hops
+  const std::chrono::microseconds idle((int64_t)(0.5e6 * HOP / fs_));
+  while (running_.load(std::memory_order_relaxed)) {
+    analyze();
+    std::this_thread::sleep_for(idle);
+  }
+}
+
+bool VibrationAnalyzer::analyze() {
+  uint64_t h = head_.load(std::memory_order_acquire);
+  uint64_t t = tail_.load(std::memory_order_relaxed);
+  for (; t != h; ++t) {
+    const float *slot = ring_[t % RING];
+    float       *dst  = hist_[samples_ % FFT_SIZE];
+    dst[0]            = slot[0];
+    dst[1]            = slot[1];
+    dst[2]            = slot[2];
+    samples_++;
+    if (samples_ >= next_fft_) {
+      transform();
+      next_fft_ += HOP;
+    }
+  }
+  tail_.store(t, std::memory_order_release);
+
+  if (!have_spectrum_ || samples_ < next_summary_) return false;
+  next_summary_ = samples_ + summary_interval_;
+
+  VibrationSpectrum s;
+  summarize(s);
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    summary_      = s;
+    have_summary_ = true;
+    if (s.peaks > 0) peak_seq_.fetch_add(1, std::memory_order_release);
+  }
+  if (on_summary) on_summary(s);
+  return true;
+}
+
+bool VibrationAnalyzer::latest(VibrationSpectrum &s) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  s = summary_;
+  return have_summary_;
+}
+
+// In place radix-2, the input is already in bit-reversed order
+void VibrationAnalyzer::fft(double *re, double *im) const {
+  for (int h = 1; h < FFT_SIZE; h <<= 1) {
+    const double *wr = tw_re_ + h;
+    const double *wi = tw_im_ + h;
+    for (int i = 0; i < FFT_SIZE; i += 2 * h) {
+      double *ar = re + i, *ai = im + i;
+      double *br = ar + h, *bi = ai + h;
+      for (int j = 0; j < h; ++j) {
+        double tr = br[j] * wr[j] - bi[j] * wi[j];
+        double ti = br[j] * wi[j] + bi[j] * wr[j];
+        br[j]     = ar[j] - tr;
+        bi[j]     = ai[j] - ti;
+        ar[j] += tr;
+        ai[j] += ti;
+      }
+    }
+  }
+}
+
+void VibrationAnalyzer::transform() {
+  double mean[3] = {0, 0, 0};
+  for (int n = 0; n < FFT_SIZE; ++n)
+    for (int a = 0; a < 3; ++a) mean[a] += hist_[n][a];
+  for (int a = 0; a < 3; ++a) mean[a] /= FFT_SIZE;
+
+  // x + iy in the first transform, z in the second
+  for (int n = 0; n < FFT_SIZE; ++n) {
+    const float *x = hist_[(samples_ + n) % FFT_SIZE];
+    int          r = bitrev_[n];
+    re_[0][r]      = (x[0] - mean[0]) * window_[n];
+    im_[0][r]      = (x[1] - mean[1]) * window_[n];
+    re_[1][r]      = (x[2] - mean[2]) * window_[n];
+    im_[1][r]      = 0;
+  }
+  fft(re_[0], im_[0]);
+  fft(re_[1], im_[1]);
+
+  // Squared amplitude of a sinusoid centered in the bin, the Hann window has a gain of 1/2
+  const double scale = 16.0 / ((double)FFT_SIZE * FFT_SIZE);
+  const double w     = have_spectrum_ ? AVG_WEIGHT : 1.0;
+  for (int k = 1; k < BINS; ++k) {
+    double cr = re_[0][k], ci = im_[0][k];
+    double nr = re_[0][FFT_SIZE - k], ni = im_[0][FFT_SIZE - k];
+    double xr = 0.5 * (cr + nr), xi = 0.5 * (ci - ni);
+    double yr = 0.5 * (ci + ni), yi = -0.5 * (cr - nr);
+    double p[3] = {(xr * xr + xi * xi) * scale, (yr * yr + yi * yi) * scale,
+                   (re_[1][k] * re_[1][k] + im_[1][k] * im_[1][k]) * scale};
+    for (int a = 0; a < 3; ++a) pow_[a][k] += w * (p[a] - pow_[a][k]);
+  }
+  have_spectrum_ = true;
+}
+
+void VibrationAnalyzer::summarize(VibrationSpectrum &s) {
+  s.samples = samples_;
+  s.dropped = dropped_.load(std::memory_order_relaxed);
+
+  // The Hann window spreads a sinusoid of amplitude A over bins summing to 1.5 A^2, i.e. to
+  // 3 times its mean square
+  for (int a = 0; a < 3; ++a) {
+    double sum = 0;
+    for (int k = k_min_; k < BINS; ++k) sum += pow_[a][k];
+    s.rms[a] = std::sqrt(sum / 3);
+  }
+
+  const int per_band = BINS / VibrationSpectrum::BANDS;
+  s.band_width       = 0.5 * fs_ / VibrationSpectrum::BANDS;
+  for (int b = 0; b < VibrationSpectrum::BANDS; ++b) {
+    double sum = 0;
+    for (int k = b * per_band; k < (b + 1) * per_band; ++k)
+      sum += pow_[0][k] + pow_[1][k] + pow_[2][k];
+    s.band_rms[b] = std::sqrt(sum / 3);
+  }
+
+  // Peaks stand PEAK_SNR above the median, which is the broadband noise floor
+  int n = 0;
+  for (int k = k_min_; k < BINS; ++k) sorted_[n++] = pow_[0][k] + pow_[1][k] + pow_[2][k];
+  std::nth_element(sorted_, sorted_ + n / 2, sorted_ + n);
+  const double threshold = PEAK_SNR * std::max(sorted_[n / 2], 1e-12);
+
+  int    peak_k[VibrationSpectrum::MAX_PEAKS];
+  double peak_p[VibrationSpectrum::MAX_PEAKS];
+  s.peaks = 0;
+  for (int k = k_min_; k < BINS - 1; ++k) {
+    double p  = pow_[0][k] + pow_[1][k] + pow_[2][k];
+    double pl = pow_[0][k - 1] + pow_[1][k - 1] + pow_[2][k - 1];
+    double pr = pow_[0][k + 1] + pow_[1][k + 1] + pow_[2][k + 1];
+    if (p <= threshold || p <= pl || p < pr) continue;
+
+    // insert, strongest first
+    int i = s.peaks < VibrationSpectrum::MAX_PEAKS ? s.peaks++ : VibrationSpectrum::MAX_PEAKS;
+    for (; i > 0 && peak_p[i - 1] < p; --i) {
+      if (i < VibrationSpectrum::MAX_PEAKS) {
+        peak_k[i] = peak_k[i - 1];
+        peak_p[i] = peak_p[i - 1];
+      }
+    }
+    if (i < VibrationSpectrum::MAX_PEAKS) {
+      peak_k[i] = k;
+      peak_p[i] = p;
+    }
+  }
+
+  // The log of the Hann main lobe is close to a parabola
+  for (int i = 0; i < s.peaks; ++i) {
+    int    k = peak_k[i];
+    double l = std::log(std::max(pow_[0][k - 1] + pow_[1][k - 1] + pow_[2][k - 1], 1e-30));
+    double c = std::log(peak_p[i]);
+    double r = std::log(std::max(pow_[0][k + 1] + pow_[1][k + 1] + pow_[2][k + 1], 1e-30));
+    double d = 0.5 * (l - r) / (l - 2 * c + r);
+    s.peak_freq[i] = (k + d) * fs_ / FFT_SIZE;
+    s.peak_amp[i]  = std::sqrt(std::exp(c - 0.25 * (l - r) * d));
+  }
+}
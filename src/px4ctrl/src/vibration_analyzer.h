@@ -0,0 +1,111 @@
+#ifndef __VIBRATION_ANALYZER_H
+#define __VIBRATION_ANALYZER_H
+
+/*
+  Vibration spectrum of the accelerometer, computed off the control path.
+
+  The IMU callback push()es every sample into a single-producer single-consumer ring, which costs
+  two atomic accesses and a store. A background thread drains the ring into a sliding window and,
+  every HOP samples, runs a Hann-windowed FFT of FFT_SIZE points: x and y packed into one complex
+  transform, z in a second one. The power spectra are averaged exponentially, and the strongest
+  local maxima above min_freq (the motor frequency and its harmonics) are located to a fraction of
+  a bin by Gaussian interpolation. All buffers are members, the thread never allocates.
+
+  At summary_rate (counted in samples, so offline tools get the same cadence) a VibrationSpectrum
+  is handed to on_summary. update_notches() moves the notches of an AccelFilter onto the peaks;
+  it is meant to be called from the thread that owns the filter and never blocks it.
+
+  This header has no ROS dependency so that the analyzer can run in the offline tools.
+*/
+
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include <Eigen/Dense>
+
+#include "accel_filter.h"
+
+struct VibrationSpectrum {
+  static constexpr int MAX_PEAKS = AccelFilter::MAX_NOTCHES;
+  static constexpr int BANDS     = 16;
+
+  uint64_t samples;     // accelerometer samples analyzed so far
+  uint64_t dropped;     // samples lost because the ring was full
+  double   rms[3];      // m/s^2 per axis, above min_freq
+  int      peaks;
+  double   peak_freq[MAX_PEAKS];  // Hz, strongest first
+  double   peak_amp[MAX_PEAKS];   // m/s^2, amplitude of the sinusoid over all axes
+  double   band_width;            // Hz, band i covers [i, i + 1) * band_width
+  double   band_rms[BANDS];       // m/s^2, all axes
+};
+
+class VibrationAnalyzer {
+ public:
+  static constexpr int FFT_SIZE = 256;
+  static constexpr int HOP      = FFT_SIZE / 4;
+
+  VibrationAnalyzer(double sample_rate, double min_freq, double summary_rate);
+  ~VibrationAnalyzer() { stop(); }
+
+  // Producer side, the IMU callback
+  void push(const Eigen::Vector3d &a);
+  void update_notches(AccelFilter &f);
+
+  // Consumer side. start() calls analyze() on a background thread, offline tools may call
+  // analyze() themselves instead, but never both.
+  void start();
+  void stop();
+  bool analyze();  // true if a summary was produced
+
+  bool latest(VibrationSpectrum &s);  // false until the first summary
+
+  std::function<void(const VibrationSpectrum &)> on_summary;  // on the analyzer thread
+
+ private:
+  static constexpr int RING = 1024;
+  static constexpr int BINS = FFT_SIZE / 2;
+
+  static constexpr double PEAK_SNR   = 10.0;  // peak power over the median power above min_freq
+  static constexpr double AVG_WEIGHT = 0.3;   // of the latest spectrum in the average
+
+  double   fs_;
+  int      k_min_;
+  uint64_t summary_interval_;
+
+  // ring, written by push() only
+  float                 ring_[RING][3];
+  std::atomic<uint64_t> head_, tail_;
+  std::atomic<uint64_t> dropped_;
+
+  // analyzer state, touched by the analyzer thread only
+  float    hist_[FFT_SIZE][3];  // sliding window, hist_[samples_ % FFT_SIZE] is the oldest
+  uint64_t samples_, next_fft_, next_summary_;
+  bool     have_spectrum_;
+  double   window_[FFT_SIZE];
+  double   tw_re_[FFT_SIZE], tw_im_[FFT_SIZE];  // stage of half length h at [h, 2h)
+  int      bitrev_[FFT_SIZE];
+  double   re_[2][FFT_SIZE], im_[2][FFT_SIZE];
+  double   pow_[3][BINS];  // averaged, amplitude^2 of a sinusoid in the bin, per axis
+  double   sorted_[BINS];
+
+  std::thread       thread_;
+  std::atomic<bool> running_;
+
+  // handoff to latest() and update_notches()
+  std::mutex            mtx_;
+  VibrationSpectrum     summary_;
+  bool                  have_summary_;
+  std::atomic<uint32_t> peak_seq_;
+  uint32_t              notch_seq_;  // producer side, peak_seq_ applied last
+
+  void run();
+  void transform();
+  void fft(double *re, double *im) const;
+  void summarize(VibrationSpectrum &s);
+};
+
+#endif
@@ -0,0 +1,96 @@
+#include "work_stealing_pool.h"
+
+#include <algorithm>
+
+WorkStealingPool::WorkerSlot &WorkStealingPool::worker_slot() {
+  static thread_local WorkerSlot slot = {nullptr, -1};
+  return slot;
+}
+
+WorkStealingPool::WorkStealingPool(unsigned threads)
+    : queued_(0)
+    , pending_(0)
+    , next_queue_(0)
+    , stop_(false) {
+  if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+  for (unsigned i = 0; i < threads; ++i) queues_.emplace_back(new TaskQueue);
+  for (unsigned i = 0; i < threads; ++i) threads_.emplace_back(&WorkStealingPool::worker, this, i);
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    stop_ = true;
+  }
+  work_cv_.notify_all();
+  for (std::thread &t : threads_) t.join();
+}
+
+void WorkStealingPool::submit(std::function<void()> task) {
+  const WorkerSlot &self = worker_slot();
+  unsigned          q    = self.pool == this ? (unsigned)self.index  // own deque
+                                           : next_queue_++ % queues_.size();
+
+  pending_++;
+  {
+    std::lock_guard<std::mutex> lock(queues_[q]->m);
+    queues_[q]->tasks.push_back(std::move(task));
+  }
+  {
+    // under m_ so that a worker checking queued_ before waiting cannot miss the notification
+    std::lock_guard<std::mutex> lock(m_);
+    queued_++;
+  }
+  work_cv_.notify_one();
+}
+
+void WorkStealingPool::wait_idle() {
+  std::unique_lock<std::mutex> lock(m_);
+  idle_cv_.wait(lock, [this] { return pending_ == 0; });
+}
+
+bool WorkStealingPool::pop(unsigned self, std::function<void()> &task) {
+  {
+    TaskQueue                  &own = *queues_[self];
+    std::lock_guard<std::mutex> lock(own.m);
+    if (!own.tasks.empty()) {
+      task = std::move(own.tasks.back());
+      own.tasks.pop_back();
+      queued_--;
+      return true;
+    }
+  }
+  for (size_t i = 1; i < queues_.size(); ++i) {
+    TaskQueue                  &victim = *queues_[(self + i) % queues_.size()];
+    std::lock_guard<std::mutex> lock(victim.m);
+    if (!victim.tasks.empty()) {
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      queued_--;
+      return true;
+    }
+  }
+  return false;
+}
+
+void WorkStealingPool::worker(unsigned self) {
+  worker_slot() = {this, (int)self};
+
+  std::function<void()> task;
+  while (true) {
+    if (pop(self, task)) {
+      task();
+      task = nullptr;
+      if (--pending_ == 0) {
+        std::lock_guard<std::mutex> lock(m_);
+        idle_cv_.notify_all();
+      }
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(m_);
+    work_cv_.wait(lock, [this] { return stop_ || queued_ > 0; });
+    if (stop_ && queued_ == 0) return;
+  }
+}
@@ -0,0 +1,59 @@
+#ifndef __WORK_STEALING_POOL_H
+#define __WORK_STEALING_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+  Fixed size thread pool with one task deque per worker. A worker takes its own tasks from the
+  back (LIFO, cache friendly) and, when it runs dry, steals from the front of the others, so a
+  batch of uneven tasks (a diverging flight ends early, a good one runs to the end) keeps every
+  core busy until the batch is done.
+
+  Tasks submitted from inside a worker go to that worker's deque, others, including those from a
+  worker of another pool, are spread round robin.
+*/
+class WorkStealingPool {
+ public:
+  explicit WorkStealingPool(unsigned threads = 0);  // 0: one per hardware thread
+  ~WorkStealingPool();
+
+  void     submit(std::function<void()> task);
+  void     wait_idle();  // until every submitted task has finished
+  unsigned size() const { return (unsigned)threads_.size(); }
+
+ private:
+  struct TaskQueue {
+    std::mutex                        m;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  std::vector<std::unique_ptr<TaskQueue>> queues_;
+  std::vector<std::thread>                threads_;
+
+  std::mutex              m_;
+  std::condition_variable work_cv_;
+  std::condition_variable idle_cv_;
+  std::atomic<long>       queued_;   // in a deque, briefly negative when a steal beats submit()
+  std::atomic<size_t>     pending_;  // queued or running
+  std::atomic<unsigned>   next_queue_;
+  bool                    stop_;
+
+  bool pop(unsigned self, std::function<void()> &task);
+  void worker(unsigned self);
+
+  // Of the calling thread, shared by all pools, so the index is only valid if pool == this
+  struct WorkerSlot {
+    const WorkStealingPool *pool;
+    int                     index;
+  };
+  static WorkerSlot &worker_slot();
+};
+
+#endif
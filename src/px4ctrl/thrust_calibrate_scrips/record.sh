@@ -1 +1 @@
-rosbag record --tcpnodelay /mavros/battery /mavros/setpoint_raw/attitude /traj_start_trigger
+rosbag record --tcpnodelay /mavros/battery /mavros/setpoint_raw/attitude /mavros/imu/data /traj_start_trigger